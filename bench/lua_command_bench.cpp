@@ -0,0 +1,162 @@
+// Lua command latency benchmark.
+//
+// Loads the bundled command scripts into a LuaCommandEngine and times whole
+// invocations of dice, flip, sfx and vipjoke, including any resumptions,
+// against a chat connection that acknowledges instantly.
+// Handlers are taken from LuaCommandEngine::handlerFor, so cooldowns and
+// usage limits do not interfere.
+//
+// Usage: lua_command_bench [commands_dir=src/commands] [iterations=20000]
+// The interpreter is chosen at build time; compare backends by running the
+// benchmark from a `-Dlua_backend=lua` and a `-Dlua_backend=luajit` build.
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "seraphbot/core/chat_message.hpp"
+#include "seraphbot/core/command_parser.hpp"
+#include "seraphbot/core/lua_async.hpp"
+#include "seraphbot/core/lua_command_engine.hpp"
+#include "seraphbot/core/lua_compat.hpp"
+
+namespace {
+constexpr std::size_t c_default_iterations{20000};
+constexpr std::size_t c_warmup_iterations{200};
+
+struct Case {
+  std::string command;
+  std::vector<std::string_view> args;
+};
+
+struct Summary {
+  double mean{0};
+  double p50{0};
+  double p99{0};
+  double max{0};
+};
+
+auto summarize(std::vector<double> samples) -> Summary {
+  if (samples.empty()) {
+    return {};
+  }
+  std::ranges::sort(samples);
+  double total{0};
+  for (double sample : samples) {
+    total += sample;
+  }
+  auto at = [&samples](double quantile) {
+    auto idx = static_cast<std::size_t>(
+        quantile * static_cast<double>(samples.size() - 1));
+    return samples[idx];
+  };
+  return {.mean = total / static_cast<double>(samples.size()),
+          .p50  = at(0.50),
+          .p99  = at(0.99),
+          .max  = samples.back()};
+}
+
+auto printRow(const std::string &label, const Summary &summary,
+              const std::string &unit) -> void {
+  std::cout << std::format(
+      "{:<22} mean {:>10.3f}  p50 {:>10.3f}  p99 {:>10.3f}  max {:>10.3f} {}\n",
+      label, summary.mean, summary.p50, summary.p99, summary.max, unit);
+}
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  std::string commands_dir{"src/commands"};
+  std::size_t iterations{c_default_iterations};
+  try {
+    if (argc > 1) {
+      commands_dir = argv[1];
+    }
+    if (argc > 2) {
+      iterations = std::stoul(argv[2]);
+    }
+  } catch (const std::exception &) {
+    std::cerr << "usage: lua_command_bench [commands_dir] [iterations]\n";
+    return EXIT_FAILURE;
+  }
+
+  // Continuations of suspended commands run here, on this thread, once the
+  // handler has returned, the way the executor would run them
+  std::deque<std::function<void()>> continuations;
+  sbot::core::LuaCommandEngine engine;
+  engine.setBytecodeCache({});
+  engine.setStorePath({});
+  engine.setAsyncRuntime({.io_context = nullptr,
+                          .schedule =
+                              [&continuations](std::function<void()> task) {
+                                continuations.push_back(std::move(task));
+                                return true;
+                              },
+                          .http_get = {}});
+  engine.initialize();
+  if (engine.loadCommandsFromDirectory(commands_dir) == 0) {
+    std::cerr << std::format("no commands loaded from {}\n", commands_dir);
+    return EXIT_FAILURE;
+  }
+
+  sbot::core::ChatMessage message;
+  message.user       = "benchmark";
+  message.badges     = {"vip"};
+  message.badge_mask = sbot::core::badge::c_vip;
+  sbot::core::ReplyFn reply_fn = [](const std::string & /*text*/,
+                                    std::function<void(bool)> on_sent) {
+    if (on_sent) {
+      on_sent(true);
+    }
+  };
+
+  // sfx looks up a sound that does not exist, so nothing is played
+  const std::vector<Case> cases{{.command = "dice", .args = {"20"}},
+                                {.command = "flip", .args = {}},
+                                {.command = "sfx", .args = {"nosuchsound"}},
+                                {.command = "vipjoke", .args = {}}};
+
+  std::cout << std::format("Lua command benchmark: {} backend, {} iterations "
+                           "({} warmup)\n",
+                           sbot::core::lua_compat::c_backend_name, iterations,
+                           c_warmup_iterations);
+  for (const auto &bench_case : cases) {
+    auto handler = engine.handlerFor(bench_case.command);
+    if (!handler) {
+      std::cerr << std::format("command {} not found in {}\n",
+                               bench_case.command, commands_dir);
+      return EXIT_FAILURE;
+    }
+    sbot::core::CommandContext ctx{message, bench_case.command,
+                                   bench_case.args, reply_fn};
+
+    std::vector<double> wall_us;
+    wall_us.reserve(iterations);
+    for (std::size_t i = 0; i < c_warmup_iterations + iterations; ++i) {
+      auto start = std::chrono::steady_clock::now();
+      handler(ctx);
+      while (!continuations.empty()) {
+        auto next = std::move(continuations.front());
+        continuations.pop_front();
+        next();
+      }
+      auto end = std::chrono::steady_clock::now();
+      if (i >= c_warmup_iterations) {
+        wall_us.push_back(
+            std::chrono::duration<double, std::micro>(end - start).count());
+      }
+    }
+    printRow(bench_case.command, summarize(std::move(wall_us)), "us");
+  }
+  engine.closeAsync();
+  return EXIT_SUCCESS;
+}
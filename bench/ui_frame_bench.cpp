@@ -0,0 +1,267 @@
+// Headless UI frame benchmark.
+//
+// Drives ImGuiManager::manageAuth/manageDiscord/manageChat against a null
+// renderer (no GLFW window, no GL context) with a chat log of N synthetic
+// messages and reports CPU time and heap allocations per frame.
+//
+// Usage: ui_frame_bench [messages=2000] [frames=600] [emote_dir]
+// With `emote_dir`, every fifth message carries an emote fragment that is
+// served from that directory through DirectoryEmoteFetcher.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <format>
+#include <imgui.h>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "seraphbot/core/app_state.hpp"
+#include "seraphbot/core/chat_message.hpp"
+#include "seraphbot/core/connection_manager.hpp"
+#include "seraphbot/core/twitch_service.hpp"
+#include "seraphbot/discord/notifications.hpp"
+#include "seraphbot/tw/config.hpp"
+#include "seraphbot/ui/emote_fetcher.hpp"
+#include "seraphbot/ui/imgui_backend_null.hpp"
+#include "seraphbot/ui/imgui_manager.hpp"
+#include "seraphbot/viewmodels/auth_viewmodel.hpp"
+#include "seraphbot/viewmodels/chat_viewmodel.hpp"
+#include "seraphbot/viewmodels/discord_viewmodel.hpp"
+
+namespace {
+std::atomic<std::uint64_t> g_new_count{0};
+std::atomic<std::uint64_t> g_new_bytes{0};
+std::atomic<std::uint64_t> g_imgui_count{0};
+
+constexpr std::size_t c_default_messages{2000};
+constexpr std::size_t c_default_frames{600};
+constexpr std::size_t c_warmup_frames{10};
+
+auto imguiAlloc(std::size_t size, void * /*user_data*/) -> void * {
+  g_imgui_count.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size);
+}
+
+auto imguiFree(void *ptr, void * /*user_data*/) -> void { std::free(ptr); }
+
+auto threadCpuTime() -> std::chrono::nanoseconds {
+#if defined(__linux__) || defined(__APPLE__)
+  timespec now{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return std::chrono::seconds{now.tv_sec} +
+         std::chrono::nanoseconds{now.tv_nsec};
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch());
+#endif
+}
+
+auto makeMessage(std::size_t index, bool with_emote)
+    -> sbot::core::ChatMessage {
+  static const std::vector<std::string> c_colors{"#FF4500", "#1E90FF",
+                                                 "#9ACD32", "#DAA520"};
+  static const std::vector<std::string> c_words{
+      "hello", "chat", "that", "was", "a", "great", "play", "pog", "gg", "lol"};
+
+  sbot::core::ChatMessage msg;
+  msg.user  = std::format("viewer{}", index % 97);
+  msg.color = c_colors[index % c_colors.size()];
+  if (index % 7 == 0) {
+    msg.badges.emplace_back("subscriber");
+  }
+  std::size_t words = 3 + (index % 20);
+  for (std::size_t i = 0; i < words; ++i) {
+    if (i > 0) {
+      msg.text += ' ';
+    }
+    msg.text += c_words[(index + i) % c_words.size()];
+  }
+  if (with_emote) {
+    msg.fragments.push_back({.type = sbot::core::ChatFragment::Type::Text,
+                             .text = msg.text + " ",
+                             .emote_id = {}});
+    msg.fragments.push_back({.type = sbot::core::ChatFragment::Type::Emote,
+                             .text = "Kappa",
+                             .emote_id = "25"});
+    msg.text += " Kappa";
+  }
+  return msg;
+}
+
+struct Summary {
+  double mean{0};
+  double p50{0};
+  double p99{0};
+  double max{0};
+};
+
+auto summarize(std::vector<double> samples) -> Summary {
+  if (samples.empty()) {
+    return {};
+  }
+  std::ranges::sort(samples);
+  double total{0};
+  for (double sample : samples) {
+    total += sample;
+  }
+  auto at = [&samples](double quantile) {
+    auto idx = static_cast<std::size_t>(
+        quantile * static_cast<double>(samples.size() - 1));
+    return samples[idx];
+  };
+  return {.mean = total / static_cast<double>(samples.size()),
+          .p50  = at(0.50),
+          .p99  = at(0.99),
+          .max  = samples.back()};
+}
+
+auto printRow(const std::string &label, const Summary &summary,
+              const std::string &unit) -> void {
+  std::cout << std::format(
+      "{:<22} mean {:>10.3f}  p50 {:>10.3f}  p99 {:>10.3f}  max {:>10.3f} {}\n",
+      label, summary.mean, summary.p50, summary.p99, summary.max, unit);
+}
+} // namespace
+
+// Counts every operator new in the process; the I/O threads are idle here
+auto operator new(std::size_t size) -> void * {
+  g_new_count.fetch_add(1, std::memory_order_relaxed);
+  g_new_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc{};
+}
+auto operator new[](std::size_t size) -> void * { return operator new(size); }
+auto operator delete(void *ptr) noexcept -> void { std::free(ptr); }
+auto operator delete[](void *ptr) noexcept -> void { std::free(ptr); }
+auto operator delete(void *ptr, std::size_t /*size*/) noexcept -> void {
+  std::free(ptr);
+}
+auto operator delete[](void *ptr, std::size_t /*size*/) noexcept -> void {
+  std::free(ptr);
+}
+
+auto main(int argc, char **argv) -> int {
+  std::size_t message_count{c_default_messages};
+  std::size_t frame_count{c_default_frames};
+  std::string emote_dir;
+  try {
+    if (argc > 1) {
+      message_count = std::stoul(argv[1]);
+    }
+    if (argc > 2) {
+      frame_count = std::stoul(argv[2]);
+    }
+    if (argc > 3) {
+      emote_dir = argv[3];
+    }
+  } catch (const std::exception &) {
+    std::cerr << "usage: ui_frame_bench [messages] [frames] [emote_dir]\n";
+    return EXIT_FAILURE;
+  }
+
+  ImGui::SetAllocatorFunctions(imguiAlloc, imguiFree);
+
+  sbot::tw::ClientConfig cfg;
+  auto conn = std::make_shared<sbot::core::ConnectionManager>(1);
+  sbot::core::AppState app_state;
+  sbot::core::TwitchService tw_service{conn, cfg};
+  sbot::discord::Notifications notifications{conn, cfg};
+  notifications.setWebhookUrl("/api/webhooks/benchmark");
+
+  sbot::ui::ImGuiManager ui{std::make_unique<sbot::ui::ImGuiBackendNull>(),
+                            app_state};
+  ImGui::GetIO().IniFilename = nullptr;
+  if (!emote_dir.empty()) {
+    ui.enableEmotes(
+        std::make_unique<sbot::ui::DirectoryEmoteFetcher>(emote_dir));
+  }
+
+  sbot::viewmodels::AuthVM auth_vm{tw_service, *conn};
+  sbot::viewmodels::DiscordVM discord_vm{*conn, notifications};
+  sbot::viewmodels::ChatVM chat_vm{tw_service};
+
+  // Pin the viewmodels to a connected session; the service version never
+  // moves afterwards, so syncFrom() keeps these values.
+  auth_vm.syncFrom();
+  chat_vm.syncFrom();
+  constexpr auto c_connected = sbot::core::TwitchService::State::ChatConnected;
+  auth_vm.snapshot.state        = c_connected;
+  auth_vm.snapshot.current_user = "benchmark";
+  chat_vm.snapshot.state        = c_connected;
+
+  for (std::size_t i = 0; i < message_count; ++i) {
+    bool with_emote = !emote_dir.empty() && i % 5 == 0;
+    app_state.pushChatMessage(makeMessage(i, with_emote));
+  }
+
+  std::vector<double> cpu_ms;
+  std::vector<double> wall_ms;
+  std::vector<double> new_counts;
+  std::vector<double> new_kib;
+  std::vector<double> imgui_counts;
+  cpu_ms.reserve(frame_count);
+  wall_ms.reserve(frame_count);
+  new_counts.reserve(frame_count);
+  new_kib.reserve(frame_count);
+  imgui_counts.reserve(frame_count);
+
+  for (std::size_t frame = 0; frame < c_warmup_frames + frame_count; ++frame) {
+    auto cpu_start   = threadCpuTime();
+    auto wall_start  = std::chrono::steady_clock::now();
+    auto new_start   = g_new_count.load(std::memory_order_relaxed);
+    auto bytes_start = g_new_bytes.load(std::memory_order_relaxed);
+    auto imgui_start = g_imgui_count.load(std::memory_order_relaxed);
+
+    ui.poll();
+    ui.beginFrame();
+    ui.manageDocking();
+    ui.manageFloating();
+    ui.manageAuth(auth_vm);
+    ui.manageDiscord(discord_vm);
+    ui.manageChat(chat_vm);
+    ui.endFrame();
+    ui.render();
+    ui.swapBuffers();
+
+    auto cpu_end  = threadCpuTime();
+    auto wall_end = std::chrono::steady_clock::now();
+    if (frame < c_warmup_frames) {
+      continue;
+    }
+    cpu_ms.push_back(
+        std::chrono::duration<double, std::milli>(cpu_end - cpu_start).count());
+    wall_ms.push_back(
+        std::chrono::duration<double, std::milli>(wall_end - wall_start)
+            .count());
+    new_counts.push_back(static_cast<double>(
+        g_new_count.load(std::memory_order_relaxed) - new_start));
+    new_kib.push_back(static_cast<double>(
+                          g_new_bytes.load(std::memory_order_relaxed) -
+                          bytes_start) /
+                      1024.0);
+    imgui_counts.push_back(static_cast<double>(
+        g_imgui_count.load(std::memory_order_relaxed) - imgui_start));
+  }
+
+  std::cout << std::format("UI frame benchmark: {} messages, {} frames "
+                           "({} warmup){}\n",
+                           message_count, frame_count, c_warmup_frames,
+                           emote_dir.empty() ? "" : ", emotes enabled");
+  printRow("cpu time / frame", summarize(cpu_ms), "ms");
+  printRow("wall time / frame", summarize(wall_ms), "ms");
+  printRow("operator new / frame", summarize(new_counts), "allocs");
+  printRow("new bytes / frame", summarize(new_kib), "KiB");
+  printRow("ImGui allocs / frame", summarize(imgui_counts), "allocs");
+  return EXIT_SUCCESS;
+}
@@ -2,7 +2,12 @@
 #define SBOT_APPLICATION_HPP
 
 #include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 
 #include "seraphbot/core/command_parser.hpp"
@@ -12,9 +17,14 @@
 namespace sbot::core {
 class ConnectionManager;
 class AppState;
+class ChatScheduler;
 class CommandParser;
+class CommandExecutor;
+class CommandMetrics;
+class FileWatcher;
 class TwitchService;
 class LuaCommandEngine;
+struct LuaAsyncRuntime;
 } // namespace sbot::core
 namespace sbot::ui {
 class ImGuiBackend;
@@ -24,6 +34,8 @@ namespace sbot::viewmodels {
 struct AuthVM;
 struct ChatVM;
 struct DiscordVM;
+struct MetricsVM;
+struct ProfilerVM;
 } // namespace sbot::viewmodels
 namespace sbot::discord {
 class Notifications;
@@ -48,8 +60,23 @@ private:
   // Core
   std::shared_ptr<core::ConnectionManager> m_conn;
   std::unique_ptr<core::AppState> m_app_state;
+  // Outlives the parser and engine, which keep a raw pointer to it
+  std::unique_ptr<core::CommandMetrics> m_metrics;
+  // Periodic export to disk, off the UI thread; declared after m_metrics so
+  // it is waited for before the metrics go away
+  std::future<bool> m_metrics_export;
   std::unique_ptr<core::CommandParser> m_command_parser;
+  // Outlives the engine, which removes its timers on destruction
+  std::unique_ptr<core::ChatScheduler> m_scheduler;
   std::unique_ptr<core::LuaCommandEngine> m_command_engine;
+  std::unique_ptr<core::CommandExecutor> m_command_executor;
+  // Uses the executor, engine and parser, so it is destroyed before them
+  std::unique_ptr<core::FileWatcher> m_command_watcher;
+  // Changed command files not reloaded yet; at most one drain task is
+  // queued for them at a time
+  std::mutex m_reload_mutex;
+  std::set<std::filesystem::path> m_pending_reloads;
+  bool m_reload_queued{false};
   std::unique_ptr<core::TwitchService> m_tw_service;
   // Integrations
   std::unique_ptr<discord::Notifications> m_disc_not;
@@ -61,12 +88,23 @@ private:
   std::unique_ptr<viewmodels::AuthVM> m_auth_vm;
   std::unique_ptr<viewmodels::DiscordVM> m_discord_vm;
   std::unique_ptr<viewmodels::ChatVM> m_chat_vm;
+  std::unique_ptr<viewmodels::MetricsVM> m_metrics_vm;
+  std::unique_ptr<viewmodels::ProfilerVM> m_profiler_vm;
 
   auto initializeServices() -> bool;
   auto initializeDiscord() -> bool;
   auto initializeViewmodels() -> bool;
   auto initializeUi() -> bool;
   auto setupCallbacks() -> void;
+  auto watchCommands(const std::filesystem::path &commands_dir) -> void;
+  // Runs on the executor until no changed files are left
+  auto drainReloads() -> void;
+  // Reply function that records send latency for `command`, measured from
+  // the moment it is created
+  auto makeReply(std::string command) -> core::ReplyFn;
+  // Timers and HTTP for Lua commands that wait; continuations run on the
+  // command executor
+  auto makeLuaRuntime() -> core::LuaAsyncRuntime;
 
   // TODO: Implement temp hack properly
   auto handleSoundCommands(const std::string &text) -> void;
@@ -1,8 +1,10 @@
 #ifndef SBOT_CORE_AUDIO_SYSTEM_HPP
 #define SBOT_CORE_AUDIO_SYSTEM_HPP
 
+#include <chrono>
 #include <filesystem>
 #include <memory>
+#include <optional>
 #include <string>
 #include <unordered_set>
 #include <vector>
@@ -41,6 +43,10 @@ public:
                      const std::filesystem::path &directory) -> std::string;
   auto playSound(const std::filesystem::path &filepath, int volume = 70)
       -> bool;
+  // How long `filepath` plays for; nullopt if it is not an allowed,
+  // readable audio file
+  [[nodiscard]] auto soundLength(const std::filesystem::path &filepath) const
+      -> std::optional<std::chrono::milliseconds>;
   static auto getSupportedExtensions() -> std::vector<std::string>;
   auto setMasterVolume(int volume) -> void;
   [[nodiscard]] auto getMasterVolume() const -> int;
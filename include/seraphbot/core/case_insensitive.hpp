@@ -0,0 +1,60 @@
+#ifndef SBOT_CORE_CASE_INSENSITIVE_HPP
+#define SBOT_CORE_CASE_INSENSITIVE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace sbot::core {
+
+// ASCII only; command names are ASCII and this avoids the locale lookup
+[[nodiscard]] constexpr auto toLowerAscii(char chr) -> char {
+  return (chr >= 'A' && chr <= 'Z') ? static_cast<char>(chr - 'A' + 'a') : chr;
+}
+
+// FNV-1a over the lowercased bytes. Transparent, so maps keyed by
+// std::string can be searched with a string_view without building a key.
+struct CaseInsensitiveHash {
+  using is_transparent = void;
+
+  [[nodiscard]] constexpr auto operator()(std::string_view text) const noexcept
+      -> std::size_t {
+    constexpr std::uint64_t c_offset_basis{14695981039346656037ULL};
+    constexpr std::uint64_t c_prime{1099511628211ULL};
+    std::uint64_t hash{c_offset_basis};
+    for (char chr : text) {
+      hash ^= static_cast<unsigned char>(toLowerAscii(chr));
+      hash *= c_prime;
+    }
+    return static_cast<std::size_t>(hash);
+  }
+};
+
+struct CaseInsensitiveEqual {
+  using is_transparent = void;
+
+  [[nodiscard]] constexpr auto operator()(std::string_view lhs,
+                                          std::string_view rhs) const noexcept
+      -> bool {
+    if (lhs.size() != rhs.size()) {
+      return false;
+    }
+    for (std::size_t i = 0; i < lhs.size(); ++i) {
+      if (toLowerAscii(lhs[i]) != toLowerAscii(rhs[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+template <typename Value>
+using CaseInsensitiveMap = std::unordered_map<std::string, Value,
+                                              CaseInsensitiveHash,
+                                              CaseInsensitiveEqual>;
+
+} // namespace sbot::core
+
+#endif
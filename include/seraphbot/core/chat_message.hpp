@@ -1,16 +1,79 @@
 #ifndef SBOT_CORE_CHAT_MESSAGE_HPP
 #define SBOT_CORE_CHAT_MESSAGE_HPP
 
+#include <chrono>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace sbot::core {
 
+// Badges that permissions and scheduling depend on, as bits so checks do
+// not scan the badge list
+using BadgeMask = std::uint8_t;
+
+namespace badge {
+inline constexpr BadgeMask c_broadcaster{1U << 0U};
+inline constexpr BadgeMask c_moderator{1U << 1U};
+inline constexpr BadgeMask c_vip{1U << 2U};
+inline constexpr BadgeMask c_subscriber{1U << 3U};
+inline constexpr BadgeMask c_founder{1U << 4U};
+
+// Each rank includes the ones above it
+inline constexpr BadgeMask c_moderator_rank = c_broadcaster | c_moderator;
+inline constexpr BadgeMask c_vip_rank       = c_moderator_rank | c_vip;
+inline constexpr BadgeMask c_subscriber_rank =
+    c_vip_rank | c_subscriber | c_founder;
+
+// Twitch badge set id to its bit; 0 for badges without one
+[[nodiscard]] constexpr auto bitFor(std::string_view set_id) -> BadgeMask {
+  if (set_id == "broadcaster") {
+    return c_broadcaster;
+  }
+  if (set_id == "moderator") {
+    return c_moderator;
+  }
+  if (set_id == "vip") {
+    return c_vip;
+  }
+  if (set_id == "subscriber") {
+    return c_subscriber;
+  }
+  if (set_id == "founder") {
+    return c_founder;
+  }
+  return 0;
+}
+} // namespace badge
+
+// Piece of a chat message as split by Twitch (`message.fragments`)
+struct ChatFragment {
+  enum class Type : std::uint8_t { Text, Emote };
+
+  Type type{Type::Text};
+  std::string text;
+  std::string emote_id;
+};
+
 struct ChatMessage {
   std::string user;
+  // Twitch user id of the sender; empty for messages the bot made up
+  std::string user_id;
   std::string text;
   std::string color;
   std::vector<std::string> badges;
+  // The entries of `badges` that have a bit in sbot::core::badge
+  BadgeMask badge_mask{0};
+  // Empty for messages without emotes; render `text` directly then
+  std::vector<ChatFragment> fragments;
+  // When the bot received the message; default constructed for messages it
+  // made up itself
+  std::chrono::steady_clock::time_point received{};
+
+  [[nodiscard]] auto hasAnyBadge(BadgeMask mask) const -> bool {
+    return (badge_mask & mask) != 0;
+  }
 };
 
 } // namespace sbot::core
@@ -0,0 +1,110 @@
+#ifndef SBOT_CORE_CHAT_SCHEDULER_HPP
+#define SBOT_CORE_CHAT_SCHEDULER_HPP
+
+#include <bitset>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace boost::asio {
+class io_context;
+} // namespace boost::asio
+
+namespace sbot::core {
+
+// Five-field cron expression (minute hour day-of-month month day-of-week),
+// evaluated in local time. Fields take `*`, numbers, ranges `a-b`, steps
+// `*/n` or `a-b/n` and comma lists. Day-of-week 0 and 7 are Sunday; when
+// both day fields are restricted, either may match, as in cron.
+class CronSchedule {
+public:
+  [[nodiscard]] static auto parse(std::string_view expression)
+      -> std::optional<CronSchedule>;
+
+  // First matching minute strictly after `after`; nullopt if none within
+  // a few years (e.g. "0 0 31 2 *")
+  [[nodiscard]] auto next(std::chrono::system_clock::time_point after) const
+      -> std::optional<std::chrono::system_clock::time_point>;
+
+private:
+  std::bitset<60> m_minutes;
+  std::bitset<24> m_hours;
+  std::bitset<32> m_days;
+  std::bitset<13> m_months;
+  std::bitset<7> m_weekdays;
+  bool m_any_day{true};
+  bool m_any_weekday{true};
+
+  [[nodiscard]] auto matchesDay(int day, int weekday) const -> bool;
+};
+
+// When a job runs: every `interval`, or at the minutes `cron` matches
+struct ScheduleSpec {
+  std::chrono::seconds interval{0};
+  std::optional<CronSchedule> cron;
+  // Chat messages that must have arrived since the job last ran; a due job
+  // without them is skipped until its next time
+  std::size_t min_messages{0};
+};
+
+// Timed jobs on the connection's io_context, kept in a TimerWheel with one
+// slot per second. Jobs only decide *when*: their action should hand real
+// work (Lua, sending to chat) to the executor. Jobs are grouped by an
+// owner string so a reloaded script can drop all of its jobs at once.
+class ChatScheduler {
+public:
+  using JobId  = std::uint64_t;
+  using Action = std::function<void()>;
+
+  static constexpr std::chrono::seconds c_tick{1};
+  // One revolution per hour; longer waits take extra rounds
+  static constexpr std::size_t c_slots{3600};
+
+  explicit ChatScheduler(std::shared_ptr<boost::asio::io_context> io_context);
+  ~ChatScheduler();
+
+  ChatScheduler(const ChatScheduler &)                     = delete;
+  auto operator=(const ChatScheduler &) -> ChatScheduler & = delete;
+  ChatScheduler(ChatScheduler &&)                          = delete;
+  auto operator=(ChatScheduler &&) -> ChatScheduler &      = delete;
+
+  auto start() -> void;
+  // No action runs once this returns; must not be called from an action
+  auto stop() -> void;
+
+  // 0 if `spec` never fires (no interval and no cron)
+  auto add(std::string group, ScheduleSpec spec, Action action) -> JobId;
+  auto remove(JobId job) -> bool;
+  auto removeGroup(std::string_view group) -> std::size_t;
+  [[nodiscard]] auto size() const -> std::size_t;
+
+  // Counts toward every job's min_messages
+  auto noteChatMessage() -> void;
+
+private:
+  struct Job {
+    std::string group;
+    ScheduleSpec spec;
+    Action action;
+    std::uint64_t messages_at_last_run{0};
+  };
+
+  // Shared with pending timer handlers, which may outlive the scheduler
+  struct State;
+
+  std::shared_ptr<State> m_state;
+
+  static auto tick(const std::shared_ptr<State> &state) -> void;
+  static auto arm(const std::shared_ptr<State> &state) -> void;
+  // Requires State::mutex; false if `job` will never fire again
+  static auto reschedule(State &state, JobId job_id, const Job &job) -> bool;
+};
+
+} // namespace sbot::core
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef SBOT_CORE_COMMAND_EXECUTOR_HPP
+#define SBOT_CORE_COMMAND_EXECUTOR_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace sbot::core {
+
+class CommandMetrics;
+
+// Runs chat commands off the I/O threads. Each user has their own queue and
+// users are served weighted round robin (deficit round robin with a cost of
+// one per command), so a user spamming a command only delays themselves.
+// Both the total backlog and each user's backlog are bounded; submit()
+// rejects work beyond that instead of growing without limit.
+//
+// Continuations of work that was already admitted (a suspended Lua command
+// resuming) bypass the queues and their limits and run before new commands.
+// They are counted apart from commands, so a command that suspends three
+// times still counts as one command in the statistics.
+//
+// The application runs one worker per pooled Lua state, so no worker waits
+// for an interpreter while another one is free.
+//
+// A worker that runs out of work calls the idle task, if set, until it
+// returns false or new work arrives; it is called again only after the
+// worker has run something else.
+class CommandExecutor {
+public:
+  using Task = std::function<void()>;
+  // One short slice of background work; true if there is more
+  using IdleTask = std::function<bool()>;
+
+  static constexpr std::size_t c_default_max_queued{256};
+  static constexpr std::size_t c_default_max_per_user{4};
+
+  // Commands only, except for the continuation fields
+  struct Stats {
+    std::uint64_t submitted{0};
+    std::uint64_t completed{0};
+    std::uint64_t rejected{0};
+    std::size_t queued{0};
+    std::chrono::nanoseconds total_wait{0};
+    std::chrono::nanoseconds max_wait{0};
+    std::chrono::nanoseconds total_run{0};
+    std::chrono::nanoseconds max_run{0};
+    std::uint64_t continuations{0};
+    std::chrono::nanoseconds continuation_run{0};
+
+    [[nodiscard]] auto meanWait() const -> std::chrono::nanoseconds {
+      return completed == 0 ? std::chrono::nanoseconds{0}
+                            : total_wait / static_cast<std::int64_t>(completed);
+    }
+    [[nodiscard]] auto meanRun() const -> std::chrono::nanoseconds {
+      return completed == 0 ? std::chrono::nanoseconds{0}
+                            : total_run / static_cast<std::int64_t>(completed);
+    }
+  };
+
+  explicit CommandExecutor(std::size_t worker_count = 1,
+                           std::size_t max_queued   = c_default_max_queued,
+                           std::size_t max_per_user = c_default_max_per_user);
+  ~CommandExecutor();
+
+  CommandExecutor(const CommandExecutor &)                     = delete;
+  auto operator=(const CommandExecutor &) -> CommandExecutor & = delete;
+  CommandExecutor(CommandExecutor &&)                          = delete;
+  auto operator=(CommandExecutor &&) -> CommandExecutor &      = delete;
+
+  // `weight` is how many commands the user may run per round; 0 counts as 1.
+  // Returns false if the task was rejected because a queue is full.
+  auto submit(const std::string &user, unsigned weight, Task task) -> bool;
+  // Only fails once the executor has stopped
+  auto submitContinuation(Task task) -> bool;
+  // Stops the workers; queued tasks that have not started are dropped
+  auto stop() -> void;
+  // Called from several workers at once; slices should take well under a
+  // millisecond, since a command arriving meanwhile waits for them
+  auto setIdleTask(IdleTask task) -> void;
+  // Wait and run time of every command also go to metrics->executor();
+  // `metrics` must outlive the executor
+  auto setMetrics(CommandMetrics *metrics) -> void;
+
+  [[nodiscard]] auto stats() const -> Stats;
+
+private:
+  struct Job {
+    Task task;
+    std::chrono::steady_clock::time_point enqueued;
+    bool continuation{false};
+  };
+
+  struct UserQueue {
+    std::deque<Job> jobs;
+    unsigned weight{1};
+    // Commands left in this user's current round
+    unsigned credits{0};
+  };
+
+  std::size_t m_max_queued;
+  std::size_t m_max_per_user;
+
+  mutable std::mutex m_mutex;
+  std::condition_variable_any m_cv;
+  std::unordered_map<std::string, UserQueue> m_users;
+  // Users with pending work, in service order
+  std::deque<std::string> m_active;
+  std::deque<Job> m_continuations;
+  IdleTask m_idle_task;
+  CommandMetrics *m_metrics{nullptr};
+  std::size_t m_queued{0};
+  bool m_stopped{false};
+  Stats m_stats;
+
+  std::vector<std::jthread> m_workers;
+
+  auto workerLoop(const std::stop_token &stop) -> void;
+  [[nodiscard]] auto hasWork() const -> bool {
+    return m_queued > 0 || !m_continuations.empty();
+  }
+  // Requires m_mutex and hasWork()
+  auto popNext() -> Job;
+};
+
+} // namespace sbot::core
+
+#endif
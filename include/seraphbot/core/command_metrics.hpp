@@ -0,0 +1,161 @@
+#ifndef SBOT_CORE_COMMAND_METRICS_HPP
+#define SBOT_CORE_COMMAND_METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "seraphbot/core/case_insensitive.hpp"
+
+namespace sbot::core {
+
+// HDR-style log-linear histogram of microsecond latencies: exact below 16us,
+// then 16 linear sub-buckets per power of two, so any recorded value is
+// reported within ~6%. Lock-free; recording is a handful of relaxed atomics.
+class LatencyHistogram {
+public:
+  static constexpr std::size_t c_sub_buckets{16};
+  // Powers of two above the exact range; the last bucket absorbs the rest
+  static constexpr std::size_t c_magnitudes{32};
+  static constexpr std::size_t c_bucket_count{c_sub_buckets *
+                                              (c_magnitudes + 1)};
+
+  auto record(std::chrono::nanoseconds latency) -> void;
+
+  [[nodiscard]] auto count() const -> std::uint64_t {
+    return m_count.load(std::memory_order_relaxed);
+  }
+  [[nodiscard]] auto sum() const -> std::chrono::microseconds {
+    return std::chrono::microseconds{m_sum_us.load(std::memory_order_relaxed)};
+  }
+  [[nodiscard]] auto max() const -> std::chrono::microseconds {
+    return std::chrono::microseconds{m_max_us.load(std::memory_order_relaxed)};
+  }
+  [[nodiscard]] auto mean() const -> std::chrono::microseconds;
+  // `quantile` in [0, 1]; returns the upper edge of the bucket it falls in
+  [[nodiscard]] auto quantile(double quantile) const
+      -> std::chrono::microseconds;
+
+private:
+  std::array<std::atomic<std::uint64_t>, c_bucket_count> m_buckets{};
+  std::atomic<std::uint64_t> m_count{0};
+  std::atomic<std::uint64_t> m_sum_us{0};
+  std::atomic<std::uint64_t> m_max_us{0};
+
+  [[nodiscard]] static auto bucketFor(std::uint64_t micros) -> std::size_t;
+  [[nodiscard]] static auto bucketUpperBound(std::size_t index)
+      -> std::uint64_t;
+};
+
+struct CommandStats {
+  std::atomic<std::uint64_t> invocations{0};
+  std::atomic<std::uint64_t> permission_denied{0};
+  std::atomic<std::uint64_t> cooldown_rejected{0};
+  std::atomic<std::uint64_t> errors{0};
+  std::atomic<std::uint64_t> shed{0};
+  // Tokenize + lookup
+  LatencyHistogram parse;
+  // Handler (Lua script) run time
+  LatencyHistogram execute;
+  // From dequeue until Twitch accepted the chat reply
+  LatencyHistogram reply;
+};
+
+// Plain copy of one command's stats for display
+struct CommandStatsRow {
+  std::string name;
+  std::uint64_t invocations{0};
+  std::uint64_t permission_denied{0};
+  std::uint64_t cooldown_rejected{0};
+  std::uint64_t errors{0};
+  std::uint64_t shed{0};
+  std::chrono::microseconds parse_p50{0};
+  std::chrono::microseconds execute_p50{0};
+  std::chrono::microseconds execute_p99{0};
+  std::chrono::microseconds execute_max{0};
+  std::chrono::microseconds reply_p50{0};
+  std::chrono::microseconds reply_p99{0};
+};
+
+// Lua collector slices: `idle` ones run when the executor had nothing to
+// do, `forced` ones mid-burst because a state's heap grew too far
+struct GcStats {
+  LatencyHistogram idle;
+  LatencyHistogram forced;
+};
+
+// Commands on the executor: `wait` from submit() until a worker picked the
+// command up, `run` until the worker was done with it
+struct ExecutorStats {
+  LatencyHistogram wait;
+  LatencyHistogram run;
+};
+
+// Live Lua heap bytes attributed to one command file, summed over states
+struct HeapUsageRow {
+  std::string file;
+  std::size_t live_bytes{0};
+};
+
+// Per-command counters and latency histograms. Entries are created on first
+// use and never removed, so references from forCommand() stay valid for the
+// lifetime of the registry and can be updated from any thread.
+class CommandMetrics {
+public:
+  CommandMetrics();
+  ~CommandMetrics();
+
+  CommandMetrics(const CommandMetrics &)                     = delete;
+  auto operator=(const CommandMetrics &) -> CommandMetrics & = delete;
+  CommandMetrics(CommandMetrics &&)                          = delete;
+  auto operator=(CommandMetrics &&) -> CommandMetrics &      = delete;
+
+  auto forCommand(std::string_view name) -> CommandStats &;
+  // Does not create an entry; nullptr for commands that never ran
+  [[nodiscard]] auto find(std::string_view name) const -> CommandStats *;
+
+  // Sorted by slowest p99 execution time first
+  [[nodiscard]] auto rows() const -> std::vector<CommandStatsRow>;
+  // Heap figures are gauges owned by whoever runs the scripts, so they are
+  // pulled from `source` when needed; an empty source clears it
+  auto setHeapSource(std::function<std::vector<HeapUsageRow>()> source)
+      -> void;
+  // Largest first
+  [[nodiscard]] auto heapRows() const -> std::vector<HeapUsageRow>;
+  auto gc() -> GcStats & { return m_gc; }
+  [[nodiscard]] auto gc() const -> const GcStats & { return m_gc; }
+  auto executor() -> ExecutorStats & { return m_executor; }
+  [[nodiscard]] auto executor() const -> const ExecutorStats & {
+    return m_executor;
+  }
+  // One line suitable for a chat reply
+  [[nodiscard]] auto summary(std::string_view name) const -> std::string;
+
+  // Prometheus text exposition format
+  auto writePrometheus(std::ostream &out) const -> void;
+  // Writes via a temporary file and rename so scrapers never see half a file
+  auto exportToFile(const std::filesystem::path &path) const -> bool;
+
+private:
+  mutable std::shared_mutex m_mutex;
+  CaseInsensitiveMap<std::unique_ptr<CommandStats>> m_commands;
+  mutable std::mutex m_heap_mutex;
+  std::function<std::vector<HeapUsageRow>()> m_heap_source;
+  GcStats m_gc;
+  ExecutorStats m_executor;
+};
+
+} // namespace sbot::core
+
+#endif
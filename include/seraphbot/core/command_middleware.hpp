@@ -0,0 +1,212 @@
+#ifndef SBOT_CORE_COMMAND_MIDDLEWARE_HPP
+#define SBOT_CORE_COMMAND_MIDDLEWARE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace sbot::core {
+
+struct CommandContext;
+struct CommandStats;
+
+// Who may run a command and how often. Applies to Lua and native commands
+// alike; the defaults let everyone run it without limits.
+struct CommandPolicy {
+  bool enabled{true};
+  bool mod_only{false};
+  bool vip_only{false};
+  bool subscriber_only{false};
+  // Allowed regardless of the badge requirements above
+  std::vector<std::string> allowed_users;
+
+  // Seconds since the last use of any command / this command / this command
+  // by the same user
+  int global_cooldown{0};
+  int command_cooldown{0};
+  int user_cooldown{0};
+  // Zero or negative for unlimited; see CommandParser::resetStreamCounters()
+  int max_uses_per_stream{-1};
+};
+
+// A use CooldownStage reserved in admit(), with what it replaced so
+// finish() can give it back if the command did not run
+struct CooldownReservation {
+  bool held{false};
+  std::chrono::steady_clock::time_point at;
+  std::chrono::steady_clock::time_point global;
+  std::chrono::steady_clock::time_point command;
+  std::chrono::steady_clock::time_point user;
+};
+
+// State threaded through the stages for one invocation
+struct DispatchContext {
+  const CommandContext &command;
+  // Registered spelling of the command; cooldowns are keyed by it
+  std::string_view name;
+  const CommandPolicy &policy;
+  // nullptr when metrics are disabled
+  CommandStats *stats{nullptr};
+  // Keyword triggers are rejected silently instead of replying
+  bool quiet{false};
+
+  // Filled in by the pipeline
+  CooldownReservation cooldown;
+  std::string_view rejected_by;
+  bool ran{false};
+  bool ok{false};
+  std::chrono::nanoseconds elapsed{0};
+
+  DispatchContext(const CommandContext &ctx, std::string_view command_name,
+                  const CommandPolicy &command_policy, CommandStats *metrics,
+                  bool silent)
+      : command{ctx}, name{command_name}, policy{command_policy},
+        stats{metrics}, quiet{silent} {}
+};
+
+// Stages are plain classes with any of
+//   static constexpr std::string_view c_name;          (required)
+//   auto admit(DispatchContext &) -> bool;              before the handler
+//   auto finish(const DispatchContext &) -> void;       after it
+// admit() runs in order and stops at the first stage that refuses. finish()
+// runs for every stage afterwards, including when the command was rejected
+// (check `ran`). Hooks a stage does not declare are not called at all, and
+// the whole chain is inlined into the dispatching function.
+template <typename... Stages> class CommandPipeline {
+public:
+  // `run` executes the handler and returns false if it failed
+  template <typename Run>
+  auto dispatch(DispatchContext &dispatch, Run &&run) -> bool {
+    bool admitted = std::apply(
+        [&dispatch](auto &...stages) {
+          return (admitStage(stages, dispatch) && ...);
+        },
+        m_stages);
+    if (admitted) {
+      auto started     = std::chrono::steady_clock::now();
+      dispatch.ok      = run();
+      dispatch.ran     = true;
+      dispatch.elapsed = std::chrono::steady_clock::now() - started;
+    }
+    std::apply(
+        [&dispatch](auto &...stages) {
+          (finishStage(stages, dispatch), ...);
+        },
+        m_stages);
+    return dispatch.ran && dispatch.ok;
+  }
+
+  template <typename Stage> auto stage() -> Stage & {
+    return std::get<Stage>(m_stages);
+  }
+
+private:
+  std::tuple<Stages...> m_stages;
+
+  template <typename Stage>
+  static auto admitStage(Stage &stage, DispatchContext &dispatch) -> bool {
+    if constexpr (requires { stage.admit(dispatch); }) {
+      if (!stage.admit(dispatch)) {
+        dispatch.rejected_by = Stage::c_name;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template <typename Stage>
+  static auto finishStage(Stage &stage, const DispatchContext &dispatch)
+      -> void {
+    if constexpr (requires { stage.finish(dispatch); }) {
+      stage.finish(dispatch);
+    }
+  }
+};
+
+// Debug log line per invocation: run time or the stage that rejected it
+struct TracingStage {
+  static constexpr std::string_view c_name{"tracing"};
+  auto finish(const DispatchContext &dispatch) -> void;
+};
+
+// Invocation, error and run time figures for CommandMetrics
+struct MetricsStage {
+  static constexpr std::string_view c_name{"metrics"};
+  auto admit(DispatchContext &dispatch) -> bool;
+  auto finish(const DispatchContext &dispatch) -> void;
+};
+
+// `enabled`, allowed users and badge requirements
+struct PermissionStage {
+  static constexpr std::string_view c_name{"permission"};
+  auto admit(DispatchContext &dispatch) -> bool;
+};
+
+// Per-user token bucket across all commands, so one chatter cannot keep the
+// executor busy by cycling through commands that each have their own
+// cooldown. Keyword triggers draw from the same bucket, so chat that keeps
+// matching them is limited like typed commands. Moderators are exempt;
+// rejections are silent so a spammer does not get the bot to spam back.
+class RateLimitStage {
+public:
+  static constexpr std::string_view c_name{"rate limit"};
+  static constexpr double c_burst{4.0};
+  static constexpr std::chrono::seconds c_refill_interval{5};
+
+  auto admit(DispatchContext &dispatch) -> bool;
+
+private:
+  // Forget users whose bucket refilled once this many are tracked
+  static constexpr std::size_t c_prune_threshold{1024};
+
+  struct Bucket {
+    double tokens{c_burst};
+    std::chrono::steady_clock::time_point updated;
+  };
+
+  std::mutex m_mutex;
+  std::unordered_map<std::string, Bucket> m_buckets;
+};
+
+// Global, per-command and per-user cooldowns plus per-stream usage limits.
+// A use is reserved under the same lock as the check, so invocations on
+// other workers cannot slip through together, and counts whether or not
+// the handler succeeded; it is given back only if the command never ran.
+class CooldownStage {
+public:
+  static constexpr std::string_view c_name{"cooldown"};
+
+  auto admit(DispatchContext &dispatch) -> bool;
+  auto finish(const DispatchContext &dispatch) -> void;
+  auto resetStreamCounters() -> void;
+
+private:
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  std::mutex m_mutex;
+  TimePoint m_last_global_command;
+  std::unordered_map<std::string, TimePoint> m_last_command_use;
+  std::unordered_map<std::string, std::unordered_map<std::string, TimePoint>>
+      m_user_command_cooldowns;
+  std::unordered_map<std::string, int> m_command_use_count;
+
+  [[nodiscard]] auto isOnCooldown(const std::string &command,
+                                  const std::string &user,
+                                  const CommandPolicy &policy) const -> bool;
+};
+
+// Tracing first so it sees every outcome; metrics before the checks so
+// rejected invocations are counted too
+using CommandMiddleware =
+    CommandPipeline<TracingStage, MetricsStage, PermissionStage,
+                    RateLimitStage, CooldownStage>;
+
+} // namespace sbot::core
+
+#endif
@@ -1,56 +1,154 @@
 #ifndef SBOT_CORE_COMMAND_PARSER_HPP
 #define SBOT_CORE_COMMAND_PARSER_HPP
 
+#include <atomic>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <utility>
 #include <vector>
 
+#include "seraphbot/core/case_insensitive.hpp"
+#include "seraphbot/core/command_middleware.hpp"
+#include "seraphbot/core/keyword_automaton.hpp"
+
 namespace sbot::core {
 
 struct ChatMessage;
+class CommandMetrics;
+struct CommandStats;
+
+// Sends `text` to chat. A non-empty `on_sent` is called exactly once, with
+// whether Twitch accepted the message, possibly on another thread.
+using ReplyFn = std::function<void(const std::string &text,
+                                   std::function<void(bool)> on_sent)>;
 
+// `command` and `args` view into the message text or the parser's per-thread
+// scratch buffer. They are only valid while the handler runs; copy them into
+// strings before handing them to anything that outlives the call.
 struct CommandContext {
   const ChatMessage &message;
-  std::string command;
-  std::vector<std::string> args;
-  std::function<void(const std::string &)> reply;
+  std::string_view command;
+  std::span<const std::string_view> args;
+  ReplyFn reply_fn;
 
-  CommandContext(const ChatMessage &msg, std::string cmd,
-                 std::vector<std::string> arguments,
-                 std::function<void(const std::string &)> reply_fn)
-      : message{msg}, command{std::move(cmd)}, args{std::move(arguments)},
-        reply{std::move(reply_fn)} {}
+  CommandContext(const ChatMessage &msg, std::string_view cmd,
+                 std::span<const std::string_view> arguments, ReplyFn reply)
+      : message{msg}, command{cmd}, args{arguments},
+        reply_fn{std::move(reply)} {}
 
+  auto reply(const std::string &text,
+             std::function<void(bool)> on_sent = {}) const -> void;
   [[nodiscard]] auto joinArgs(std::size_t start_index = 0) const -> std::string;
 };
 
 using CommandHandler = std::function<void(const CommandContext &)>;
 
+struct CommandOptions {
+  // Drop the command instead of running it once this much time has passed
+  // since the message was received; zero uses the parser default
+  std::chrono::milliseconds stale_after{0};
+  // Checked by the middleware before every invocation
+  CommandPolicy policy;
+};
+
+// Keyword triggers compiled together; replaced as a whole, never mutated
+struct TriggerSet {
+  KeywordAutomaton automaton;
+  // Command to run for each keyword index
+  std::vector<std::string> commands;
+};
+
+struct TriggerMatch {
+  // Keeps the set the indices refer to alive across a reload
+  std::shared_ptr<const TriggerSet> triggers;
+  std::vector<std::uint32_t> keywords;
+
+  explicit operator bool() const { return !keywords.empty(); }
+};
+
 class CommandParser {
 public:
   CommandParser();
   ~CommandParser();
 
-  auto registerCommand(const std::string &name, CommandHandler handler) -> void;
+  // Registering or unregistering is safe while commands run; a handler that
+  // already started keeps its old version until it returns
+  auto registerCommand(const std::string &name, CommandHandler handler,
+                       CommandOptions options = {}) -> void;
+  auto unregisterCommand(std::string_view name) -> bool;
   auto setPrefix(const std::string &prefix) -> void;
-  auto parseAndExecute(const ChatMessage &message,
-                       std::function<void(const std::string &)> reply_fn)
-      -> bool;
-  [[nodiscard]] auto isCommand(const std::string &text) const -> bool;
+  auto setDefaultStaleAfter(std::chrono::milliseconds stale_after) -> void {
+    m_default_stale_after = stale_after;
+  }
+  // Optional; must outlive the parser
+  auto setMetrics(CommandMetrics *metrics) -> void { m_metrics = metrics; }
+  auto parseAndExecute(const ChatMessage &message, ReplyFn reply_fn) -> bool;
+  [[nodiscard]] auto isCommand(std::string_view text) const -> bool;
+  // Name of the command in a prefixed message, without tokenizing it
+  [[nodiscard]] auto peekCommand(std::string_view text) const
+      -> std::string_view;
+
+  // Replaces all keyword triggers (keyword, command name). Builds the new
+  // automaton first and swaps the pointer under a lock, so concurrent
+  // matchTriggers() calls keep using the old set until the swap.
+  auto setTriggers(
+      const std::vector<std::pair<std::string, std::string>> &triggers)
+      -> void;
+  // Safe on any thread; one linear scan of `text`
+  [[nodiscard]] auto matchTriggers(std::string_view text) const
+      -> TriggerMatch;
+  // Runs each matched command once, with the keyword as the command name
+  auto executeTriggers(const ChatMessage &message, const TriggerMatch &match,
+                       const ReplyFn &reply_fn) -> bool;
+  // Commands skipped because their message was older than the budget
+  [[nodiscard]] auto shedCount() const -> std::uint64_t {
+    return m_shed_count.load(std::memory_order_relaxed);
+  }
+  // Clears `max_uses_per_stream` counts, e.g. when a new stream starts
+  auto resetStreamCounters() -> void {
+    m_middleware.stage<CooldownStage>().resetStreamCounters();
+  }
 
 private:
+  static constexpr std::chrono::milliseconds c_default_stale_after{30000};
+
+  struct RegisteredCommand {
+    // Registered spelling
+    std::string name;
+    CommandHandler handler;
+    CommandOptions options;
+  };
+  using CommandPtr = std::shared_ptr<const RegisteredCommand>;
+
   std::string m_prefix{"!"};
-  std::unordered_map<std::string, CommandHandler> m_commands;
-
-  // Parse command and arguments from text
-  [[nodiscard]] auto parseCommand(const std::string &text) const
-      -> std::pair<std::string, std::vector<std::string>>;
-  // Split string by spaces, respecting quotes
-  [[nodiscard]] auto tokenize(const std::string &text) const
-      -> std::vector<std::string>;
+  std::chrono::milliseconds m_default_stale_after{c_default_stale_after};
+  // Keys keep the registered spelling; lookups ignore case. Guarded by
+  // m_commands_mutex, which is never held while a handler runs.
+  mutable std::shared_mutex m_commands_mutex;
+  CaseInsensitiveMap<CommandPtr> m_commands;
+  std::atomic<std::uint64_t> m_shed_count{0};
+  CommandMetrics *m_metrics{nullptr};
+  CommandMiddleware m_middleware;
+  // Held only to copy or swap the pointer; matching runs without it.
+  // (libc++ has no std::atomic<std::shared_ptr>.)
+  mutable std::mutex m_triggers_mutex;
+  std::shared_ptr<const TriggerSet> m_triggers;
+
+  [[nodiscard]] auto findCommand(std::string_view name) const -> CommandPtr;
+  [[nodiscard]] auto isStale(const ChatMessage &message,
+                             const CommandOptions &options) const -> bool;
+  // Runs the command through the middleware; false if a stage rejected it
+  // or the handler threw
+  auto dispatch(const RegisteredCommand &command, const CommandContext &ctx,
+                CommandStats *stats, bool quiet) -> bool;
 };
 
 } // namespace sbot::core
@@ -0,0 +1,40 @@
+#ifndef SBOT_CORE_COMMAND_TOKENIZER_HPP
+#define SBOT_CORE_COMMAND_TOKENIZER_HPP
+
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sbot::core {
+
+// Splits a command line on whitespace, honouring double quotes and backslash
+// escapes. Tokens are views into the input; only tokens that contain quotes
+// or escapes are rebuilt, into a scratch buffer owned by the tokenizer. Both
+// buffers are reused, so once warmed up tokenizing does not allocate.
+//
+// Returned views stay valid until the next tokenize() call or until the
+// input goes away, whichever comes first.
+class CommandTokenizer {
+public:
+  auto tokenize(std::string_view text) -> std::span<const std::string_view>;
+
+  // Index of the first quote, backslash or (outside quotes) whitespace at or
+  // after `pos`, or `text.size()` if there is none
+  [[nodiscard]] static auto findSpecial(std::string_view text, std::size_t pos,
+                                        bool in_quotes) -> std::size_t;
+
+private:
+  std::vector<std::string_view> m_tokens;
+  std::string m_scratch;
+
+  // Slow path for a token containing quotes or escapes; `pos` points at the
+  // first special character, returns the index just past the token
+  auto unescapeToken(std::string_view text, std::size_t start,
+                     std::size_t pos) -> std::size_t;
+};
+
+} // namespace sbot::core
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef SBOT_CORE_FILE_WATCHER_HPP
+#define SBOT_CORE_FILE_WATCHER_HPP
+
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <set>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace sbot::core {
+
+// Watches one directory (not recursively) for files with a given extension
+// being created, written, renamed or deleted. Uses inotify on Linux and
+// falls back to polling mtimes elsewhere or when inotify is unavailable.
+//
+// Changes are debounced: the callback runs on the watcher thread once no
+// further event arrived for the debounce interval, with every path touched
+// in that burst, so an editor's save-via-rename shows up as one change.
+// Whether a path was modified or deleted is left to the callback to check.
+class FileWatcher {
+public:
+  using Callback = std::function<void(std::vector<std::filesystem::path>)>;
+
+  static constexpr std::chrono::milliseconds c_default_debounce{250};
+
+  FileWatcher(std::filesystem::path directory, std::string extension,
+              Callback on_change,
+              std::chrono::milliseconds debounce = c_default_debounce);
+  ~FileWatcher();
+
+  FileWatcher(const FileWatcher &)                     = delete;
+  auto operator=(const FileWatcher &) -> FileWatcher & = delete;
+  FileWatcher(FileWatcher &&)                          = delete;
+  auto operator=(FileWatcher &&) -> FileWatcher &      = delete;
+
+private:
+  static constexpr std::chrono::milliseconds c_wake_interval{100};
+  static constexpr std::chrono::seconds c_poll_interval{1};
+
+  std::filesystem::path m_directory;
+  std::string m_extension;
+  Callback m_on_change;
+  std::chrono::milliseconds m_debounce;
+  // Paths seen since the last callback, and when the burst goes quiet
+  std::set<std::filesystem::path> m_pending;
+  std::chrono::steady_clock::time_point m_deadline;
+  // Declared last so the members above exist for the thread's lifetime
+  std::jthread m_thread;
+
+  [[nodiscard]] auto matches(const std::filesystem::path &path) const -> bool;
+  auto note(const std::filesystem::path &path) -> void;
+  auto flushIfQuiet() -> void;
+
+  // Both return when stop is requested; watchInotify returns false right
+  // away if inotify cannot be set up
+  auto watchInotify(const std::stop_token &stop) -> bool;
+  auto watchPolling(const std::stop_token &stop) -> void;
+  auto scanDirectory() const
+      -> std::unordered_map<std::string, std::filesystem::file_time_type>;
+};
+
+} // namespace sbot::core
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef SBOT_CORE_KEYWORD_AUTOMATON_HPP
+#define SBOT_CORE_KEYWORD_AUTOMATON_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sbot::core {
+
+// Aho-Corasick automaton over a fixed set of keywords, compiled to a dense
+// DFA so scanning a message is one table lookup per byte regardless of how
+// many keywords are loaded. Matching ignores ASCII case and only reports
+// whole words: "gg" matches "gg wp" but not "eggs". Keyword edges that are
+// not word characters (":)") match anywhere.
+//
+// Immutable after construction, so one instance can be scanned from any
+// number of threads.
+class KeywordAutomaton {
+public:
+  KeywordAutomaton() = default;
+  explicit KeywordAutomaton(const std::vector<std::string> &keywords);
+
+  // Appends the index of every keyword occurring in `text`; a keyword that
+  // occurs several times is reported once per occurrence
+  auto findAll(std::string_view text, std::vector<std::uint32_t> &out) const
+      -> void;
+  [[nodiscard]] auto containsAny(std::string_view text) const -> bool;
+
+  [[nodiscard]] auto empty() const -> bool { return m_keywords.empty(); }
+  [[nodiscard]] auto keyword(std::uint32_t index) const -> std::string_view {
+    return m_keywords[index].text;
+  }
+
+private:
+  static constexpr std::int32_t c_no_keyword{-1};
+
+  struct Keyword {
+    std::string text;
+    bool word_start{false};
+    bool word_end{false};
+  };
+
+  std::vector<Keyword> m_keywords;
+  // Bytes that occur in no keyword share class 0
+  std::array<std::uint8_t, 256> m_classes{};
+  std::size_t m_class_count{1};
+  // m_next[node * m_class_count + class]
+  std::vector<std::uint32_t> m_next;
+  // Keyword ending exactly at each node, or c_no_keyword
+  std::vector<std::int32_t> m_node_keyword;
+  // Nearest proper suffix node that ends a keyword, 0 when there is none
+  std::vector<std::uint32_t> m_output;
+
+  template <typename OnMatch>
+  auto scan(std::string_view text, OnMatch &&on_match) const -> void;
+};
+
+} // namespace sbot::core
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef SBOT_CORE_KV_STORE_HPP
+#define SBOT_CORE_KV_STORE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "seraphbot/core/shared_store.hpp"
+
+namespace sbot::core {
+
+// Key/value data that survives restarts, for Lua scripts' `store` module.
+// Reads are served from memory. Every write is applied in memory, encoded
+// and queued; a background thread appends the queue to a log file and
+// fsyncs once per batch (group commit), so callers never wait on the disk.
+// A crash loses at most the last c_commit_interval of writes.
+//
+// Opening replays the log, stopping at the first torn or corrupt record.
+// Once the log holds mostly overwritten records it is compacted: the live
+// data is written to a new file that atomically replaces the old one.
+class KvStore {
+public:
+  using Value = SharedStore::Value;
+  using Entry = std::pair<std::string, Value>;
+
+  static constexpr std::chrono::milliseconds c_commit_interval{50};
+  // Commit early once this much is queued
+  static constexpr std::size_t c_commit_bytes{256UL * 1024};
+  // Compact when the log is at least this big and c_compact_ratio times
+  // the size of the live data
+  static constexpr std::uintmax_t c_compact_min_bytes{1024UL * 1024};
+  static constexpr std::uintmax_t c_compact_ratio{2};
+
+  // An empty path keeps everything in memory only
+  explicit KvStore(std::filesystem::path log_path);
+  ~KvStore();
+
+  KvStore(const KvStore &)                     = delete;
+  auto operator=(const KvStore &) -> KvStore & = delete;
+  KvStore(KvStore &&)                          = delete;
+  auto operator=(KvStore &&) -> KvStore &      = delete;
+
+  [[nodiscard]] auto get(std::string_view key) const -> std::optional<Value>;
+  auto set(std::string_view key, Value value) -> void;
+  auto remove(std::string_view key) -> bool;
+  // Same as SharedStore::increment()
+  auto increment(std::string_view key, std::int64_t delta) -> std::int64_t;
+  // Up to `limit` entries with first <= key < last, in key order; an empty
+  // `last` means no upper bound
+  [[nodiscard]] auto range(std::string_view first, std::string_view last,
+                           std::size_t limit) const -> std::vector<Entry>;
+  // Up to `limit` entries whose key starts with `prefix`, in key order
+  [[nodiscard]] auto scan(std::string_view prefix, std::size_t limit) const
+      -> std::vector<Entry>;
+  [[nodiscard]] auto size() const -> std::size_t;
+
+  // Blocks until every write made so far is on disk
+  auto flush() -> void;
+
+private:
+  std::filesystem::path m_log_path;
+  // Fixed once the constructor returns
+  bool m_persistent{false};
+
+  mutable std::shared_mutex m_mutex;
+  StoreMap<Value> m_values;
+  // Views the keys of m_values, which do not move on rehash
+  std::set<std::string_view, std::less<>> m_order;
+  // Encoded size of the live entries; compared against the log size
+  std::uintmax_t m_live_bytes{0};
+
+  // Guards everything below; taken after m_mutex
+  std::mutex m_log_mutex;
+  std::condition_variable_any m_log_cv;
+  // Encoded records not yet handed to the writer
+  std::string m_queued;
+  std::uint64_t m_queued_seq{0};
+  std::uint64_t m_synced_seq{0};
+  bool m_flush_requested{false};
+
+  // Only touched by the writer (and the constructor, before it starts)
+  std::FILE *m_file{nullptr};
+  // Bytes of complete, synced batches
+  std::uintmax_t m_log_bytes{0};
+  std::jthread m_writer;
+
+  auto replay() -> void;
+  auto openForAppend() -> bool;
+  // Cuts the log back to m_log_bytes, dropping any part of a batch that
+  // failed, and opens it for appending again
+  auto reopenLog() -> bool;
+  // Updates the in-memory data; returns the stored value, or nullptr if
+  // `value` was empty and the key is gone. Requires m_mutex held
+  // exclusively.
+  auto apply(std::string_view key, std::optional<Value> value)
+      -> const Value *;
+  // Queues a record for the writer; nullptr records a removal. Requires
+  // m_mutex held exclusively, so the queue is in the same order as the
+  // changes.
+  auto append(std::string_view key, const Value *value) -> void;
+  auto writeLoop(const std::stop_token &stop) -> void;
+  auto commit(const std::string &batch) -> bool;
+  // Rewrites the log from the live data if it has grown enough
+  auto compactIfWorthwhile() -> void;
+};
+
+} // namespace sbot::core
+
+#endif
@@ -47,30 +47,43 @@ public:
 
   static auto instance() -> Logger &;
   static auto init(const Config &config) -> void;
-  // Template methods for efficient logging
+  // Template methods for efficient logging. Filtered levels return before
+  // formatting, so disabled debug/trace calls cost one atomic load.
   template <typename... Args>
   auto trace(std::format_string<Args...> fmt, Args &&...args) -> void {
-    log(LogLevel::Trace, std::format(fmt, std::forward<Args>(args)...));
+    if (shouldLog(LogLevel::Trace)) {
+      log(LogLevel::Trace, std::format(fmt, std::forward<Args>(args)...));
+    }
   }
   template <typename... Args>
   auto debug(std::format_string<Args...> fmt, Args &&...args) -> void {
-    log(LogLevel::Debug, std::format(fmt, std::forward<Args>(args)...));
+    if (shouldLog(LogLevel::Debug)) {
+      log(LogLevel::Debug, std::format(fmt, std::forward<Args>(args)...));
+    }
   }
   template <typename... Args>
   auto info(std::format_string<Args...> fmt, Args &&...args) -> void {
-    log(LogLevel::Info, std::format(fmt, std::forward<Args>(args)...));
+    if (shouldLog(LogLevel::Info)) {
+      log(LogLevel::Info, std::format(fmt, std::forward<Args>(args)...));
+    }
   }
   template <typename... Args>
   auto warn(std::format_string<Args...> fmt, Args &&...args) -> void {
-    log(LogLevel::Warn, std::format(fmt, std::forward<Args>(args)...));
+    if (shouldLog(LogLevel::Warn)) {
+      log(LogLevel::Warn, std::format(fmt, std::forward<Args>(args)...));
+    }
   }
   template <typename... Args>
   auto error(std::format_string<Args...> fmt, Args &&...args) -> void {
-    log(LogLevel::Error, std::format(fmt, std::forward<Args>(args)...));
+    if (shouldLog(LogLevel::Error)) {
+      log(LogLevel::Error, std::format(fmt, std::forward<Args>(args)...));
+    }
   }
   template <typename... Args>
   auto critical(std::format_string<Args...> fmt, Args &&...args) -> void {
-    log(LogLevel::Critical, std::format(fmt, std::forward<Args>(args)...));
+    if (shouldLog(LogLevel::Critical)) {
+      log(LogLevel::Critical, std::format(fmt, std::forward<Args>(args)...));
+    }
   }
 
   // Context-aware logging
@@ -81,6 +94,9 @@ public:
   // Level control
   auto setLevel(LogLevel level) -> void;
   [[nodiscard]] auto getLevel() const -> LogLevel;
+  [[nodiscard]] auto shouldLog(LogLevel level) const -> bool {
+    return level >= m_current_level.load(std::memory_order_relaxed);
+  }
 
   // Flush logs
   auto flush() -> void;
@@ -0,0 +1,110 @@
+#ifndef SBOT_CORE_LUA_ALLOCATOR_HPP
+#define SBOT_CORE_LUA_ALLOCATOR_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace sbot::core {
+
+// lua_Alloc for one Lua state. Small blocks (most strings, tables and
+// closures) come from per-size-class free lists carved out of 64 KiB slabs;
+// larger ones go to malloc. Slabs are only returned when the allocator is
+// destroyed, so a state's footprint is its peak small-object usage.
+//
+// Growth beyond `limit` bytes fails, which Lua reports as a "not enough
+// memory" error after an emergency collection. Every block records the
+// owner that was current when it was allocated, so live bytes can be
+// broken down by command file.
+//
+// Only the thread using the state allocates; the counters are atomics so
+// other threads can read them at any time.
+class LuaAllocator {
+public:
+  static constexpr std::size_t c_default_limit{64UL * 1024 * 1024};
+  // Owner 0 is the runtime itself (libraries, bindings, shared strings).
+  // Counters are allocated a chunk of owners at a time as ids show up.
+  static constexpr std::uint32_t c_owner_chunk{256};
+  static constexpr std::uint32_t c_max_owners{c_owner_chunk * 1024};
+
+  explicit LuaAllocator(std::size_t limit = c_default_limit);
+  ~LuaAllocator();
+
+  LuaAllocator(const LuaAllocator &)                     = delete;
+  auto operator=(const LuaAllocator &) -> LuaAllocator & = delete;
+  LuaAllocator(LuaAllocator &&)                          = delete;
+  auto operator=(LuaAllocator &&) -> LuaAllocator &      = delete;
+
+  // Matches lua_Alloc; `user_data` is the allocator
+  static auto allocate(void *user_data, void *ptr, std::size_t old_size,
+                       std::size_t new_size) -> void *;
+
+  // Charges allocations to `owner` until changed; ids beyond c_max_owners
+  // count as the runtime, with a warning the first time
+  auto setOwner(std::uint32_t owner) -> void;
+
+  [[nodiscard]] auto limit() const -> std::size_t { return m_limit; }
+  [[nodiscard]] auto liveBytes() const -> std::size_t {
+    return m_live.load(std::memory_order_relaxed);
+  }
+  [[nodiscard]] auto peakBytes() const -> std::size_t {
+    return m_peak.load(std::memory_order_relaxed);
+  }
+  [[nodiscard]] auto ownerBytes(std::uint32_t owner) const -> std::size_t;
+  // Allocations refused because of the limit
+  [[nodiscard]] auto failedAllocations() const -> std::uint64_t {
+    return m_failed.load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr std::size_t c_granule{16};
+  static constexpr std::size_t c_class_count{32};
+  // Largest block, header included, served from a size class
+  static constexpr std::size_t c_max_small{c_granule * c_class_count};
+  static constexpr std::size_t c_slab_size{64UL * 1024};
+
+  // Precedes every block; keeps the payload 8-byte aligned
+  struct alignas(8) Header {
+    std::uint32_t owner;
+    // Where the block came from (c_class_count for malloc). A shrink that
+    // could not move the block leaves it bigger than its size implies.
+    std::uint32_t size_class;
+  };
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+  using OwnerChunk = std::array<std::atomic<std::int64_t>, c_owner_chunk>;
+
+  std::size_t m_limit;
+  std::uint32_t m_owner{0};
+  bool m_owners_exhausted{false};
+  std::array<FreeBlock *, c_class_count> m_free{};
+  std::vector<std::unique_ptr<std::byte[]>> m_slabs;
+
+  std::atomic<std::size_t> m_live{0};
+  std::atomic<std::size_t> m_peak{0};
+  std::atomic<std::uint64_t> m_failed{0};
+  // Published once and never moved, so readers need no lock; owned here
+  // and deleted with the allocator
+  std::array<std::atomic<OwnerChunk *>, c_max_owners / c_owner_chunk>
+      m_owner_bytes{};
+
+  // Index of the class holding `size` payload bytes, or c_class_count
+  static auto sizeClass(std::size_t size) -> std::size_t;
+  auto allocateBlock(std::size_t size, std::uint32_t owner) -> void *;
+  auto freeBlock(void *ptr, std::size_t size) -> void;
+  // Fallback when a block could not be moved; nullptr unless shrinking
+  auto shrinkInPlace(void *ptr, std::uint32_t owner, std::int64_t delta)
+      -> void *;
+  // Never throws, since it runs inside lua_Alloc; false if out of memory
+  auto refill(std::size_t size_class) -> bool;
+  // Single writer, so plain load/store instead of read-modify-write
+  auto charge(std::uint32_t owner, std::int64_t delta) -> void;
+};
+
+} // namespace sbot::core
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef SBOT_CORE_LUA_ASYNC_HPP
+#define SBOT_CORE_LUA_ASYNC_HPP
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace boost::asio {
+class io_context;
+} // namespace boost::asio
+
+namespace sbot::core {
+
+// What a suspended script gets back from the native it was waiting on;
+// monostate is nil
+using AsyncValue  = std::variant<std::monostate, bool, std::string>;
+// Call exactly once, from any thread, to resume the script
+using AsyncResume = std::function<void(std::vector<AsyncValue>)>;
+// Starts the operation a script yielded on; may resume inline
+using AsyncStart  = std::function<void(AsyncResume)>;
+
+// Supplied by the application so the engine can wait on I/O without
+// knowing about the connection or the executor
+struct LuaAsyncRuntime {
+  // Timers run here
+  std::shared_ptr<boost::asio::io_context> io_context;
+  // Runs a continuation off the I/O threads; false once shut down
+  std::function<bool(std::function<void()>)> schedule;
+  // GET `target` (a path below the configured base URL); nullopt on failure
+  std::function<void(std::string target,
+                     std::function<void(std::optional<std::string>)>)>
+      http_get;
+};
+
+} // namespace sbot::core
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef SBOT_CORE_LUA_BUDGET_HPP
+#define SBOT_CORE_LUA_BUDGET_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+struct lua_State;
+struct lua_Debug;
+
+namespace sbot::core {
+
+class LuaProfiler;
+
+// How much one call into Lua may use before it is aborted
+struct ExecutionBudget {
+  static constexpr std::uint64_t c_default_instructions{1'000'000};
+  static constexpr std::chrono::milliseconds c_default_time{250};
+
+  // Counted in steps of BudgetScope::c_hook_interval
+  std::uint64_t instructions{c_default_instructions};
+  std::chrono::milliseconds time{c_default_time};
+};
+
+enum class BudgetOverrun : std::uint8_t { None, Instructions, Time };
+
+// Enforces a budget on everything `lua` runs while the scope is alive, via
+// a count hook that raises a Lua error once the budget is spent. After
+// that the hook fires on every instruction, so a script cannot pcall its
+// way past the limit. Time spent blocked inside C functions is only
+// noticed once control returns to Lua.
+//
+// The same hook feeds `profiler`, when given and enabled, with samples of
+// `command`; Lua has only one hook per state, so they cannot be separate.
+// The time since the last sample is flushed when the scope ends.
+class BudgetScope {
+public:
+  static constexpr int c_hook_interval{1000};
+
+  BudgetScope(lua_State *lua, const ExecutionBudget &budget,
+              LuaProfiler *profiler = nullptr, std::string_view command = {});
+  ~BudgetScope();
+
+  BudgetScope(const BudgetScope &)                     = delete;
+  auto operator=(const BudgetScope &) -> BudgetScope & = delete;
+  BudgetScope(BudgetScope &&)                          = delete;
+  auto operator=(BudgetScope &&) -> BudgetScope &      = delete;
+
+  [[nodiscard]] auto overrun() const -> BudgetOverrun { return m_overrun; }
+  // What is left of `budget` after this scope, for a call that continues
+  // later (a coroutine resumed after a wait)
+  [[nodiscard]] auto remaining(const ExecutionBudget &budget) const
+      -> ExecutionBudget;
+
+private:
+  lua_State *m_lua;
+  std::uint64_t m_limit;
+  std::uint64_t m_used{0};
+  std::chrono::steady_clock::time_point m_started;
+  std::chrono::steady_clock::time_point m_deadline;
+  LuaProfiler *m_profiler;
+  // Must outlive the scope
+  std::string_view m_command;
+  std::chrono::steady_clock::time_point m_last_sample;
+  BudgetOverrun m_overrun{BudgetOverrun::None};
+  // Restored on destruction, so scopes may nest on one thread
+  BudgetScope *m_previous;
+
+  static auto onHook(lua_State *lua, lua_Debug *debug) -> void;
+};
+
+} // namespace sbot::core
+
+#endif
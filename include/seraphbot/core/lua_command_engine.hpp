@@ -2,116 +2,150 @@
 #define SBOT_CORE_LUA_COMMAND_ENGINE_HPP
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <sol/forward.hpp>
 #include <sol/optional_implementation.hpp>
 #include <sol/sol.hpp>
 #include <sol/state.hpp>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "seraphbot/core/audio_system.hpp"
 #include "seraphbot/core/chat_message.hpp"
+#include "seraphbot/core/chat_scheduler.hpp"
+#include "seraphbot/core/command_metrics.hpp"
+#include "seraphbot/core/command_middleware.hpp"
 #include "seraphbot/core/command_parser.hpp"
+#include "seraphbot/core/kv_store.hpp"
+#include "seraphbot/core/lua_allocator.hpp"
+#include "seraphbot/core/lua_async.hpp"
+#include "seraphbot/core/lua_budget.hpp"
+#include "seraphbot/core/lua_compat.hpp"
+#include "seraphbot/core/lua_profiler.hpp"
+#include "seraphbot/core/lua_state_pool.hpp"
+#include "seraphbot/core/shared_store.hpp"
 
 namespace sbot::core {
 
+// A `timers` entry: posts `message` when it has one, otherwise runs the
+// command as the channel owner with `args`
+struct CommandTimer {
+  ScheduleSpec schedule;
+  std::string message;
+  std::vector<std::string> args;
+};
+
 struct CommandMetadata {
   std::string name;
   std::string description;
   std::string usage;
   std::vector<std::string> aliases;
+  // Words or phrases that run the command without the prefix
+  std::vector<std::string> triggers;
 
-  int global_cooldown{0};
-  int command_cooldown{0};
-  int user_cooldown{0};
+  // Seconds after which a queued invocation is dropped; 0 = parser default
+  int stale_after{0};
 
-  bool mod_only{false};
-  bool vip_only{false};
-  bool subscriber_only{false};
-  std::vector<std::string> allowed_users;
+  // Permissions, cooldowns and usage limits, enforced by the parser
+  CommandPolicy policy;
 
-  bool enabled{true};
-  int max_uses_per_stream{-1};
-};
+  // `instruction_budget` and `time_budget_ms`; missing or non-positive
+  // values keep the defaults
+  ExecutionBudget budget;
 
-struct CooldownTracker {
-  std::chrono::steady_clock::time_point last_global_command;
-  std::unordered_map<std::string, std::chrono::steady_clock::time_point>
-      last_command_use;
-  std::unordered_map<
-      std::string,
-      std::unordered_map<std::string, std::chrono::steady_clock::time_point>>
-      user_command_cooldowns;
-  std::unordered_map<std::string, int> command_use_count;
-
-  auto isOnCooldown(const std::string &command, const std::string &user,
-                    const CommandMetadata &meta) const -> bool;
-  auto recordUsage(const std::string &command, const std::string &user) -> void;
-  auto resetStreamCounters() -> void;
+  // Timed messages; replaced on every reload of the file
+  std::vector<CommandTimer> timers;
 };
 
+// Index of a command file in LuaCommandEngine's command table, shared by the
+// command and its aliases. Assigned on a file's first load and never reused,
+// so it also names the file's heap usage; 0 stands for the runtime.
+using CommandId = std::uint32_t;
+
+// Passed to scripts by pointer and owned by the invocation. Getters return
+// views that sol pushes straight onto the Lua stack, and the argument table
+// is built once and shared by `execute`'s second parameter and every
+// getArgs() call. Until the script first suspends, the context views the
+// parser's CommandContext; detach() copies what it refers to, since the
+// parser's copy is gone by the time the script resumes.
 class LuaCommandContext {
 public:
-  explicit LuaCommandContext(const CommandContext &ctx,
-                             const std::string &channel_owner,
-                             AudioSystem &audio_system)
-      : m_ctx(ctx), m_channel_owner(channel_owner),
-        m_audio_system(audio_system) {}
+  LuaCommandContext(const CommandContext &ctx, sol::table args,
+                    const std::string &channel_owner,
+                    AudioSystem &audio_system);
+  ~LuaCommandContext();
+
+  LuaCommandContext(const LuaCommandContext &)                     = delete;
+  auto operator=(const LuaCommandContext &) -> LuaCommandContext & = delete;
+  LuaCommandContext(LuaCommandContext &&)                          = delete;
+  auto operator=(LuaCommandContext &&) -> LuaCommandContext &      = delete;
+
+  [[nodiscard]] auto command() const -> const CommandContext & {
+    return *m_ctx;
+  }
+  // Idempotent
+  auto detach() -> void;
+  // Called by the yielding natives; the engine starts the operation once
+  // the coroutine has actually yielded
+  auto suspend(AsyncStart start) -> void { m_pending = std::move(start); }
+  [[nodiscard]] auto takePending() -> AsyncStart {
+    return std::exchange(m_pending, {});
+  }
 
-  [[nodiscard]] auto getUser() const -> std::string {
-    return m_ctx.message.user;
+  [[nodiscard]] auto getUser() const -> std::string_view {
+    return m_ctx->message.user;
   }
-  [[nodiscard]] auto getCommand() const -> std::string { return m_ctx.command; }
-  [[nodiscard]] auto getArgs() const -> std::vector<std::string> {
-    return m_ctx.args;
+  [[nodiscard]] auto getCommand() const -> std::string_view {
+    return m_ctx->command;
   }
+  [[nodiscard]] auto getArgs() const -> const sol::table & { return m_args; }
   [[nodiscard]] auto
   joinArgs(sol::optional<int> start_index = sol::nullopt) const -> std::string {
     int idx = start_index.value_or(0);
-    return m_ctx.joinArgs(static_cast<std::size_t>(std::max(0, idx)));
+    return m_ctx->joinArgs(static_cast<std::size_t>(std::max(0, idx)));
   }
 
-  auto reply(const std::string &message) const -> void { m_ctx.reply(message); }
-
-  [[nodiscard]] auto getMessageText() const -> std::string {
-    return m_ctx.message.text;
+  [[nodiscard]] auto getMessageText() const -> std::string_view {
+    return m_ctx->message.text;
   }
 
   [[nodiscard]] auto isBroadcaster() const -> bool {
-    return std::ranges::contains(m_ctx.message.badges, "broadcaster");
+    return m_ctx->message.hasAnyBadge(badge::c_broadcaster);
   }
 
   [[nodiscard]] auto isModerator() const -> bool {
-    return std::ranges::any_of(m_ctx.message.badges, [](auto const &badge) {
-      return badge == "moderator" || badge == "broadcaster";
-    });
+    return m_ctx->message.hasAnyBadge(badge::c_moderator_rank);
   }
 
   [[nodiscard]] auto isVip() const -> bool {
-    return std::ranges::any_of(m_ctx.message.badges, [](auto const &badge) {
-      return badge == "vip" || badge == "moderator" || badge == "broadcaster";
-    });
+    return m_ctx->message.hasAnyBadge(badge::c_vip_rank);
   }
 
   [[nodiscard]] auto isSubscriber() const -> bool {
-    return std::ranges::any_of(m_ctx.message.badges, [](auto const &badge) {
-      return badge == "subscriber" || badge == "vip" || badge == "moderator" ||
-             badge == "broadcaster";
-    });
+    return m_ctx->message.hasAnyBadge(badge::c_subscriber_rank);
   }
 
-  [[nodiscard]] auto hasBadge(const std::string &badge_name) const -> bool {
-    return std::ranges::any_of(
-        m_ctx.message.badges,
-        [&badge_name](auto const &badge) { return badge == badge_name; });
+  [[nodiscard]] auto hasBadge(std::string_view badge_name) const -> bool {
+    if (BadgeMask bit = badge::bitFor(badge_name); bit != 0) {
+      return m_ctx->message.hasAnyBadge(bit);
+    }
+    return std::ranges::contains(m_ctx->message.badges, badge_name);
   }
 
   auto isFounder() const -> bool {
-    return std::ranges::contains(m_ctx.message.badges, "founder");
+    return m_ctx->message.hasAnyBadge(badge::c_founder);
   }
 
   auto getSubscriberMonths() const -> int {
@@ -138,48 +172,286 @@ public:
   }
 
 private:
-  const CommandContext &m_ctx;
-  std::string m_channel_owner;
+  // Copies of everything m_ctx views, made by detach()
+  struct OwnedCommand;
+
+  const CommandContext *m_ctx;
+  std::unique_ptr<OwnedCommand> m_owned;
+  sol::table m_args;
+  const std::string &m_channel_owner;
   AudioSystem &m_audio_system;
+  AsyncStart m_pending;
 };
 
+// Scripts are loaded once into a loader state to read their metadata and
+// compile them; invocations check out one of `state_count` pooled states,
+// each holding its own copy of every script, so commands run in parallel.
+// Each file runs in its own _ENV, so reloading one leaves the others'
+// globals alone. Scripts share data only through the native `shared`
+// table, and keep data across restarts in the native `store` table.
+//
+// Every `execute` runs as a coroutine. Natives that wait (ctx:sleep,
+// ctx:replyAndWait, ...) yield it and hand the wait to the async runtime;
+// the completion schedules the rest of the call back onto a worker, on the
+// same pooled state. A suspended command holds no thread and no state.
+// Lua cannot yield through a C function, so waiting natives fail with
+// "attempt to yield across a C-call boundary" when called from a callback
+// of string.gsub, table.sort and the like; call them from plain Lua code.
 class LuaCommandEngine {
 public:
-  LuaCommandEngine();
+  // Hands a due timer to whatever runs commands; `run` is called there
+  // with a reply function for `command`
+  using TimerDispatch = std::function<void(
+      const std::string &command, std::function<void(ReplyFn)> run)>;
+
+  explicit LuaCommandEngine(std::size_t state_count = 1);
   ~LuaCommandEngine();
 
   auto initialize() -> void;
+  // Files whose mtime or contents did not change since their last load are
+  // not executed again
   auto loadLuaCommand(const std::filesystem::path &file_path) -> bool;
   auto loadCommandsFromDirectory(const std::filesystem::path &directory) -> int;
   auto registerWithParser(CommandParser &parser) -> void;
-  auto reloadAllCommands() -> void;
+  // What registerWithParser installs for `command_name`, minus the parser's
+  // permission and cooldown checks; empty if there is no such command. For
+  // tools and benchmarks that drive commands directly.
+  [[nodiscard]] auto handlerFor(const std::string &command_name)
+      -> CommandHandler;
+  // Reloads one file (or drops it if it was deleted) and updates only its
+  // commands in `parser`. Unchanged files are a no-op; a file that fails to
+  // load keeps its previous version registered.
+  auto reloadFile(const std::filesystem::path &file_path,
+                  CommandParser &parser) -> bool;
+  // reloadFile() for every loaded file, so deleted files and dropped
+  // aliases are unregistered too
+  auto reloadAllCommands(CommandParser &parser) -> void;
   auto getLoadedCommands() const -> std::vector<std::string>;
+  // A copy, since a reload may replace the entry at any time
   auto getCommandMetadata(const std::string &command_name) const
-      -> const CommandMetadata *;
-  auto resetStreamCounters() -> void {
-    m_cooldown_tracker.resetStreamCounters();
-  }
+      -> std::optional<CommandMetadata>;
   auto getAudioSystem() -> AudioSystem & { return m_audio_system; }
+  // Required by the waiting natives; set before commands run
+  auto setAsyncRuntime(LuaAsyncRuntime runtime) -> void {
+    m_async = std::move(runtime);
+  }
+  // Drops every suspended command; later completions are ignored. Call
+  // before stopping whatever runs the runtime's continuations.
+  auto closeAsync() -> void;
+  // Registers the `timers` of every loaded file with `scheduler`, and
+  // keeps them in step with reloads; nullptr removes them. The scheduler
+  // must outlive the engine and be stopped before it is destroyed.
+  auto setScheduler(ChatScheduler *scheduler, TimerDispatch dispatch)
+      -> void;
+  // Optional; must outlive the engine. Also publishes heapUsage().
+  auto setMetrics(CommandMetrics *metrics) -> void;
+  // Live bytes per command file across all pooled states; "(runtime)" is
+  // everything not allocated while a script was loading or running. Empty
+  // on LuaJIT (see lua_compat::c_custom_allocator).
+  [[nodiscard]] auto heapUsage() const -> std::vector<HeapUsageRow>;
+  // One collector slice on a pooled state that commands have run on, if
+  // that state is free; true while some may be left. Pooled states only
+  // collect here, or mid-burst once their heap is c_gc_forced_growth past
+  // its size after the last full cycle; from then on every command pays
+  // for what it allocated until a cycle finishes. For
+  // CommandExecutor::setIdleTask.
+  auto collectIdle() -> bool;
+  // Samples command execution while enabled; off by default
+  auto profiler() -> LuaProfiler & { return m_profiler; }
+  // Where compiled chunks are kept between runs; empty disables the cache
+  auto setBytecodeCache(std::filesystem::path directory) -> void {
+    m_bytecode_cache = std::move(directory);
+  }
+  // Log file behind the `store` table; read by initialize(). Empty keeps
+  // the store in memory.
+  auto setStorePath(std::filesystem::path path) -> void {
+    m_store_path = std::move(path);
+  }
 
 private:
+  enum class LoadOutcome : std::uint8_t { Failed, Unchanged, Loaded };
+
+  // Consecutive budget overruns after which a command is disabled
+  static constexpr int c_max_budget_strikes{3};
+
+  // Budget overruns of one loaded version of a file; reloading starts over
+  struct ScriptHealth {
+    std::atomic<int> strikes{0};
+    std::atomic<bool> disabled{false};
+  };
+
+  // Entries returned by store.scan and store.range
+  static constexpr std::size_t c_default_scan_limit{100};
+  static constexpr std::size_t c_max_scan_limit{1000};
+  // Longest a script may wait in one ctx:sleep
+  static constexpr std::chrono::minutes c_max_sleep{5};
+  // Incremental work per idle collector slice, and the least a forced one
+  // does
+  static constexpr int c_gc_step_kb{64};
+  // Heap growth since the last finished cycle after which commands pay for
+  // collection as they allocate
+  static constexpr std::size_t c_gc_forced_growth{8U << 20U};
+
+  // One `execute` call, running or suspended. Holds Lua references into
+  // `state`, so it may only be destroyed while that state is leased.
+  struct Invocation {
+    std::uint64_t id{0};
+    CommandId command{0};
+    std::string command_name;
+    std::shared_ptr<ScriptHealth> health;
+    // What is left of the command's budget; waiting does not use it up
+    ExecutionBudget remaining;
+    LuaStatePool::PooledState *state{nullptr};
+    std::unique_ptr<LuaCommandContext> context;
+    sol::thread thread;
+    sol::coroutine coroutine;
+  };
+
+  // Suspended invocations by id. Completion handlers keep it alive and do
+  // nothing once it is closed, so they may outlive the engine.
+  struct PendingInvocations {
+    std::mutex mutex;
+    bool closed{false};
+    std::unordered_map<std::uint64_t, std::unique_ptr<Invocation>> invocations;
+  };
+
+  // A slot of the command table, shared by the command and all its aliases.
+  // Slots of removed files stay, unloaded, so their ids are not reused.
+  struct LoadedScript {
+    // Path
+    std::string key;
+    // Names the slot's heap usage
+    std::string file_name;
+    bool loaded{false};
+    std::filesystem::file_time_type mtime;
+    std::uint64_t source_hash{0};
+    // Bumped on every successful load; pooled states compare against it
+    std::uint64_t version{0};
+    std::shared_ptr<const std::string> bytecode;
+    std::shared_ptr<ScriptHealth> health;
+    CommandMetadata metadata;
+    // Command name first, then its aliases
+    std::vector<std::string> names;
+  };
+
+  // A command file read and compiled outside m_lua, so that several can be
+  // prepared at once; installScript() runs it and registers the result
+  struct PreparedScript {
+    std::filesystem::path path;
+    std::filesystem::file_time_type mtime;
+    // Source hash of the loaded version, if any; an equal source is not
+    // compiled again
+    std::optional<std::uint64_t> loaded_hash;
+    std::uint64_t source_hash{0};
+    bool unchanged{false};
+    // Empty if the file could not be read or compiled
+    std::string bytecode;
+    bool from_cache{false};
+    std::chrono::microseconds read_time{0};
+    std::chrono::microseconds compile_time{0};
+  };
+
+  // Only used to load and validate files; commands run in m_pool
+  LuaAllocator m_loader_allocator;
   sol::state m_lua;
-  std::unordered_map<std::string, std::filesystem::path> m_command_files;
-  std::unordered_map<std::string, CommandMetadata> m_command_metadata;
-  CooldownTracker m_cooldown_tracker;
+  std::size_t m_state_count;
+  std::unique_ptr<LuaStatePool> m_pool;
+  SharedStore m_shared_store;
+  std::filesystem::path m_store_path{"data/store.log"};
+  std::unique_ptr<KvStore> m_kv_store;
+  // Serializes loading, reloading and everything else that touches m_lua
+  std::mutex m_load_mutex;
+  // Guards the command table and its indexes; written only with
+  // m_load_mutex held, so loaders may read them without it
+  mutable std::shared_mutex m_scripts_mutex;
+  // Indexed by CommandId. Handlers capture their id, so running a command
+  // needs no name lookup.
+  std::vector<LoadedScript> m_commands{
+      LoadedScript{.file_name = "(runtime)"}};
+  // Ids by path, and by command name and alias
+  std::unordered_map<std::string, CommandId> m_command_ids;
+  std::unordered_map<std::string, CommandId> m_command_names;
+  std::uint64_t m_next_version{0};
+  // Bumped whenever m_commands changes; states resync lazily on checkout
+  std::atomic<std::uint64_t> m_generation{1};
+  // Per backend, since LuaJIT and Lua bytecode are incompatible
+  std::filesystem::path m_bytecode_cache{std::filesystem::path{"cache"} /
+                                         lua_compat::c_backend_name};
   AudioSystem m_audio_system;
   std::string m_channel_owner{"lagizur"};
+  CommandMetrics *m_metrics{nullptr};
+  LuaProfiler m_profiler;
+  // Both guarded by m_load_mutex; scheduled jobs hold their own copy of the
+  // dispatch
+  ChatScheduler *m_scheduler{nullptr};
+  TimerDispatch m_timer_dispatch;
+  LuaAsyncRuntime m_async;
+  std::shared_ptr<PendingInvocations> m_pending{
+      std::make_shared<PendingInvocations>()};
+  std::atomic<std::uint64_t> m_next_invocation{1};
   bool m_initialized{false};
 
-  auto setupLuaEnvironment() -> void;
-
-  auto executeLuaCommand(const CommandContext &ctx,
-                         sol::protected_function lua_func) -> void;
+  auto setupLuaEnvironment(sol::state &lua) -> void;
+  // Brings a pooled state's scripts up to date with m_commands
+  auto syncState(LuaStatePool::PooledState &state) -> void;
+  auto loadScript(const std::filesystem::path &file_path) -> LoadOutcome;
+  // Unchanged if the file's mtime matches the loaded version, Failed if it
+  // is missing; otherwise Loaded, with `prepared` ready for prepareScript().
+  // Requires m_load_mutex.
+  auto statScript(const std::filesystem::path &file_path,
+                  PreparedScript &prepared) const -> LoadOutcome;
+  // Reads the file, then takes cached bytecode when it matches the mtime
+  // and hash, or compiles it in `compiler` and refreshes the cache. Safe to
+  // call from several threads with different compilers.
+  auto prepareScript(PreparedScript &prepared, sol::state &compiler) const
+      -> void;
+  // prepareScript() for each entry on a pool of threads with their own
+  // compiler states; returns how many threads were used
+  auto prepareScripts(std::vector<PreparedScript> &scripts) const
+      -> std::size_t;
+  // Runs the chunk in m_lua and publishes the command. Requires
+  // m_load_mutex.
+  auto installScript(PreparedScript prepared) -> LoadOutcome;
+  // The loaded slot of the file at `key`, or 0. Requires m_load_mutex or
+  // m_scripts_mutex.
+  [[nodiscard]] auto findLoaded(const std::string &key) const -> CommandId;
+  // Drops a file's names so a reload can register a changed alias list
+  auto forgetScript(const std::string &key) -> void;
+  // Requires m_scripts_mutex held exclusively
+  auto eraseScript(CommandId command) -> void;
+  auto registerScript(CommandId command, CommandParser &parser) -> void;
+  auto makeHandler(CommandId command, const std::string &command_name)
+      -> CommandHandler;
+  [[nodiscard]] auto collectTriggers() const
+      -> std::vector<std::pair<std::string, std::string>>;
+  // Replaces the scheduler jobs of the file at `key` with its current
+  // timers, or drops them if it is not loaded. Requires m_load_mutex.
+  auto syncTimers(const std::string &key) -> void;
+  // Runs a due timer; a reload may have replaced it since it was scheduled
+  auto runTimer(CommandId command, std::size_t index, const ReplyFn &reply_fn)
+      -> void;
+
+  auto startInvocation(const CommandContext &ctx, CommandId command,
+                       const std::string &command_name) -> void;
+  // Runs the coroutine until it finishes or suspends; `state` must be
+  // leased and be the invocation's. Script errors are replied to chat.
+  auto runSlice(LuaStatePool::PooledState &state,
+                std::unique_ptr<Invocation> invocation,
+                std::vector<sol::object> args) -> void;
+  auto suspend(std::unique_ptr<Invocation> invocation, AsyncStart start)
+      -> void;
+  auto resume(std::uint64_t id, std::vector<AsyncValue> values) -> void;
+  // Counts a strike against the script and disables it after too many
+  auto recordOverrun(const std::string &command_name, ScriptHealth &health,
+                     BudgetOverrun overrun) -> void;
+  auto countOutcome(const std::string &command_name,
+                    std::atomic<std::uint64_t> CommandStats::*counter) -> void;
+  // About `kilobytes` of collector work; `state` must be leased
+  auto collectStep(LuaStatePool::PooledState &state, int kilobytes,
+                   bool forced) -> void;
 
   auto parseCommandMetadata(const sol::table &command_table,
                             const std::string &default_name) -> CommandMetadata;
-
-  auto hasPermission(const CommandContext &ctx,
-                     const CommandMetadata &meta) const -> bool;
 };
 
 } // namespace sbot::core
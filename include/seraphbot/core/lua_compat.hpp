@@ -0,0 +1,55 @@
+#ifndef SBOT_CORE_LUA_COMPAT_HPP
+#define SBOT_CORE_LUA_COMPAT_HPP
+
+#include <cstddef>
+#include <sol/forward.hpp>
+#include <sol/sol.hpp>
+#include <sol/state.hpp>
+#include <string_view>
+
+#include "seraphbot/core/lua_allocator.hpp"
+
+// Set by the `lua_backend` and `luajit_compile` meson options
+#if !defined(SBOT_LUAJIT)
+#define SBOT_LUAJIT 0
+#endif
+#if !defined(SBOT_LUAJIT_COMPILE)
+#define SBOT_LUAJIT_COMPILE 0
+#endif
+
+// Differences between the interpreters scripts may run on, kept out of the
+// engine. Lua 5.4 is the reference; LuaJIT speaks Lua 5.1 plus extensions.
+namespace sbot::core::lua_compat {
+
+inline constexpr bool c_luajit{SBOT_LUAJIT != 0};
+inline constexpr std::string_view c_backend_name{c_luajit ? "luajit" : "lua"};
+// 64-bit LuaJIT only allocates from its own arena, so there LuaAllocator
+// sees nothing: no memory limit and no per-file heap usage
+inline constexpr bool c_custom_allocator{!c_luajit};
+
+// A state allocating through `allocator` where the backend allows it
+[[nodiscard]] auto makeState(LuaAllocator &allocator) -> sol::state;
+
+// The libraries scripts get: base, string, math, table and utf8. LuaJIT has
+// no utf8 library, so a native one with the same functions is installed.
+// Its trace compiler stays off unless built with `luajit_compile`, because
+// count hooks, and with them execution budgets, do not run inside traces.
+auto openLibraries(sol::state &lua) -> void;
+
+// Stops automatic collection, so a burst of commands never pays for a
+// collector cycle; the owner runs it in slices with stepCollector()
+// instead. Lua 5.4 is kept in incremental mode: a generational step may
+// turn into a full major collection, which no slice size bounds. An
+// allocation that would fail still collects in full.
+auto pauseCollector(sol::state &lua) -> void;
+
+// About `kilobytes` of incremental collection work. Automatic collection
+// stays off. True when this finished a cycle.
+auto stepCollector(sol::state &lua, int kilobytes) -> bool;
+
+// Bytes the collector counts as in use
+[[nodiscard]] auto heapBytes(sol::state &lua) -> std::size_t;
+
+} // namespace sbot::core::lua_compat
+
+#endif
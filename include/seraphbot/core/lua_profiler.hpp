@@ -0,0 +1,95 @@
+#ifndef SBOT_CORE_LUA_PROFILER_HPP
+#define SBOT_CORE_LUA_PROFILER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct lua_State;
+
+namespace sbot::core {
+
+// Time spent in one function of one command, summed over all samples
+struct ProfileRow {
+  std::string command;
+  // "name (file:line)", or "name [C]" for natives
+  std::string function;
+  // While the function itself was running
+  std::chrono::nanoseconds self{0};
+  // While it was anywhere on the stack
+  std::chrono::nanoseconds total{0};
+  std::uint64_t samples{0};
+};
+
+// Sampling profiler for Lua commands. It has no hook of its own: Lua allows
+// one hook per state, so while the profiler is enabled BudgetScope's count
+// hook calls sample() once at least c_sample_interval has passed, and the
+// scope calls it once more when it ends, charging the time since the
+// previous call to the stack it sees. A command too short to reach the
+// hook shows up as "(unattributed)". Disabled, it costs the hook one
+// relaxed load. LuaJIT only runs hooks in the interpreter, so compiled
+// traces are invisible to it.
+class LuaProfiler {
+public:
+  // Frames below this depth are folded into their caller
+  static constexpr std::size_t c_max_depth{32};
+  // Distinct stacks kept; samples of new stacks past this are dropped
+  static constexpr std::size_t c_max_stacks{10000};
+  // Minimum time between samples, so a sample's cost stays small next to
+  // what it measures
+  static constexpr std::chrono::microseconds c_sample_interval{1000};
+
+  LuaProfiler();
+  ~LuaProfiler();
+
+  LuaProfiler(const LuaProfiler &)                     = delete;
+  auto operator=(const LuaProfiler &) -> LuaProfiler & = delete;
+  LuaProfiler(LuaProfiler &&)                          = delete;
+  auto operator=(LuaProfiler &&) -> LuaProfiler &      = delete;
+
+  auto setEnabled(bool enabled) -> void;
+  [[nodiscard]] auto enabled() const -> bool {
+    return m_enabled.load(std::memory_order_relaxed);
+  }
+
+  // Records the stack `lua` is running as one sample of `command` lasting
+  // `elapsed`. Called from a Lua hook, so it never throws.
+  auto sample(lua_State *lua, std::string_view command,
+              std::chrono::nanoseconds elapsed) noexcept -> void;
+
+  // Sorted by self time, longest first
+  [[nodiscard]] auto rows() const -> std::vector<ProfileRow>;
+  [[nodiscard]] auto sampleCount() const -> std::uint64_t;
+  [[nodiscard]] auto droppedCount() const -> std::uint64_t;
+  auto reset() -> void;
+
+  // Folded stacks ("command;outer;inner <microseconds>"), one per line, as
+  // read by flamegraph.pl and speedscope
+  auto writeFolded(std::ostream &out) const -> void;
+  auto exportFolded(const std::filesystem::path &path) const -> bool;
+
+private:
+  struct StackTime {
+    std::chrono::nanoseconds time{0};
+    std::uint64_t samples{0};
+  };
+
+  std::atomic<bool> m_enabled{false};
+  mutable std::mutex m_mutex;
+  // Keyed by folded stack, command first
+  std::unordered_map<std::string, StackTime> m_stacks;
+  std::uint64_t m_samples{0};
+  std::uint64_t m_dropped{0};
+};
+
+} // namespace sbot::core
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef SBOT_CORE_LUA_SANDBOX_HPP
+#define SBOT_CORE_LUA_SANDBOX_HPP
+
+#include <sol/forward.hpp>
+#include <sol/sol.hpp>
+#include <sol/state.hpp>
+
+// Every command file runs in an _ENV of its own, so a global one script
+// sets is invisible to the others and goes away with the file. Reads fall
+// through to a read-only view of the state's globals. This keeps scripts
+// from clobbering each other by accident; it does not stop a script that
+// means to (rawset, load), and scripts still share data only through the
+// `shared` and `store` tables.
+//
+// pairs() and # over a read-only view rely on __pairs and __len, which
+// LuaJIT ignores for tables unless built with LUAJIT_ENABLE_LUA52COMPAT.
+// Without it, iterating a library table or the view of _G finds nothing
+// and its length is 0; indexing works on either backend.
+namespace sbot::core::lua_sandbox {
+
+// Snapshots the globals as the base every environment reads from, with
+// library tables behind read-only views, and hides the string metatable,
+// whose __index is the real string table. Call once the state is set up;
+// globals added later are not seen by scripts.
+auto sealGlobals(sol::state &lua) -> void;
+
+// A fresh environment over the sealed globals, in which `_G` is itself.
+// Apply it with set_on() to a loaded chunk before running it.
+[[nodiscard]] auto makeEnvironment(sol::state &lua) -> sol::environment;
+
+} // namespace sbot::core::lua_sandbox
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef SBOT_CORE_LUA_STATE_POOL_HPP
+#define SBOT_CORE_LUA_STATE_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sol/forward.hpp>
+#include <sol/sol.hpp>
+#include <sol/state.hpp>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "seraphbot/core/lua_allocator.hpp"
+#include "seraphbot/core/lua_compat.hpp"
+
+namespace sbot::core {
+
+// Independent Lua states that are checked out one invocation at a time, so
+// commands can run on several threads without sharing an interpreter. The
+// pool only hands out states; keeping their scripts current is up to the
+// owner (see LuaCommandEngine::syncState).
+class LuaStatePool {
+public:
+  struct PooledState {
+    explicit PooledState(std::size_t memory_limit)
+        : allocator{memory_limit},
+          lua{lua_compat::makeState(allocator)} {}
+
+    // Declared first so it outlives the state
+    LuaAllocator allocator;
+    sol::state lua;
+    // Owner's script generation this state last synced to
+    std::uint64_t generation{0};
+    struct Script {
+      std::uint64_t version{0};
+      sol::protected_function execute;
+    };
+    // Indexed by the owner's command id; version 0 is an empty slot
+    std::vector<Script> scripts;
+    // Set when commands have run since the collector last caught up; may
+    // be read without a lease
+    std::atomic<bool> gc_pending{false};
+    // Heap size when the collector last finished a cycle
+    std::size_t gc_baseline{0};
+    // Heap size after the last collector slice
+    std::size_t gc_stepped_at{0};
+  };
+
+  // Returns the state to the pool when destroyed
+  class Lease {
+  public:
+    Lease(LuaStatePool &pool, PooledState &state)
+        : m_pool{&pool}, m_state{&state} {}
+    ~Lease();
+
+    Lease(const Lease &)                     = delete;
+    auto operator=(const Lease &) -> Lease & = delete;
+    Lease(Lease &&other) noexcept
+        : m_pool{std::exchange(other.m_pool, nullptr)},
+          m_state{std::exchange(other.m_state, nullptr)} {}
+    auto operator=(Lease &&) -> Lease & = delete;
+
+    auto operator*() const -> PooledState & { return *m_state; }
+    auto operator->() const -> PooledState * { return m_state; }
+
+  private:
+    LuaStatePool *m_pool;
+    PooledState *m_state;
+  };
+
+  using Setup = std::function<void(sol::state &)>;
+
+  // `setup` runs once per state (libraries, usertypes, globals); each
+  // state may use up to `memory_limit` bytes
+  LuaStatePool(std::size_t size, std::size_t memory_limit,
+               const Setup &setup);
+  ~LuaStatePool();
+
+  LuaStatePool(const LuaStatePool &)                     = delete;
+  auto operator=(const LuaStatePool &) -> LuaStatePool & = delete;
+  LuaStatePool(LuaStatePool &&)                          = delete;
+  auto operator=(LuaStatePool &&) -> LuaStatePool &      = delete;
+
+  // Blocks until a state is free
+  [[nodiscard]] auto acquire() -> Lease;
+  // Blocks until `state` in particular is free. Only for threads that may
+  // wait, such as shutdown; workers use acquireOrPark()
+  [[nodiscard]] auto acquire(PooledState &state) -> Lease;
+  // `state` if it is free right now. Otherwise `on_free` is kept and
+  // called, without the pool's lock, by the next release of `state`; it
+  // should reschedule the caller, which may then find the state taken
+  // again. For resuming a coroutine, which cannot move between states.
+  [[nodiscard]] auto acquireOrPark(PooledState &state,
+                                   std::function<void()> on_free)
+      -> std::optional<Lease>;
+  // `state` if it is free right now; for background work that should not
+  // hold up commands
+  [[nodiscard]] auto tryAcquire(PooledState &state) -> std::optional<Lease>;
+  [[nodiscard]] auto size() const -> std::size_t { return m_states.size(); }
+  // Only the allocator's counters may be read without a lease
+  [[nodiscard]] auto states() const
+      -> const std::vector<std::unique_ptr<PooledState>> & {
+    return m_states;
+  }
+
+private:
+  std::vector<std::unique_ptr<PooledState>> m_states;
+  std::mutex m_mutex;
+  // Waiters for any state; one release satisfies one of them
+  std::condition_variable m_cv;
+  // Waiters for a particular state, counted so releases skip the notify
+  // when there are none
+  std::condition_variable m_state_cv;
+  std::size_t m_state_waiters{0};
+  std::vector<PooledState *> m_idle;
+  // Continuations waiting on a busy state, oldest first
+  std::unordered_map<PooledState *, std::deque<std::function<void()>>>
+      m_parked;
+
+  auto release(PooledState &state) -> void;
+};
+
+} // namespace sbot::core
+
+#endif
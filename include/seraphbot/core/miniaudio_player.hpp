@@ -1,7 +1,9 @@
 #ifndef SBOT_CORE_MINIAUDIO_PLAYER_HPP
 #define SBOT_CORE_MINIAUDIO_PLAYER_HPP
 
+#include <chrono>
 #include <filesystem>
+#include <optional>
 using ma_engine = struct ma_engine;
 
 namespace sbot::core {
@@ -19,6 +21,9 @@ public:
   [[nodiscard]] auto isInitialized() const -> bool { return m_initialized; }
   auto playSound(const std::filesystem::path &filepath, int volume = 70)
       -> bool;
+  // Decodes only the header; nullopt if the file cannot be read
+  [[nodiscard]] static auto soundLength(const std::filesystem::path &filepath)
+      -> std::optional<std::chrono::milliseconds>;
   auto setMasterVolume(int volume) -> void;
   [[nodiscard]] auto getMasterVolume() const -> int;
   auto stopAll() -> void;
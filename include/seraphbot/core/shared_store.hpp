@@ -0,0 +1,58 @@
+#ifndef SBOT_CORE_SHARED_STORE_HPP
+#define SBOT_CORE_SHARED_STORE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+
+namespace sbot::core {
+
+// Values held by both SharedStore and KvStore
+using StoreValue = std::variant<bool, std::int64_t, double, std::string>;
+
+// Lets string-keyed maps be searched with a string_view
+struct StoreKeyHash {
+  using is_transparent = void;
+  auto operator()(std::string_view key) const -> std::size_t {
+    return std::hash<std::string_view>{}(key);
+  }
+};
+
+template <typename Mapped>
+using StoreMap =
+    std::unordered_map<std::string, Mapped, StoreKeyHash, std::equal_to<>>;
+
+// What increment() stores: the integer held by `current` (0 if it is
+// missing or not an integer) plus `delta`, saturating at the int64 limits
+[[nodiscard]] auto incrementedValue(const StoreValue *current,
+                                    std::int64_t delta) -> std::int64_t;
+
+// In-memory key/value data shared by every Lua state. Each state has its
+// own globals, so this is the only way for scripts running in parallel to
+// see each other's data. Values are copied in and out; nothing here refers
+// to a particular Lua state.
+class SharedStore {
+public:
+  using Value = StoreValue;
+
+  [[nodiscard]] auto get(std::string_view key) const -> std::optional<Value>;
+  auto set(std::string_view key, Value value) -> void;
+  auto remove(std::string_view key) -> bool;
+  // Atomic read-modify-write; see incrementedValue()
+  auto increment(std::string_view key, std::int64_t delta) -> std::int64_t;
+  [[nodiscard]] auto size() const -> std::size_t;
+
+private:
+  mutable std::shared_mutex m_mutex;
+  StoreMap<Value> m_values;
+};
+
+} // namespace sbot::core
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef SBOT_CORE_TIMER_WHEEL_HPP
+#define SBOT_CORE_TIMER_WHEEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace sbot::core {
+
+// Hashed timing wheel: a ring of slots, one per tick, each holding the
+// timers that expire when the cursor reaches it. A timer further away than
+// one revolution waits `rounds` extra passes. Scheduling and cancelling are
+// O(1), and a tick only looks at one slot, so thousands of timers cost the
+// same per tick as a few. Not synchronized; the owner drives advance().
+class TimerWheel {
+public:
+  using Key = std::uint64_t;
+
+  explicit TimerWheel(std::size_t slot_count);
+
+  // Expires `key` after `ticks` calls to advance() (at least one).
+  // Replaces an earlier schedule of the same key.
+  auto schedule(Key key, std::uint64_t ticks) -> void;
+  auto cancel(Key key) -> bool;
+  // Moves one tick forward; returns the keys that expired, which are no
+  // longer scheduled
+  [[nodiscard]] auto advance() -> std::vector<Key>;
+  [[nodiscard]] auto size() const -> std::size_t { return m_index.size(); }
+
+private:
+  struct Entry {
+    Key key;
+    std::uint64_t rounds;
+  };
+  struct Position {
+    std::size_t slot;
+    std::list<Entry>::iterator entry;
+  };
+
+  std::vector<std::list<Entry>> m_slots;
+  std::unordered_map<Key, Position> m_index;
+  std::size_t m_cursor{0};
+};
+
+} // namespace sbot::core
+
+#endif
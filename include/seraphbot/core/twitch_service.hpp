@@ -1,6 +1,7 @@
 #ifndef SBOT_CORE_TWITCH_SERVICE_HPP
 #define SBOT_CORE_TWITCH_SERVICE_HPP
 
+#include <atomic>
 #include <boost/asio/awaitable.hpp>
 #include <cstdint>
 #include <functional>
@@ -10,6 +11,7 @@
 
 #include "seraphbot/core/chat_message.hpp"
 #include "seraphbot/core/connection_manager.hpp"
+#include "seraphbot/core/versioned.hpp"
 #include "seraphbot/tw/auth.hpp"
 #include "seraphbot/tw/chat/read.hpp"
 #include "seraphbot/tw/chat/send.hpp"
@@ -32,24 +34,36 @@ public:
     Error
   };
 
+  // Consistent view of the session for the UI, published as a whole
+  struct Snapshot {
+    State state{State::Disconnected};
+    std::string current_user;
+  };
+
   explicit TwitchService(std::shared_ptr<ConnectionManager> connection,
                          tw::ClientConfig &cfg);
   ~TwitchService();
 
   auto startLogin() -> void;
   auto connectToChat() -> boost::asio::awaitable<void>;
-  auto sendMessage(const std::string &message) -> void;
+  // `on_sent` runs exactly once: with true on an I/O thread once Twitch
+  // accepted the message, or with false if it could not be sent
+  auto sendMessage(const std::string &message,
+                   std::function<void(bool)> on_sent = {}) -> void;
   auto disconnect() -> void;
 
-  [[nodiscard]] auto getState() const -> State { return m_state; }
+  [[nodiscard]] auto getState() const -> State { return m_state.load(); }
   [[nodiscard]] auto canConnectToChat() const -> bool {
-    return m_state == State::LoggedIn;
+    return m_state.load() == State::LoggedIn;
   }
   [[nodiscard]] auto canSendMessages() const -> bool {
-    return m_state == State::ChatConnected;
+    return m_state.load() == State::ChatConnected;
   }
   [[nodiscard]] auto getCurrentUser() const -> std::string {
-    return m_current_user;
+    return m_snapshot.get().current_user;
+  }
+  [[nodiscard]] auto snapshot() const -> const Versioned<Snapshot> & {
+    return m_snapshot;
   }
 
   auto setMessageCallback(MessageCallback callback) -> void {
@@ -67,8 +81,8 @@ private:
   std::unique_ptr<tw::chat::Send> m_chat_send;
   tw::ClientConfig &m_config;
 
-  State m_state{State::Disconnected};
-  std::string m_current_user;
+  std::atomic<State> m_state{State::Disconnected};
+  Versioned<Snapshot> m_snapshot;
 
   MessageCallback m_message_callback;
   StatusCallback m_status_callback;
@@ -0,0 +1,66 @@
+#ifndef SBOT_CORE_VERSIONED_HPP
+#define SBOT_CORE_VERSIONED_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+namespace sbot::core {
+
+// Value shared between I/O threads (writers) and the UI thread (reader).
+// Every write bumps an atomic version, so readers can poll the version each
+// frame and only take the lock and copy the value when it actually changed.
+template <typename T>
+class Versioned {
+public:
+  Versioned() = default;
+  explicit Versioned(T value) : m_value{std::move(value)} {}
+
+  Versioned(const Versioned &)                     = delete;
+  auto operator=(const Versioned &) -> Versioned & = delete;
+  Versioned(Versioned &&)                          = delete;
+  auto operator=(Versioned &&) -> Versioned &      = delete;
+
+  template <typename Fn>
+  auto update(Fn &&mutate) -> void {
+    std::lock_guard lock{m_mutex};
+    std::forward<Fn>(mutate)(m_value);
+    m_version.fetch_add(1, std::memory_order_release);
+  }
+
+  auto set(T value) -> void {
+    update([&value](T &current) { current = std::move(value); });
+  }
+
+  [[nodiscard]] auto get() const -> T {
+    std::lock_guard lock{m_mutex};
+    return m_value;
+  }
+
+  [[nodiscard]] auto version() const -> std::uint64_t {
+    return m_version.load(std::memory_order_acquire);
+  }
+
+  // Copies the value into `out` only if it changed since `seen_version`.
+  // Copy-assignment lets `out` reuse its existing buffers.
+  auto syncIfChanged(std::uint64_t &seen_version, T &out) const -> bool {
+    if (version() == seen_version) {
+      return false;
+    }
+    std::lock_guard lock{m_mutex};
+    out          = m_value;
+    seen_version = m_version.load(std::memory_order_relaxed);
+    return true;
+  }
+
+private:
+  mutable std::mutex m_mutex;
+  T m_value{};
+  // Starts at 1 so a freshly constructed reader (seen_version == 0) syncs once
+  std::atomic<std::uint64_t> m_version{1};
+};
+
+} // namespace sbot::core
+
+#endif
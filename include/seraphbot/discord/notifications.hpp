@@ -2,8 +2,10 @@
 #define SBOT_DISCORD_NOTIFICATIONS_HPP
 
 #include "seraphbot/core/connection_manager.hpp"
+#include "seraphbot/core/versioned.hpp"
 #include "seraphbot/tw/config.hpp"
 #include <boost/asio/awaitable.hpp>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <utility>
@@ -18,16 +20,21 @@ public:
   auto sendMessage(std::string message) -> boost::asio::awaitable<void>;
 
   [[nodiscard]] auto getWebhookUrl() const -> std::string {
-    return m_webhook_url;
+    return m_webhook_url.get();
   }
   auto setWebhookUrl(std::string webhook_url) -> void {
-    m_webhook_url = std::move(webhook_url);
+    m_webhook_url.set(std::move(webhook_url));
+  }
+  // Copies the URL into `out` only when it changed since `seen_version`
+  auto syncWebhookUrl(std::uint64_t &seen_version, std::string &out) const
+      -> bool {
+    return m_webhook_url.syncIfChanged(seen_version, out);
   }
 
 private:
   std::shared_ptr<core::ConnectionManager> m_connection;
   tw::ClientConfig &m_cfg;
-  std::string m_webhook_url;
+  core::Versioned<std::string> m_webhook_url;
 };
 
 } // namespace sbot::discord
@@ -16,6 +16,8 @@ struct ClientConfig {
   std::string port       = "443";
   std::string helix_host = "api.twitch.tv";
   std::string helix_port = "443";
+  // Lua commands' ctx:httpGet targets are paths below this; https only
+  std::string script_http_base = "https://api.twitch.tv/helix";
 
   std::string client_id;
   std::string access_token;   // raw token (no "oauth:" prefix)
@@ -0,0 +1,117 @@
+#ifndef SBOT_UI_EMOTE_CACHE_HPP
+#define SBOT_UI_EMOTE_CACHE_HPP
+
+#include <atomic>
+#include <boost/asio/thread_pool.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <imgui.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "seraphbot/ui/emote_fetcher.hpp"
+#include "seraphbot/ui/imgui_backend.hpp"
+
+namespace sbot::ui {
+
+struct EmoteSprite {
+  ImTextureID texture{};
+  ImVec2 uv0;
+  ImVec2 uv1;
+  ImVec2 size;
+};
+
+// Emote images packed into one fixed-cell GPU atlas. Fetching and PNG decoding
+// run on a small worker pool; the UI thread only uploads a bounded number of
+// finished images per frame and evicts the least recently drawn emotes when
+// the atlas is full. Everything except the workers runs on the UI thread.
+class EmoteCache {
+public:
+  static constexpr int c_atlas_size{1024};
+  static constexpr int c_cell_size{32};
+  static constexpr std::size_t c_decode_threads{2};
+  static constexpr std::size_t c_max_uploads_per_frame{8};
+  // Fetches + decoded images waiting for upload; bounds worker memory
+  static constexpr std::size_t c_max_in_flight{16};
+  static constexpr std::size_t c_max_queued_requests{512};
+  // A failed emote is fetched again after this, doubling with each failure
+  // up to c_max_retry_delay
+  static constexpr std::chrono::seconds c_retry_delay{30};
+  static constexpr std::chrono::minutes c_max_retry_delay{30};
+
+  EmoteCache(ImGuiBackend &backend, std::unique_ptr<EmoteFetcher> fetcher);
+  ~EmoteCache();
+
+  EmoteCache(const EmoteCache &)                     = delete;
+  auto operator=(const EmoteCache &) -> EmoteCache & = delete;
+  EmoteCache(EmoteCache &&)                          = delete;
+  auto operator=(EmoteCache &&) -> EmoteCache &      = delete;
+
+  // Returns the sprite when the emote is resident, otherwise schedules it
+  // and returns nothing so the caller can draw the emote name instead.
+  auto lookup(const std::string &emote_id) -> std::optional<EmoteSprite>;
+  // Once per frame, before any lookup
+  auto processUploads() -> void;
+  // Must run while the backend is still alive
+  auto releaseTexture() -> void;
+
+  [[nodiscard]] auto residentCount() const -> std::size_t {
+    return m_lru.size();
+  }
+
+private:
+  enum class Status : std::uint8_t { Queued, Decoding, Resident, Failed };
+
+  struct Entry {
+    Status status{Status::Queued};
+    int slot{-1};
+    int width{0};
+    int height{0};
+    std::uint64_t last_used_frame{0};
+    std::list<std::string>::iterator lru_pos;
+    // Failed entries only
+    int failures{0};
+    std::chrono::steady_clock::time_point retry_at;
+  };
+
+  struct DecodedEmote {
+    std::string emote_id;
+    int width{0};
+    int height{0};
+    std::vector<unsigned char> pixels;
+  };
+
+  ImGuiBackend &m_backend;
+  std::unique_ptr<EmoteFetcher> m_fetcher;
+  boost::asio::thread_pool m_workers{c_decode_threads};
+  std::atomic<bool> m_stopping{false};
+
+  ImTextureID m_atlas{};
+  bool m_has_atlas{false};
+  std::unordered_map<std::string, Entry> m_entries;
+  std::deque<std::string> m_requests;
+  std::size_t m_in_flight{0};
+  // Front is the most recently drawn resident emote
+  std::list<std::string> m_lru;
+  std::vector<int> m_free_slots;
+  std::uint64_t m_frame{0};
+
+  std::mutex m_decoded_mutex;
+  std::deque<DecodedEmote> m_decoded;
+
+  auto dispatchRequests() -> void;
+  auto decode(const std::string &emote_id) -> DecodedEmote;
+  auto acquireSlot() -> int;
+  [[nodiscard]] auto spriteFor(const Entry &entry) const -> EmoteSprite;
+};
+
+} // namespace sbot::ui
+
+#endif
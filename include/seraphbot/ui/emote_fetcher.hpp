@@ -0,0 +1,91 @@
+#ifndef SBOT_UI_EMOTE_FETCHER_HPP
+#define SBOT_UI_EMOTE_FETCHER_HPP
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace sbot::core {
+class ConnectionManager;
+} // namespace sbot::core
+
+namespace sbot::ui {
+
+// Source of encoded (PNG) emote images. Called from the emote decode workers,
+// so implementations may block but must be thread safe.
+class EmoteFetcher {
+public:
+  virtual ~EmoteFetcher() = default;
+
+  virtual auto fetch(const std::string &emote_id)
+      -> std::optional<std::vector<unsigned char>> = 0;
+  // Makes fetches in progress return nothing right away and later ones fail;
+  // for shutdown, from any thread
+  virtual auto cancel() -> void {}
+
+  // Emote ids end up in file names and URLs, so only allow what Twitch uses
+  [[nodiscard]] static auto isValidEmoteId(const std::string &emote_id)
+      -> bool;
+};
+
+// Reads `<directory>/<emote_id>.png`; stands in for the CDN when testing
+class DirectoryEmoteFetcher : public EmoteFetcher {
+public:
+  explicit DirectoryEmoteFetcher(std::filesystem::path directory);
+
+  auto fetch(const std::string &emote_id)
+      -> std::optional<std::vector<unsigned char>> override;
+
+private:
+  std::filesystem::path m_directory;
+};
+
+// Downloads the static dark 1.0 variant from the Twitch emote CDN. A
+// download that times out or is cancelled is aborted on the io_context, not
+// just abandoned.
+class CdnEmoteFetcher : public EmoteFetcher {
+public:
+  explicit CdnEmoteFetcher(
+      std::shared_ptr<core::ConnectionManager> connection,
+      std::string host = "static-cdn.jtvnw.net", std::string port = "443");
+
+  auto fetch(const std::string &emote_id)
+      -> std::optional<std::vector<unsigned char>> override;
+  auto cancel() -> void override;
+
+private:
+  struct Download;
+
+  std::shared_ptr<core::ConnectionManager> m_connection;
+  std::string m_host;
+  std::string m_port;
+
+  std::mutex m_mutex;
+  std::set<std::shared_ptr<Download>> m_downloads;
+  bool m_cancelled{false};
+};
+
+// Serves emotes from a cache directory and only asks `upstream` for misses,
+// so every emote is downloaded once across sessions
+class DiskCachedEmoteFetcher : public EmoteFetcher {
+public:
+  DiskCachedEmoteFetcher(std::filesystem::path cache_directory,
+                         std::unique_ptr<EmoteFetcher> upstream);
+
+  auto fetch(const std::string &emote_id)
+      -> std::optional<std::vector<unsigned char>> override;
+  auto cancel() -> void override;
+
+private:
+  DirectoryEmoteFetcher m_cache;
+  std::filesystem::path m_cache_directory;
+  std::unique_ptr<EmoteFetcher> m_upstream;
+};
+
+} // namespace sbot::ui
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef SBOT_UI_IMGUI_BACKEND_HPP
 #define SBOT_UI_IMGUI_BACKEND_HPP
 
+#include <imgui.h>
+
 struct GLFWwindow;
 
 namespace sbot::ui {
@@ -12,6 +14,14 @@ public:
   virtual void newFrame()               = 0;
   virtual void renderDrawData()         = 0;
   virtual void shutdown()               = 0;
+  // Headless backends skip GLFW window and GL context creation
+  [[nodiscard]] virtual auto needsWindow() const -> bool { return true; }
+
+  // RGBA8 textures for UI owned images (emote atlas)
+  virtual auto createTexture(int width, int height) -> ImTextureID = 0;
+  virtual void updateTexture(ImTextureID texture, int x, int y, int width,
+                             int height, const unsigned char *rgba) = 0;
+  virtual void destroyTexture(ImTextureID texture)                 = 0;
 };
 
 } // namespace sbot::ui
@@ -0,0 +1,71 @@
+#ifndef SBOT_UI_IMGUI_BACKEND_NULL_HPP
+#define SBOT_UI_IMGUI_BACKEND_NULL_HPP
+
+#include "seraphbot/core/logging.hpp"
+#include "seraphbot/ui/imgui_backend.hpp"
+
+#include <cstdint>
+#include <imgui.h>
+
+namespace sbot::ui {
+
+// Renders nothing and needs no window or GL context. Lets the UI code run
+// headless, e.g. to measure frame cost in CI.
+class ImGuiBackendNull : public ImGuiBackend {
+public:
+  static constexpr float c_default_width{1280.0F};
+  static constexpr float c_default_height{720.0F};
+  static constexpr float c_default_delta{1.0F / 60.0F};
+
+  explicit ImGuiBackendNull(float width  = c_default_width,
+                            float height = c_default_height,
+                            float delta  = c_default_delta)
+      : m_width{width}, m_height{height}, m_delta{delta} {
+    LOG_CONTEXT("ImGuiBackendNull");
+    LOG_INFO("Initializing");
+  }
+
+  ~ImGuiBackendNull() override {
+    LOG_CONTEXT("ImGuiBackendNull");
+    LOG_INFO("Shutting down");
+  }
+
+  [[nodiscard]] auto needsWindow() const -> bool override { return false; }
+
+  void init(GLFWwindow * /*window*/) override {
+    ImGuiIO &io    = ImGui::GetIO();
+    io.DisplaySize = ImVec2(m_width, m_height);
+    // Nothing uploads the font atlas, it only has to be built
+    unsigned char *pixels{nullptr};
+    int tex_width{0};
+    int tex_height{0};
+    io.Fonts->GetTexDataAsRGBA32(&pixels, &tex_width, &tex_height);
+  }
+
+  void newFrame() override {
+    ImGuiIO &io    = ImGui::GetIO();
+    io.DisplaySize = ImVec2(m_width, m_height);
+    io.DeltaTime   = m_delta;
+  }
+
+  void renderDrawData() override {}
+  void shutdown() override {}
+
+  auto createTexture(int /*width*/, int /*height*/) -> ImTextureID override {
+    return static_cast<ImTextureID>(++m_next_texture);
+  }
+  void updateTexture(ImTextureID /*texture*/, int /*x*/, int /*y*/,
+                     int /*width*/, int /*height*/,
+                     const unsigned char * /*rgba*/) override {}
+  void destroyTexture(ImTextureID /*texture*/) override {}
+
+private:
+  float m_width;
+  float m_height;
+  float m_delta;
+  std::uint64_t m_next_texture{0};
+};
+
+} // namespace sbot::ui
+
+#endif
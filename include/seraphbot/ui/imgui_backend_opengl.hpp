@@ -4,9 +4,12 @@
 #include "seraphbot/core/logging.hpp"
 #include "seraphbot/ui/imgui_backend.hpp"
 
+#include <GL/gl.h>
 #include <backends/imgui_impl_glfw.h>
 #include <backends/imgui_impl_opengl3.h>
+#include <cstddef>
 #include <imgui.h>
+#include <vector>
 
 namespace sbot::ui {
 
@@ -40,6 +43,36 @@ public:
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
   }
+
+  auto createTexture(int width, int height) -> ImTextureID override {
+    GLuint texture{0};
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // Zeroed so unused atlas cells stay transparent
+    std::vector<unsigned char> blank(
+        static_cast<std::size_t>(width) * static_cast<std::size_t>(height) * 4,
+        0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, blank.data());
+    return static_cast<ImTextureID>(texture);
+  }
+
+  void updateTexture(ImTextureID texture, int x, int y, int width, int height,
+                     const unsigned char *rgba) override {
+    glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(texture));
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, GL_RGBA,
+                    GL_UNSIGNED_BYTE, rgba);
+  }
+
+  void destroyTexture(ImTextureID texture) override {
+    auto gl_texture = static_cast<GLuint>(texture);
+    glDeleteTextures(1, &gl_texture);
+  }
 };
 
 }; // namespace sbot::ui
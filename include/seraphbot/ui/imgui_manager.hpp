@@ -4,10 +4,15 @@
 #include <imgui.h>
 
 #include "seraphbot/core/app_state.hpp"
+#include "seraphbot/core/chat_message.hpp"
 #include "seraphbot/core/twitch_service.hpp"
+#include "seraphbot/ui/emote_cache.hpp"
+#include "seraphbot/ui/emote_fetcher.hpp"
 #include "seraphbot/ui/imgui_backend.hpp"
 #include "seraphbot/viewmodels/chat_viewmodel.hpp"
 #include "seraphbot/viewmodels/discord_viewmodel.hpp"
+#include "seraphbot/viewmodels/metrics_viewmodel.hpp"
+#include "seraphbot/viewmodels/profiler_viewmodel.hpp"
 #include "seraphbot/viewmodels/auth_viewmodel.hpp"
 
 #include <memory>
@@ -37,6 +42,8 @@ public:
   auto hexToImVec4(const std::string &hex) -> ImVec4;
 
   auto getWindow() -> GLFWwindow * { return m_window; }
+  // Renders emote fragments inline, fetching images through `fetcher`
+  auto enableEmotes(std::unique_ptr<EmoteFetcher> fetcher) -> void;
 
   core::AppState &state;
 
@@ -45,12 +52,17 @@ public:
   auto manageAuth(sbot::viewmodels::AuthVM &auth_vm) -> void;
   auto manageChat(sbot::viewmodels::ChatVM &chat_vm) -> void;
   auto manageDiscord(sbot::viewmodels::DiscordVM &discord_vm) -> void;
+  auto manageMetrics(sbot::viewmodels::MetricsVM &metrics_vm) -> void;
+  auto manageProfiler(sbot::viewmodels::ProfilerVM &profiler_vm) -> void;
 
 private:
   std::unique_ptr<ImGuiBackend> m_backend;
-  GLFWwindow *m_window;
-  ImGuiContext *m_context;
+  std::unique_ptr<EmoteCache> m_emote_cache;
+  GLFWwindow *m_window{nullptr};
+  ImGuiContext *m_context{nullptr};
   std::vector<char> m_message_input /*(256, '\0')*/;
+
+  auto drawFragments(const core::ChatMessage &msg) -> void;
 };
 
 } // namespace sbot::ui
@@ -4,6 +4,7 @@
 #include <boost/asio/awaitable.hpp>
 #include <boost/asio/co_spawn.hpp>
 #include <boost/asio/detached.hpp>
+#include <cstdint>
 #include <string>
 
 #include "seraphbot/core/connection_manager.hpp"
@@ -11,22 +12,27 @@
 
 namespace sbot::viewmodels {
 
-// TODO: Consider caching expensive operations instead of calling them each
-// time.
+// Mirrors the TwitchService snapshot; strings are only re-copied when the
+// service publishes a new version.
 struct AuthVM {
   sbot::core::TwitchService &tw_service;
   sbot::core::ConnectionManager &connection;
-  sbot::core::TwitchService::State state{};
+  sbot::core::TwitchService::Snapshot snapshot{};
+  std::uint64_t seen_version{0};
 
   AuthVM(sbot::core::TwitchService &tw_s, sbot::core::ConnectionManager &c)
       : tw_service(tw_s), connection(c) {}
 
-  auto syncFrom() -> void { state = tw_service.getState(); }
-  auto getState() const -> sbot::core::TwitchService::State { return state; }
+  auto syncFrom() -> void {
+    tw_service.snapshot().syncIfChanged(seen_version, snapshot);
+  }
+  auto getState() const -> sbot::core::TwitchService::State {
+    return snapshot.state;
+  }
 
   auto login() -> void { tw_service.startLogin(); }
-  [[nodiscard]] auto currentUser() const -> std::string {
-    return tw_service.getCurrentUser();
+  [[nodiscard]] auto currentUser() const -> const std::string & {
+    return snapshot.current_user;
   }
   auto connect() -> void {
     boost::asio::co_spawn(*connection.getIoContext(),
@@ -1,6 +1,7 @@
 #ifndef SBOT_VIEWMODELS_CHAT_VIEWMODEL_HPP
 #define SBOT_VIEWMODELS_CHAT_VIEWMODEL_HPP
 
+#include <cstdint>
 #include <string>
 
 #include "seraphbot/core/twitch_service.hpp"
@@ -9,10 +10,17 @@ namespace sbot::viewmodels {
 
 struct ChatVM {
   sbot::core::TwitchService &tw_service;
+  sbot::core::TwitchService::Snapshot snapshot{};
+  std::uint64_t seen_version{0};
 
   ChatVM(sbot::core::TwitchService &tw) : tw_service(tw) {}
 
-  auto canSendMessages() -> bool { return tw_service.canSendMessages(); }
+  auto syncFrom() -> void {
+    tw_service.snapshot().syncIfChanged(seen_version, snapshot);
+  }
+  [[nodiscard]] auto canSendMessages() const -> bool {
+    return snapshot.state == sbot::core::TwitchService::State::ChatConnected;
+  }
   auto sendMessage(std::string msg) -> void { tw_service.sendMessage(msg); }
 };
 
@@ -3,6 +3,7 @@
 
 #include <boost/asio/awaitable.hpp>
 #include <boost/asio/co_spawn.hpp>
+#include <cstdint>
 #include <exception>
 #include <string>
 
@@ -17,6 +18,8 @@ struct DiscordVM {
   sbot::discord::Notifications &notifications;
   char webhook_url[512]       = "";
   char notification_text[512] = "";
+  std::string applied_webhook_url;
+  std::uint64_t seen_version{0};
 
   DiscordVM(sbot::core::ConnectionManager &c, sbot::discord::Notifications &d)
       : connection(c), notifications(d) {}
@@ -24,8 +27,8 @@ struct DiscordVM {
   auto syncTo(const std::string &url) -> void {
     notifications.setWebhookUrl(url);
   }
-  [[nodiscard]] auto syncFrom() const -> std::string {
-    return notifications.getWebhookUrl();
+  auto syncFrom() -> void {
+    notifications.syncWebhookUrl(seen_version, applied_webhook_url);
   }
   auto testMessage(const std::string &message) -> void {
     boost::asio::co_spawn(
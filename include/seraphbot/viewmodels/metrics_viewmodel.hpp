@@ -0,0 +1,44 @@
+#ifndef SBOT_VIEWMODELS_METRICS_VIEWMODEL_HPP
+#define SBOT_VIEWMODELS_METRICS_VIEWMODEL_HPP
+
+#include <chrono>
+#include <vector>
+
+#include "seraphbot/core/command_metrics.hpp"
+
+namespace sbot::viewmodels {
+
+struct MetricsVM {
+  // Copying rows walks every histogram, so don't do it every frame
+  static constexpr std::chrono::seconds c_refresh_interval{1};
+
+  sbot::core::CommandMetrics &metrics;
+  std::vector<sbot::core::CommandStatsRow> rows;
+  std::vector<sbot::core::HeapUsageRow> heap_rows;
+  std::chrono::microseconds wait_p50{0};
+  std::chrono::microseconds wait_p99{0};
+  std::chrono::microseconds run_p50{0};
+  std::chrono::microseconds run_p99{0};
+  std::chrono::steady_clock::time_point next_refresh{};
+
+  MetricsVM(sbot::core::CommandMetrics &m) : metrics(m) {}
+
+  auto syncFrom() -> void {
+    auto now = std::chrono::steady_clock::now();
+    if (now < next_refresh) {
+      return;
+    }
+    const auto &executor = metrics.executor();
+    rows                 = metrics.rows();
+    heap_rows            = metrics.heapRows();
+    wait_p50             = executor.wait.quantile(0.5);
+    wait_p99             = executor.wait.quantile(0.99);
+    run_p50              = executor.run.quantile(0.5);
+    run_p99              = executor.run.quantile(0.99);
+    next_refresh         = now + c_refresh_interval;
+  }
+};
+
+} // namespace sbot::viewmodels
+
+#endif
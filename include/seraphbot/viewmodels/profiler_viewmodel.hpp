@@ -0,0 +1,50 @@
+#ifndef SBOT_VIEWMODELS_PROFILER_VIEWMODEL_HPP
+#define SBOT_VIEWMODELS_PROFILER_VIEWMODEL_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "seraphbot/core/lua_profiler.hpp"
+
+namespace sbot::viewmodels {
+
+struct ProfilerVM {
+  // Rows are rebuilt from every recorded stack, so not every frame
+  static constexpr std::chrono::seconds c_refresh_interval{1};
+  static constexpr const char *c_export_path{"profiles/lua_commands.folded"};
+
+  sbot::core::LuaProfiler &profiler;
+  bool enabled{false};
+  std::vector<sbot::core::ProfileRow> rows;
+  std::uint64_t samples{0};
+  std::uint64_t dropped{0};
+  std::chrono::steady_clock::time_point next_refresh{};
+
+  ProfilerVM(sbot::core::LuaProfiler &p) : profiler(p) {}
+
+  auto syncFrom() -> void {
+    enabled  = profiler.enabled();
+    auto now = std::chrono::steady_clock::now();
+    if (now < next_refresh) {
+      return;
+    }
+    rows         = profiler.rows();
+    samples      = profiler.sampleCount();
+    dropped      = profiler.droppedCount();
+    next_refresh = now + c_refresh_interval;
+  }
+
+  auto setEnabled(bool value) -> void { profiler.setEnabled(value); }
+
+  auto reset() -> void {
+    profiler.reset();
+    next_refresh = {};
+  }
+
+  auto exportFolded() -> bool { return profiler.exportFolded(c_export_path); }
+};
+
+} // namespace sbot::viewmodels
+
+#endif
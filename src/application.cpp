@@ -1,29 +1,130 @@
 #include "seraphbot/application.hpp"
 
+#include <algorithm>
+#include <array>
 #include <boost/asio/co_spawn.hpp>
 #include <boost/asio/detached.hpp>
+#include <chrono>
 #include <cstddef>
+#include <exception>
 #include <filesystem>
+#include <format>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <random>
+#include <set>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "seraphbot/core/app_state.hpp"
 #include "seraphbot/core/chat_message.hpp"
+#include "seraphbot/core/chat_scheduler.hpp"
+#include "seraphbot/core/command_executor.hpp"
+#include "seraphbot/core/command_metrics.hpp"
 #include "seraphbot/core/command_parser.hpp"
 #include "seraphbot/core/connection_manager.hpp"
+#include "seraphbot/core/file_watcher.hpp"
 #include "seraphbot/core/logging.hpp"
+#include "seraphbot/core/lua_async.hpp"
 #include "seraphbot/core/lua_command_engine.hpp"
 #include "seraphbot/core/twitch_service.hpp"
 #include "seraphbot/discord/notifications.hpp"
 #include "seraphbot/obs/obsservice.hpp"
+#include "seraphbot/tw/config.hpp"
+#include "seraphbot/ui/emote_fetcher.hpp"
 #include "seraphbot/ui/imgui_backend_opengl.hpp"
 #include "seraphbot/ui/imgui_manager.hpp"
 #include "seraphbot/viewmodels/auth_viewmodel.hpp"
 #include "seraphbot/viewmodels/chat_viewmodel.hpp"
 #include "seraphbot/viewmodels/discord_viewmodel.hpp"
+#include "seraphbot/viewmodels/metrics_viewmodel.hpp"
+#include "seraphbot/viewmodels/profiler_viewmodel.hpp"
+
+namespace {
+const std::filesystem::path c_metrics_path{"metrics/commands.prom"};
+constexpr std::chrono::seconds c_metrics_export_interval{15};
+constexpr std::size_t c_max_command_workers{8};
+// Commands listed by a bare !stats
+constexpr std::size_t c_stats_top_commands{3};
+// Executor queue for hot reloads; not a valid Twitch login
+constexpr const char *c_reload_queue{"@reload"};
+constexpr unsigned c_reload_weight{3};
+// Executor queue for timed messages, weighted like a viewer's commands
+constexpr const char *c_timer_queue{"@timers"};
+constexpr unsigned c_timer_weight{1};
+
+// Commands per fair-queueing round; higher ranks get more of the executor
+// when chat is busy but are still bounded per user
+auto commandWeight(const sbot::core::ChatMessage &msg) -> unsigned {
+  namespace badge = sbot::core::badge;
+  if (msg.hasAnyBadge(badge::c_moderator_rank)) {
+    return 3;
+  }
+  // Founders are subscribers too
+  if (msg.hasAnyBadge(badge::c_subscriber_rank)) {
+    return 2;
+  }
+  return 1;
+}
+
+struct HttpBase {
+  std::string host;
+  std::string port{"443"};
+  // Prepended to every target; no trailing slash
+  std::string path;
+};
+
+// Helix endpoints scripts may call with the bot's credentials; read-only
+// lookups of public data. Anything else on the Helix host is refused, since
+// the token is the broadcaster's and the response goes back to the script.
+constexpr std::array<std::string_view, 11> c_script_helix_endpoints{
+    "/users", "/streams", "/channels", "/games", "/games/top",
+    "/chat/emotes/global", "/chat/badges/global", "/search/categories",
+    "/search/channels", "/clips", "/videos"};
+
+// A path below the base with an optional query; printable ASCII only, so
+// nothing can end up in the request line or headers
+auto isValidScriptTarget(std::string_view target) -> bool {
+  return target.starts_with('/') &&
+         target.find("..") == std::string_view::npos &&
+         std::ranges::all_of(target, [](char chr) {
+           return chr > ' ' && chr < '\x7f';
+         });
+}
+
+// "https://host[:port][/path]"
+auto parseHttpBase(std::string_view url) -> std::optional<HttpBase> {
+  constexpr std::string_view c_scheme{"https://"};
+  if (!url.starts_with(c_scheme)) {
+    return std::nullopt;
+  }
+  url.remove_prefix(c_scheme.size());
+  std::size_t slash          = url.find('/');
+  std::string_view authority = url.substr(0, slash);
+  HttpBase base;
+  if (slash != std::string_view::npos) {
+    base.path = url.substr(slash);
+    while (base.path.ends_with('/')) {
+      base.path.pop_back();
+    }
+  }
+  std::size_t colon = authority.find(':');
+  base.host         = authority.substr(0, colon);
+  if (colon != std::string_view::npos) {
+    base.port = authority.substr(colon + 1);
+  }
+  if (base.host.empty() || base.port.empty()) {
+    return std::nullopt;
+  }
+  return base;
+}
+} // namespace
 
 sbot::Application::Application() {
   LOG_CONTEXT("Application");
@@ -51,11 +152,23 @@ auto sbot::Application::initialize() -> bool {
 }
 
 auto sbot::Application::initializeServices() -> bool {
+  // One Lua state per worker; commands are short, so a few go a long way
+  std::size_t command_workers = std::clamp<std::size_t>(
+      std::thread::hardware_concurrency(), 1, c_max_command_workers);
   m_conn      = std::make_shared<sbot::core::ConnectionManager>(m_thread_count);
   m_app_state = std::make_unique<sbot::core::AppState>();
+  m_metrics   = std::make_unique<sbot::core::CommandMetrics>();
   m_command_parser = std::make_unique<sbot::core::CommandParser>();
-  m_command_engine = std::make_unique<sbot::core::LuaCommandEngine>();
-  m_tw_service     = std::make_unique<sbot::core::TwitchService>(m_conn, m_cfg);
+  m_scheduler =
+      std::make_unique<sbot::core::ChatScheduler>(m_conn->getIoContext());
+  m_command_engine =
+      std::make_unique<sbot::core::LuaCommandEngine>(command_workers);
+  m_command_parser->setMetrics(m_metrics.get());
+  m_command_engine->setMetrics(m_metrics.get());
+  m_command_executor =
+      std::make_unique<sbot::core::CommandExecutor>(command_workers);
+  m_command_executor->setMetrics(m_metrics.get());
+  m_tw_service = std::make_unique<sbot::core::TwitchService>(m_conn, m_cfg);
   return true;
 }
 
@@ -71,6 +184,9 @@ auto sbot::Application::initializeViewmodels() -> bool {
   m_discord_vm =
       std::make_unique<sbot::viewmodels::DiscordVM>(*m_conn, *m_disc_not);
   m_chat_vm = std::make_unique<sbot::viewmodels::ChatVM>(*m_tw_service);
+  m_metrics_vm = std::make_unique<sbot::viewmodels::MetricsVM>(*m_metrics);
+  m_profiler_vm = std::make_unique<sbot::viewmodels::ProfilerVM>(
+      m_command_engine->profiler());
   return true;
 }
 
@@ -78,25 +194,178 @@ auto sbot::Application::initializeUi() -> bool {
   m_ui_backend = std::make_unique<sbot::ui::ImGuiBackendOpenGL>();
   m_ui_manager = std::make_unique<sbot::ui::ImGuiManager>(
       std::move(m_ui_backend), *m_app_state);
+  m_ui_manager->enableEmotes(std::make_unique<sbot::ui::DiskCachedEmoteFetcher>(
+      "cache/emotes", std::make_unique<sbot::ui::CdnEmoteFetcher>(m_conn)));
   return true;
 }
 
 auto sbot::Application::setupCallbacks() -> void {
   m_tw_service->setMessageCallback([this](const sbot::core::ChatMessage &msg) {
     m_app_state->pushChatMessage(msg);
-    auto reply_fn = [this](const std::string &text) {
-      m_tw_service->sendMessage(text);
-    };
-    if (m_command_parser->parseAndExecute(msg, reply_fn)) {
-      LOG_DEBUG("Message handled as command");
+    // The bot posts as the channel owner; counting those posts would let
+    // timers satisfy each other's min_messages
+    if (msg.user_id.empty() || msg.user_id != m_cfg.broadcaster_id) {
+      m_scheduler->noteChatMessage();
+    }
+    // Commands (and their Lua handlers) run on the executor, not the I/O
+    // thread that read the frame
+    bool queued{true};
+    if (m_command_parser->isCommand(msg.text)) {
+      queued = m_command_executor->submit(
+          msg.user, commandWeight(msg), [this, msg] {
+            auto reply_fn = makeReply(
+                std::string{m_command_parser->peekCommand(msg.text)});
+            if (m_command_parser->parseAndExecute(msg, std::move(reply_fn))) {
+              LOG_DEBUG("Message handled as command");
+            }
+          });
+    } else if (auto match = m_command_parser->matchTriggers(msg.text)) {
+      queued = m_command_executor->submit(
+          msg.user, commandWeight(msg), [this, msg, match = std::move(match)] {
+            auto reply_fn =
+                makeReply(match.triggers->commands[match.keywords.front()]);
+            m_command_parser->executeTriggers(msg, match, reply_fn);
+          });
+    }
+    if (!queued) {
+      LOG_DEBUG("Command queue full, dropped command from {}", msg.user);
     }
   });
   m_tw_service->setStatusCallback(
       [this](const std::string &status) { m_app_state->last_status = status; });
 }
 
+auto sbot::Application::makeReply(std::string command) -> core::ReplyFn {
+  return [this, command = std::move(command),
+          started = std::chrono::steady_clock::now()](
+             const std::string &text, std::function<void(bool)> on_sent) {
+    m_tw_service->sendMessage(
+        text, [this, command, started,
+               on_sent = std::move(on_sent)](bool sent) {
+          // Only commands the parser resolved have an entry; typos are not
+          // kept
+          auto *stats = sent ? m_metrics->find(command) : nullptr;
+          if (stats != nullptr) {
+            stats->reply.record(std::chrono::steady_clock::now() - started);
+          }
+          if (on_sent) {
+            on_sent(sent);
+          }
+        });
+  };
+}
+
+auto sbot::Application::makeLuaRuntime() -> core::LuaAsyncRuntime {
+  core::LuaAsyncRuntime runtime;
+  runtime.io_context = m_conn->getIoContext();
+  runtime.schedule   = [this](std::function<void()> task) {
+    return m_command_executor->submitContinuation(std::move(task));
+  };
+
+  auto base = parseHttpBase(m_cfg.script_http_base);
+  if (!base) {
+    LOG_WARN("Invalid script HTTP base '{}'; ctx:httpGet is disabled",
+             m_cfg.script_http_base);
+    return runtime;
+  }
+  runtime.http_get =
+      [this, base = std::move(*base)](
+          std::string target,
+          std::function<void(std::optional<std::string>)> done) {
+        // Scripts only get to pick a path below the base
+        bool helix = base.host == m_cfg.helix_host;
+        std::string_view endpoint{target};
+        endpoint = endpoint.substr(0, endpoint.find('?'));
+        if (!isValidScriptTarget(target) ||
+            (helix && !std::ranges::contains(c_script_helix_endpoints,
+                                             endpoint))) {
+          LOG_WARN("Rejected Lua HTTP target '{}'", target);
+          done(std::nullopt);
+          return;
+        }
+        std::vector<std::pair<std::string, std::string>> headers;
+        if (helix) {
+          headers.emplace_back("Client-Id", m_cfg.client_id);
+          headers.emplace_back(
+              "Authorization",
+              "Bearer " + tw::stripOauthPrefix(m_cfg.access_token));
+        }
+        boost::asio::co_spawn(
+            *m_conn->getIoContext(),
+            tw::httpsGetAsync(m_conn, base.host, base.port, base.path + target,
+                              std::move(headers)),
+            [done = std::move(done)](const std::exception_ptr &err,
+                                     std::string body) {
+              if (err) {
+                try {
+                  std::rethrow_exception(err);
+                } catch (const std::exception &ex) {
+                  LOG_WARN("Lua HTTP request failed: {}", ex.what());
+                } catch (...) {
+                  LOG_WARN("Lua HTTP request failed");
+                }
+                done(std::nullopt);
+                return;
+              }
+              done(std::move(body));
+            });
+      };
+  return runtime;
+}
+
+auto sbot::Application::watchCommands(
+    const std::filesystem::path &commands_dir) -> void {
+  m_command_watcher = std::make_unique<sbot::core::FileWatcher>(
+      commands_dir, ".lua",
+      [this](std::vector<std::filesystem::path> changed) {
+        {
+          std::lock_guard lock{m_reload_mutex};
+          m_pending_reloads.insert(changed.begin(), changed.end());
+          if (m_reload_queued) {
+            // The queued drain picks these up too
+            return;
+          }
+          m_reload_queued = true;
+        }
+        // Reload on the executor, so a burst of edits queues behind chat
+        // commands instead of stalling the watcher. When chat has filled
+        // the executor, go ahead of it rather than lose the edit.
+        bool queued =
+            m_command_executor->submit(c_reload_queue, c_reload_weight,
+                                       [this] { drainReloads(); }) ||
+            m_command_executor->submitContinuation(
+                [this] { drainReloads(); });
+        if (!queued) {
+          // Shutting down
+          std::lock_guard lock{m_reload_mutex};
+          m_reload_queued = false;
+        }
+      });
+}
+
+auto sbot::Application::drainReloads() -> void {
+  while (true) {
+    std::set<std::filesystem::path> changed;
+    {
+      std::lock_guard lock{m_reload_mutex};
+      if (m_pending_reloads.empty()) {
+        m_reload_queued = false;
+        return;
+      }
+      changed.swap(m_pending_reloads);
+    }
+    for (const auto &file_path : changed) {
+      m_command_engine->reloadFile(file_path, *m_command_parser);
+    }
+  }
+}
+
 auto sbot::Application::run() -> int {
   m_command_engine->initialize();
+  m_command_engine->setAsyncRuntime(makeLuaRuntime());
+  // Lua garbage is collected while no command is waiting
+  m_command_executor->setIdleTask(
+      [this] { return m_command_engine->collectIdle(); });
   std::filesystem::path commands_dir = "commands";
   if (std::filesystem::exists(commands_dir)) {
     int loaded = m_command_engine->loadCommandsFromDirectory(commands_dir);
@@ -107,14 +376,27 @@ auto sbot::Application::run() -> int {
     LOG_INFO("Created commands directory: {}", commands_dir.string());
   }
   m_command_engine->registerWithParser(*m_command_parser);
+  m_command_engine->setScheduler(
+      m_scheduler.get(),
+      [this](const std::string &command,
+             std::function<void(core::ReplyFn)> run) {
+        bool queued = m_command_executor->submit(
+            c_timer_queue, c_timer_weight,
+            [this, command, run = std::move(run)] { run(makeReply(command)); });
+        if (!queued) {
+          LOG_DEBUG("Command queue full, skipped timer of {}", command);
+        }
+      });
+  m_scheduler->start();
+  watchCommands(commands_dir);
   // Optional: Keep some native C++ commands for core functionality
   m_command_parser->registerCommand(
       "reload", [this](const sbot::core::CommandContext &ctx) {
         ctx.reply("Reloading Lua commands...");
-        m_command_engine->reloadAllCommands();
-        m_command_engine->registerWithParser(*m_command_parser);
+        m_command_engine->reloadAllCommands(*m_command_parser);
         ctx.reply("Lua commands reloaded!");
-      });
+      },
+      {.policy = {.mod_only = true}});
   m_command_parser->registerCommand(
       "commands", [this](const core::CommandContext &ctx) {
         auto loaded_commands = m_command_engine->getLoadedCommands();
@@ -131,8 +413,47 @@ auto sbot::Application::run() -> int {
         }
         ctx.reply(response);
       });
+  m_command_parser->registerCommand(
+      "stats", [this](const core::CommandContext &ctx) {
+        if (!ctx.args.empty()) {
+          ctx.reply(m_metrics->summary(ctx.args.front()));
+          return;
+        }
+        auto rows = m_metrics->rows();
+        if (rows.empty()) {
+          ctx.reply("No commands run yet");
+          return;
+        }
+        std::string response = "Slowest commands (p99): ";
+        for (std::size_t i = 0;
+             i < std::min(rows.size(), c_stats_top_commands); ++i) {
+          if (i > 0) {
+            response += ", ";
+          }
+          response += std::format("!{} {}", rows[i].name, rows[i].execute_p99);
+        }
+        ctx.reply(response);
+      },
+      {.policy = {.user_cooldown = 10}});
 
+  auto next_metrics_export =
+      std::chrono::steady_clock::now() + c_metrics_export_interval;
   while (!m_ui_manager->shouldClose()) {
+    if (auto now = std::chrono::steady_clock::now();
+        now >= next_metrics_export) {
+      // Disk writes can stall; the frame loop must not. An export still
+      // running skips this one.
+      if (!m_metrics_export.valid() ||
+          m_metrics_export.wait_for(std::chrono::seconds{0}) ==
+              std::future_status::ready) {
+        m_metrics_export = std::async(
+            std::launch::async, [metrics = m_metrics.get()] {
+              return metrics->exportToFile(c_metrics_path);
+            });
+      }
+      next_metrics_export = now + c_metrics_export_interval;
+    }
+
     m_ui_manager->poll();
     m_ui_manager->beginFrame();
 
@@ -142,6 +463,8 @@ auto sbot::Application::run() -> int {
     m_ui_manager->manageAuth(*m_auth_vm);
     m_ui_manager->manageDiscord(*m_discord_vm);
     m_ui_manager->manageChat(*m_chat_vm);
+    m_ui_manager->manageMetrics(*m_metrics_vm);
+    m_ui_manager->manageProfiler(*m_profiler_vm);
 
     m_ui_manager->endFrame();
     m_ui_manager->render();
@@ -155,6 +478,43 @@ auto sbot::Application::shutdown() -> void {
   m_ui_manager.reset();
   m_ui_backend.reset();
 
+  // Queued commands reply through the Twitch service, stop them first
+  if (m_scheduler) {
+    m_scheduler->stop();
+  }
+  m_command_watcher.reset();
+  // Suspended Lua commands would otherwise resume onto a stopped executor
+  if (m_command_engine) {
+    m_command_engine->closeAsync();
+  }
+  if (m_command_executor) {
+    auto stats = m_command_executor->stats();
+    LOG_INFO("Commands: {} run, {} rejected, wait mean {} max {}, run mean {} "
+             "max {}",
+             stats.completed, stats.rejected,
+             std::chrono::duration_cast<std::chrono::microseconds>(
+                 stats.meanWait()),
+             std::chrono::duration_cast<std::chrono::microseconds>(
+                 stats.max_wait),
+             std::chrono::duration_cast<std::chrono::microseconds>(
+                 stats.meanRun()),
+             std::chrono::duration_cast<std::chrono::microseconds>(
+                 stats.max_run));
+    LOG_INFO("Continuations: {} run, {} total", stats.continuations,
+             std::chrono::duration_cast<std::chrono::microseconds>(
+                 stats.continuation_run));
+    m_command_executor.reset();
+  }
+  if (m_command_parser) {
+    LOG_INFO("Dropped {} stale commands", m_command_parser->shedCount());
+  }
+  if (m_metrics_export.valid()) {
+    m_metrics_export.wait();
+  }
+  if (m_metrics) {
+    m_metrics->exportToFile(c_metrics_path);
+  }
+
   m_tw_service.reset();
   m_app_state.reset();
   m_conn.reset();
@@ -0,0 +1,11 @@
+-- commands/gg.lua - Keyword trigger, runs without the ! prefix
+return {
+    name = "gg",
+    description = "Cheer along when chat says gg",
+    usage = "gg",
+    triggers = {"gg", "good game", "ggwp"},
+    command_cooldown = 30,  -- once per 30 seconds no matter how many say it
+    execute = function(ctx, args)
+        ctx:reply("GG " .. ctx:getUser() .. "! 🎉")
+    end
+}
@@ -6,6 +6,7 @@ return {
     usage = "!sfx <soundname> | !sfx list [page] | !sfx random",
     user_cooldown = 3,
     command_cooldown = 1,
+    stale_after = 10,  -- a sound 10+ seconds late is just noise, skip it
 
     execute = function(ctx, args)
         local sound_dir = "sounds"
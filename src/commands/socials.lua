@@ -0,0 +1,16 @@
+-- commands/socials.lua - Command that also posts itself on timers
+return {
+    name = "socials",
+    description = "Where else to find the stream",
+    usage = "!socials",
+    command_cooldown = 30,
+    timers = {
+        -- Every 20 minutes, skipped unless chat said 10 things since
+        { every = 1200, min_messages = 10 },
+        -- Weekdays at 18:00 local time, as a plain message
+        { cron = "0 18 * * 1-5", message = "Stream schedule: weekdays 18:00!" },
+    },
+    execute = function(ctx, args)
+        ctx:reply("Follow along on Discord and YouTube, links in the panels below!")
+    end
+}
@@ -4,10 +4,12 @@
 
 #include <algorithm>
 #include <cctype>
+#include <chrono>
 #include <cstddef>
 #include <exception>
 #include <filesystem>
 #include <memory>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -208,6 +210,15 @@ auto sbot::core::AudioSystem::playSound(const std::filesystem::path &filepath,
   return m_player->playSound(filepath, volume);
 }
 
+auto sbot::core::AudioSystem::soundLength(
+    const std::filesystem::path &filepath) const
+    -> std::optional<std::chrono::milliseconds> {
+  if (!m_whitelist.isPathAllowed(filepath.parent_path())) {
+    return std::nullopt;
+  }
+  return MiniaudioPlayer::soundLength(filepath);
+}
+
 auto sbot::core::AudioSystem::setMasterVolume(int volume) -> void {
   if (m_player && m_player->isInitialized()) {
     m_player->setMasterVolume(volume);
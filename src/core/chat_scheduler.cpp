@@ -0,0 +1,345 @@
+#include "seraphbot/core/chat_scheduler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/system/error_code.hpp>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "seraphbot/core/logging.hpp"
+#include "seraphbot/core/timer_wheel.hpp"
+
+namespace {
+// Bounds the search in CronSchedule::next; each step skips at least a
+// minute and usually a whole hour, day or month
+constexpr int c_max_cron_steps{100000};
+
+auto parseNumber(std::string_view text, int &value) -> bool {
+  const auto *end = text.data() + text.size();
+  auto [ptr, err] = std::from_chars(text.data(), end, value);
+  return err == std::errc{} && ptr == end;
+}
+
+// Sets the bits of one cron field; `first` and `last` are the field's
+// allowed values
+template <std::size_t N>
+auto parseField(std::string_view field, int first, int last,
+                std::bitset<N> &bits) -> bool {
+  while (!field.empty()) {
+    std::size_t comma     = field.find(',');
+    std::string_view item = field.substr(0, comma);
+    field = comma == std::string_view::npos ? std::string_view{}
+                                            : field.substr(comma + 1);
+
+    int step{1};
+    if (std::size_t slash = item.find('/'); slash != std::string_view::npos) {
+      if (!parseNumber(item.substr(slash + 1), step) || step < 1) {
+        return false;
+      }
+      item = item.substr(0, slash);
+    }
+    int low{first};
+    int high{last};
+    if (item != "*") {
+      std::size_t dash = item.find('-');
+      if (!parseNumber(item.substr(0, dash), low)) {
+        return false;
+      }
+      // "a/n" runs from a to the end of the field
+      high = step > 1 && dash == std::string_view::npos ? last : low;
+      if (dash != std::string_view::npos &&
+          !parseNumber(item.substr(dash + 1), high)) {
+        return false;
+      }
+    }
+    if (low < first || high > last || low > high) {
+      return false;
+    }
+    for (int value = low; value <= high; value += step) {
+      bits.set(static_cast<std::size_t>(value));
+    }
+  }
+  return bits.any();
+}
+
+auto toLocal(std::time_t time) -> std::tm {
+  std::tm local{};
+#if defined(_WIN32)
+  localtime_s(&local, &time);
+#else
+  localtime_r(&time, &local);
+#endif
+  return local;
+}
+} // namespace
+
+auto sbot::core::CronSchedule::parse(std::string_view expression)
+    -> std::optional<CronSchedule> {
+  std::vector<std::string_view> fields;
+  while (!expression.empty()) {
+    std::size_t start = expression.find_first_not_of(' ');
+    if (start == std::string_view::npos) {
+      break;
+    }
+    expression      = expression.substr(start);
+    std::size_t end = expression.find(' ');
+    fields.push_back(expression.substr(0, end));
+    expression = end == std::string_view::npos ? std::string_view{}
+                                               : expression.substr(end);
+  }
+  if (fields.size() != 5) {
+    return std::nullopt;
+  }
+
+  CronSchedule schedule;
+  std::bitset<8> weekdays;
+  if (!parseField(fields[0], 0, 59, schedule.m_minutes) ||
+      !parseField(fields[1], 0, 23, schedule.m_hours) ||
+      !parseField(fields[2], 1, 31, schedule.m_days) ||
+      !parseField(fields[3], 1, 12, schedule.m_months) ||
+      !parseField(fields[4], 0, 7, weekdays)) {
+    return std::nullopt;
+  }
+  for (std::size_t day = 0; day < 7; ++day) {
+    schedule.m_weekdays[day] = weekdays[day];
+  }
+  if (weekdays[7]) {
+    schedule.m_weekdays.set(0);
+  }
+  schedule.m_any_day     = fields[2] == "*";
+  schedule.m_any_weekday = fields[4] == "*";
+  return schedule;
+}
+
+auto sbot::core::CronSchedule::matchesDay(int day, int weekday) const
+    -> bool {
+  bool day_match     = m_days[static_cast<std::size_t>(day)];
+  bool weekday_match = m_weekdays[static_cast<std::size_t>(weekday)];
+  if (m_any_day || m_any_weekday) {
+    return day_match && weekday_match;
+  }
+  return day_match || weekday_match;
+}
+
+auto sbot::core::CronSchedule::next(
+    std::chrono::system_clock::time_point after) const
+    -> std::optional<std::chrono::system_clock::time_point> {
+  std::time_t time = std::chrono::system_clock::to_time_t(after);
+  // The next whole minute
+  std::tm local = toLocal(time);
+  local.tm_sec  = 0;
+  local.tm_min += 1;
+  local.tm_isdst = -1;
+  time           = std::mktime(&local);
+
+  for (int step = 0; step < c_max_cron_steps; ++step) {
+    local          = toLocal(time);
+    local.tm_isdst = -1;
+    if (!m_months[static_cast<std::size_t>(local.tm_mon + 1)]) {
+      local.tm_mon += 1;
+      local.tm_mday = 1;
+      local.tm_hour = 0;
+      local.tm_min  = 0;
+    } else if (!matchesDay(local.tm_mday, local.tm_wday)) {
+      local.tm_mday += 1;
+      local.tm_hour = 0;
+      local.tm_min  = 0;
+    } else if (!m_hours[static_cast<std::size_t>(local.tm_hour)]) {
+      local.tm_hour += 1;
+      local.tm_min = 0;
+    } else if (!m_minutes[static_cast<std::size_t>(local.tm_min)]) {
+      local.tm_min += 1;
+    } else {
+      return std::chrono::system_clock::from_time_t(time);
+    }
+    // mktime normalizes the overflowed field
+    time = std::mktime(&local);
+  }
+  return std::nullopt;
+}
+
+struct sbot::core::ChatScheduler::State {
+  explicit State(std::shared_ptr<boost::asio::io_context> context)
+      : io_context{std::move(context)}, timer{*io_context} {}
+
+  std::shared_ptr<boost::asio::io_context> io_context;
+  std::atomic<std::uint64_t> messages{0};
+  // Held for a whole tick, so stop() can wait for running actions
+  std::mutex run_mutex;
+  // Guards everything below
+  std::mutex mutex;
+  bool running{false};
+  boost::asio::steady_timer timer;
+  std::chrono::steady_clock::time_point next_tick;
+  TimerWheel wheel{c_slots};
+  std::unordered_map<JobId, Job> jobs;
+  JobId next_job{1};
+};
+
+sbot::core::ChatScheduler::ChatScheduler(
+    std::shared_ptr<boost::asio::io_context> io_context)
+    : m_state{std::make_shared<State>(std::move(io_context))} {
+  LOG_CONTEXT("ChatScheduler");
+  LOG_INFO("Initializing");
+}
+
+sbot::core::ChatScheduler::~ChatScheduler() {
+  LOG_CONTEXT("ChatScheduler");
+  LOG_INFO("Shutting down");
+  stop();
+}
+
+auto sbot::core::ChatScheduler::start() -> void {
+  std::lock_guard lock{m_state->mutex};
+  if (m_state->running) {
+    return;
+  }
+  m_state->running   = true;
+  m_state->next_tick = std::chrono::steady_clock::now() + c_tick;
+  arm(m_state);
+}
+
+auto sbot::core::ChatScheduler::stop() -> void {
+  {
+    std::lock_guard lock{m_state->mutex};
+    if (!m_state->running) {
+      return;
+    }
+    m_state->running = false;
+    m_state->timer.cancel();
+  }
+  std::lock_guard wait_for_tick{m_state->run_mutex};
+}
+
+auto sbot::core::ChatScheduler::add(std::string group, ScheduleSpec spec,
+                                    Action action) -> JobId {
+  std::lock_guard lock{m_state->mutex};
+  JobId job_id = m_state->next_job++;
+  Job job{.group                = std::move(group),
+          .spec                 = std::move(spec),
+          .action               = std::move(action),
+          .messages_at_last_run = m_state->messages.load(
+              std::memory_order_relaxed)};
+  if (!reschedule(*m_state, job_id, job)) {
+    return 0;
+  }
+  m_state->jobs.emplace(job_id, std::move(job));
+  return job_id;
+}
+
+auto sbot::core::ChatScheduler::remove(JobId job) -> bool {
+  std::lock_guard lock{m_state->mutex};
+  m_state->wheel.cancel(job);
+  return m_state->jobs.erase(job) > 0;
+}
+
+auto sbot::core::ChatScheduler::removeGroup(std::string_view group)
+    -> std::size_t {
+  std::lock_guard lock{m_state->mutex};
+  return std::erase_if(m_state->jobs, [this, group](const auto &entry) {
+    if (entry.second.group != group) {
+      return false;
+    }
+    m_state->wheel.cancel(entry.first);
+    return true;
+  });
+}
+
+auto sbot::core::ChatScheduler::size() const -> std::size_t {
+  std::lock_guard lock{m_state->mutex};
+  return m_state->jobs.size();
+}
+
+auto sbot::core::ChatScheduler::noteChatMessage() -> void {
+  m_state->messages.fetch_add(1, std::memory_order_relaxed);
+}
+
+auto sbot::core::ChatScheduler::arm(const std::shared_ptr<State> &state)
+    -> void {
+  state->timer.expires_at(state->next_tick);
+  state->timer.async_wait([weak = std::weak_ptr<State>{state}](
+                              const boost::system::error_code &err) {
+    if (err) {
+      return;
+    }
+    if (auto locked = weak.lock()) {
+      tick(locked);
+    }
+  });
+}
+
+auto sbot::core::ChatScheduler::tick(const std::shared_ptr<State> &state)
+    -> void {
+  std::lock_guard run_lock{state->run_mutex};
+  std::vector<Action> due;
+  {
+    std::lock_guard lock{state->mutex};
+    if (!state->running) {
+      return;
+    }
+    auto messages = state->messages.load(std::memory_order_relaxed);
+    for (JobId job_id : state->wheel.advance()) {
+      auto job_it = state->jobs.find(job_id);
+      if (job_it == state->jobs.end()) {
+        continue;
+      }
+      Job &job = job_it->second;
+      if (messages - job.messages_at_last_run >= job.spec.min_messages) {
+        job.messages_at_last_run = messages;
+        due.push_back(job.action);
+      }
+      if (!reschedule(*state, job_id, job)) {
+        state->jobs.erase(job_it);
+      }
+    }
+    // From the planned time, so ticks do not drift; a late tick makes the
+    // next ones fire back to back until the wheel has caught up
+    state->next_tick += c_tick;
+    arm(state);
+  }
+  for (const auto &action : due) {
+    try {
+      action();
+    } catch (const std::exception &err) {
+      LOG_ERROR("Scheduled job failed: {}", err.what());
+    } catch (...) {
+      LOG_ERROR("Scheduled job failed with a non-standard exception");
+    }
+  }
+}
+
+auto sbot::core::ChatScheduler::reschedule(State &state, JobId job_id,
+                                           const Job &job) -> bool {
+  std::chrono::seconds wait{0};
+  if (job.spec.cron) {
+    auto now  = std::chrono::system_clock::now();
+    auto next = job.spec.cron->next(now);
+    if (!next) {
+      return false;
+    }
+    wait = std::chrono::ceil<std::chrono::seconds>(*next - now);
+  } else if (job.spec.interval > std::chrono::seconds::zero()) {
+    wait = job.spec.interval;
+  } else {
+    return false;
+  }
+  auto ticks = static_cast<std::uint64_t>(std::max<std::int64_t>(
+      (wait + c_tick - std::chrono::seconds{1}) / c_tick, 1));
+  state.wheel.schedule(job_id, ticks);
+  return true;
+}
@@ -0,0 +1,216 @@
+#include "seraphbot/core/command_executor.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <utility>
+
+#include "seraphbot/core/command_metrics.hpp"
+#include "seraphbot/core/logging.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+} // namespace
+
+sbot::core::CommandExecutor::CommandExecutor(std::size_t worker_count,
+                                             std::size_t max_queued,
+                                             std::size_t max_per_user)
+    : m_max_queued{max_queued}, m_max_per_user{max_per_user} {
+  LOG_CONTEXT("CommandExecutor");
+  LOG_INFO("Initializing with {} workers", worker_count);
+  worker_count = std::max<std::size_t>(1, worker_count);
+  m_workers.reserve(worker_count);
+  for (std::size_t i = 0; i < worker_count; ++i) {
+    m_workers.emplace_back(
+        [this](const std::stop_token &stop) { workerLoop(stop); });
+  }
+}
+
+sbot::core::CommandExecutor::~CommandExecutor() {
+  LOG_CONTEXT("CommandExecutor");
+  LOG_INFO("Shutting down");
+  stop();
+}
+
+auto sbot::core::CommandExecutor::submit(const std::string &user,
+                                         unsigned weight, Task task) -> bool {
+  {
+    std::lock_guard lock{m_mutex};
+    auto user_it = m_users.find(user);
+    std::size_t user_queued =
+        user_it != m_users.end() ? user_it->second.jobs.size() : 0;
+    if (m_stopped || m_queued >= m_max_queued ||
+        user_queued >= m_max_per_user) {
+      ++m_stats.rejected;
+      return false;
+    }
+
+    if (user_it == m_users.end()) {
+      user_it = m_users.emplace(user, UserQueue{}).first;
+      m_active.push_back(user);
+    }
+    UserQueue &queue = user_it->second;
+    queue.weight     = std::max(1U, weight);
+    queue.jobs.push_back({.task = std::move(task), .enqueued = Clock::now()});
+    ++m_queued;
+    ++m_stats.submitted;
+  }
+  m_cv.notify_one();
+  return true;
+}
+
+auto sbot::core::CommandExecutor::submitContinuation(Task task) -> bool {
+  {
+    std::lock_guard lock{m_mutex};
+    if (m_stopped) {
+      return false;
+    }
+    m_continuations.push_back({.task         = std::move(task),
+                               .enqueued     = Clock::now(),
+                               .continuation = true});
+  }
+  m_cv.notify_one();
+  return true;
+}
+
+auto sbot::core::CommandExecutor::stop() -> void {
+  {
+    std::lock_guard lock{m_mutex};
+    m_stopped = true;
+  }
+  for (auto &worker : m_workers) {
+    worker.request_stop();
+  }
+  m_cv.notify_all();
+  m_workers.clear(); // joins
+
+  std::lock_guard lock{m_mutex};
+  if (hasWork()) {
+    LOG_WARN("Dropping {} queued commands and {} continuations", m_queued,
+             m_continuations.size());
+  }
+  m_users.clear();
+  m_active.clear();
+  m_continuations.clear();
+  m_queued = 0;
+}
+
+auto sbot::core::CommandExecutor::setIdleTask(IdleTask task) -> void {
+  std::lock_guard lock{m_mutex};
+  m_idle_task = std::move(task);
+}
+
+auto sbot::core::CommandExecutor::setMetrics(CommandMetrics *metrics)
+    -> void {
+  std::lock_guard lock{m_mutex};
+  m_metrics = metrics;
+}
+
+auto sbot::core::CommandExecutor::stats() const -> Stats {
+  std::lock_guard lock{m_mutex};
+  Stats stats  = m_stats;
+  stats.queued = m_queued;
+  return stats;
+}
+
+auto sbot::core::CommandExecutor::workerLoop(const std::stop_token &stop)
+    -> void {
+  // Whether the idle task may have something to do
+  bool idle_work{false};
+  while (true) {
+    Job job;
+    IdleTask idle_task;
+    {
+      std::unique_lock lock{m_mutex};
+      if (idle_work && !hasWork() && m_idle_task && !stop.stop_requested()) {
+        idle_task = m_idle_task;
+      } else {
+        if (!m_cv.wait(lock, stop, [this] { return hasWork(); })) {
+          return;
+        }
+        job = popNext();
+      }
+    }
+
+    if (idle_task) {
+      try {
+        idle_work = idle_task();
+      } catch (const std::exception &err) {
+        LOG_ERROR("Idle task threw: {}", err.what());
+        idle_work = false;
+      } catch (...) {
+        LOG_ERROR("Idle task threw a non-standard exception");
+        idle_work = false;
+      }
+      continue;
+    }
+    idle_work = true;
+
+    auto started = Clock::now();
+    try {
+      job.task();
+    } catch (const std::exception &err) {
+      LOG_ERROR("Command task threw: {}", err.what());
+    } catch (...) {
+      LOG_ERROR("Command task threw a non-standard exception");
+    }
+    auto finished = Clock::now();
+
+    auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        started - job.enqueued);
+    auto run = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        finished - started);
+    CommandMetrics *metrics{nullptr};
+    {
+      std::lock_guard lock{m_mutex};
+      if (job.continuation) {
+        ++m_stats.continuations;
+        m_stats.continuation_run += run;
+        continue;
+      }
+      ++m_stats.completed;
+      m_stats.total_wait += wait;
+      m_stats.max_wait    = std::max(m_stats.max_wait, wait);
+      m_stats.total_run  += run;
+      m_stats.max_run     = std::max(m_stats.max_run, run);
+      metrics             = m_metrics;
+    }
+    if (metrics != nullptr) {
+      metrics->executor().wait.record(wait);
+      metrics->executor().run.record(run);
+    }
+  }
+}
+
+auto sbot::core::CommandExecutor::popNext() -> Job {
+  if (!m_continuations.empty()) {
+    Job job = std::move(m_continuations.front());
+    m_continuations.pop_front();
+    return job;
+  }
+  // Every user in m_active has at least one job
+  auto user_it     = m_users.find(m_active.front());
+  UserQueue &queue = user_it->second;
+  if (queue.credits == 0) {
+    queue.credits = queue.weight;
+  }
+
+  Job job = std::move(queue.jobs.front());
+  queue.jobs.pop_front();
+  --queue.credits;
+  --m_queued;
+
+  if (queue.jobs.empty()) {
+    // Idle users do not bank credits for later
+    m_users.erase(user_it);
+    m_active.pop_front();
+  } else if (queue.credits == 0) {
+    m_active.push_back(std::move(m_active.front()));
+    m_active.pop_front();
+  }
+  return job;
+}
@@ -0,0 +1,336 @@
+#include "seraphbot/core/command_metrics.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "seraphbot/core/logging.hpp"
+
+namespace {
+namespace sbc = sbot::core;
+
+constexpr std::array<double, 3> c_export_quantiles{0.5, 0.9, 0.99};
+
+auto escapeLabel(std::string_view value) -> std::string {
+  std::string out;
+  out.reserve(value.size());
+  for (char chr : value) {
+    if (chr == '\\' || chr == '"') {
+      out += '\\';
+      out += chr;
+    } else if (chr == '\n') {
+      out += "\\n";
+    } else {
+      out += chr;
+    }
+  }
+  return out;
+}
+
+auto toRow(std::string_view name, const sbc::CommandStats &stats)
+    -> sbc::CommandStatsRow {
+  return {.name              = std::string{name},
+          .invocations       = stats.invocations.load(),
+          .permission_denied = stats.permission_denied.load(),
+          .cooldown_rejected = stats.cooldown_rejected.load(),
+          .errors            = stats.errors.load(),
+          .shed              = stats.shed.load(),
+          .parse_p50         = stats.parse.quantile(0.5),
+          .execute_p50       = stats.execute.quantile(0.5),
+          .execute_p99       = stats.execute.quantile(0.99),
+          .execute_max       = stats.execute.max(),
+          .reply_p50         = stats.reply.quantile(0.5),
+          .reply_p99         = stats.reply.quantile(0.99)};
+}
+} // namespace
+
+auto sbc::LatencyHistogram::bucketFor(std::uint64_t micros) -> std::size_t {
+  if (micros < c_sub_buckets) {
+    return static_cast<std::size_t>(micros);
+  }
+  // Values in [16 << e, 32 << e) share magnitude e
+  auto magnitude = static_cast<std::size_t>(std::bit_width(micros)) - 5;
+  if (magnitude >= c_magnitudes) {
+    return c_bucket_count - 1;
+  }
+  auto sub = static_cast<std::size_t>(micros >> magnitude) - c_sub_buckets;
+  return c_sub_buckets + (magnitude * c_sub_buckets) + sub;
+}
+
+auto sbc::LatencyHistogram::bucketUpperBound(std::size_t index)
+    -> std::uint64_t {
+  if (index < c_sub_buckets) {
+    return index;
+  }
+  std::size_t magnitude = (index - c_sub_buckets) / c_sub_buckets;
+  std::uint64_t sub = c_sub_buckets + ((index - c_sub_buckets) % c_sub_buckets);
+  return ((sub + 1) << magnitude) - 1;
+}
+
+auto sbc::LatencyHistogram::record(std::chrono::nanoseconds latency) -> void {
+  auto micros = static_cast<std::uint64_t>(std::max<std::int64_t>(
+      0, std::chrono::duration_cast<std::chrono::microseconds>(latency)
+             .count()));
+  m_buckets[bucketFor(micros)].fetch_add(1, std::memory_order_relaxed);
+  m_count.fetch_add(1, std::memory_order_relaxed);
+  m_sum_us.fetch_add(micros, std::memory_order_relaxed);
+  std::uint64_t seen = m_max_us.load(std::memory_order_relaxed);
+  while (seen < micros && !m_max_us.compare_exchange_weak(
+                              seen, micros, std::memory_order_relaxed)) {
+  }
+}
+
+auto sbc::LatencyHistogram::mean() const -> std::chrono::microseconds {
+  std::uint64_t samples = count();
+  if (samples == 0) {
+    return std::chrono::microseconds{0};
+  }
+  return std::chrono::microseconds{
+      m_sum_us.load(std::memory_order_relaxed) / samples};
+}
+
+auto sbc::LatencyHistogram::quantile(double quantile) const
+    -> std::chrono::microseconds {
+  std::array<std::uint64_t, c_bucket_count> counts{};
+  std::uint64_t total{0};
+  for (std::size_t i = 0; i < c_bucket_count; ++i) {
+    counts[i]  = m_buckets[i].load(std::memory_order_relaxed);
+    total     += counts[i];
+  }
+  if (total == 0) {
+    return std::chrono::microseconds{0};
+  }
+
+  auto target = static_cast<std::uint64_t>(
+      std::ceil(std::clamp(quantile, 0.0, 1.0) * static_cast<double>(total)));
+  target = std::max<std::uint64_t>(1, target);
+  std::uint64_t seen{0};
+  for (std::size_t i = 0; i < c_bucket_count; ++i) {
+    seen += counts[i];
+    if (seen >= target) {
+      // The top bucket's edge can overshoot the largest real sample
+      return std::chrono::microseconds{
+          std::min(bucketUpperBound(i), m_max_us.load())};
+    }
+  }
+  return max();
+}
+
+sbc::CommandMetrics::CommandMetrics() {
+  LOG_CONTEXT("CommandMetrics");
+  LOG_INFO("Initializing");
+}
+
+sbc::CommandMetrics::~CommandMetrics() {
+  LOG_CONTEXT("CommandMetrics");
+  LOG_INFO("Shutting down");
+}
+
+auto sbc::CommandMetrics::forCommand(std::string_view name) -> CommandStats & {
+  {
+    std::shared_lock lock{m_mutex};
+    if (auto it = m_commands.find(name); it != m_commands.end()) {
+      return *it->second;
+    }
+  }
+  std::unique_lock lock{m_mutex};
+  auto [it, inserted] = m_commands.try_emplace(std::string{name}, nullptr);
+  if (inserted) {
+    it->second = std::make_unique<CommandStats>();
+  }
+  return *it->second;
+}
+
+auto sbc::CommandMetrics::find(std::string_view name) const -> CommandStats * {
+  std::shared_lock lock{m_mutex};
+  auto it = m_commands.find(name);
+  return it != m_commands.end() ? it->second.get() : nullptr;
+}
+
+auto sbc::CommandMetrics::rows() const -> std::vector<CommandStatsRow> {
+  std::vector<CommandStatsRow> result;
+  {
+    std::shared_lock lock{m_mutex};
+    result.reserve(m_commands.size());
+    for (const auto &[name, stats] : m_commands) {
+      result.push_back(toRow(name, *stats));
+    }
+  }
+  std::ranges::sort(result, [](const auto &lhs, const auto &rhs) {
+    return lhs.execute_p99 > rhs.execute_p99;
+  });
+  return result;
+}
+
+auto sbc::CommandMetrics::setHeapSource(
+    std::function<std::vector<HeapUsageRow>()> source) -> void {
+  std::lock_guard lock{m_heap_mutex};
+  m_heap_source = std::move(source);
+}
+
+auto sbc::CommandMetrics::heapRows() const -> std::vector<HeapUsageRow> {
+  std::vector<HeapUsageRow> result;
+  {
+    std::lock_guard lock{m_heap_mutex};
+    if (m_heap_source) {
+      result = m_heap_source();
+    }
+  }
+  std::ranges::sort(result, [](const auto &lhs, const auto &rhs) {
+    return lhs.live_bytes > rhs.live_bytes;
+  });
+  return result;
+}
+
+auto sbc::CommandMetrics::summary(std::string_view name) const -> std::string {
+  const CommandStats *stats = find(name);
+  if (stats == nullptr) {
+    return std::format("No stats for !{} yet", name);
+  }
+  CommandStatsRow row = toRow(name, *stats);
+  return std::format(
+      "!{}: {} runs, {} denied, {} on cooldown, {} errors, {} dropped | "
+      "run p50 {} p99 {} | reply p50 {} p99 {}",
+      row.name, row.invocations, row.permission_denied, row.cooldown_rejected,
+      row.errors, row.shed, row.execute_p50, row.execute_p99, row.reply_p50,
+      row.reply_p99);
+}
+
+auto sbc::CommandMetrics::writePrometheus(std::ostream &out) const -> void {
+  auto rows = this->rows();
+
+  auto counter = [&out, &rows](std::string_view metric, std::string_view help,
+                               auto field) {
+    out << std::format("# HELP {} {}\n# TYPE {} counter\n", metric, help,
+                       metric);
+    for (const auto &row : rows) {
+      out << std::format("{}{{command=\"{}\"}} {}\n", metric,
+                         escapeLabel(row.name), row.*field);
+    }
+  };
+  counter("sbot_command_invocations_total", "Commands run",
+          &CommandStatsRow::invocations);
+  counter("sbot_command_permission_denied_total",
+          "Invocations rejected for missing permissions",
+          &CommandStatsRow::permission_denied);
+  counter("sbot_command_cooldown_rejected_total",
+          "Invocations rejected by cooldowns or usage limits",
+          &CommandStatsRow::cooldown_rejected);
+  counter("sbot_command_errors_total", "Invocations that failed",
+          &CommandStatsRow::errors);
+  counter("sbot_command_shed_total", "Invocations dropped as stale",
+          &CommandStatsRow::shed);
+
+  constexpr std::string_view c_heap{"sbot_lua_heap_bytes"};
+  out << std::format(
+      "# HELP {} Live Lua heap bytes per command file\n# TYPE {} gauge\n",
+      c_heap, c_heap);
+  for (const auto &row : heapRows()) {
+    out << std::format("{}{{file=\"{}\"}} {}\n", c_heap,
+                       escapeLabel(row.file), row.live_bytes);
+  }
+
+  constexpr std::string_view c_gc{"sbot_lua_gc_step_microseconds"};
+  out << std::format("# HELP {} Lua collector slice duration\n"
+                     "# TYPE {} summary\n",
+                     c_gc, c_gc);
+  for (const auto &[kind, histogram] :
+       {std::pair{"idle", &m_gc.idle}, std::pair{"forced", &m_gc.forced}}) {
+    for (double quantile : c_export_quantiles) {
+      out << std::format("{}{{kind=\"{}\",quantile=\"{}\"}} {}\n", c_gc,
+                         kind, quantile,
+                         histogram->quantile(quantile).count());
+    }
+    out << std::format("{}_sum{{kind=\"{}\"}} {}\n", c_gc, kind,
+                       histogram->sum().count());
+    out << std::format("{}_count{{kind=\"{}\"}} {}\n", c_gc, kind,
+                       histogram->count());
+  }
+
+  constexpr std::string_view c_executor{"sbot_executor_microseconds"};
+  out << std::format("# HELP {} Command queueing and run time on the "
+                     "executor\n# TYPE {} summary\n",
+                     c_executor, c_executor);
+  for (const auto &[phase, histogram] :
+       {std::pair{"wait", &m_executor.wait},
+        std::pair{"run", &m_executor.run}}) {
+    for (double quantile : c_export_quantiles) {
+      out << std::format("{}{{phase=\"{}\",quantile=\"{}\"}} {}\n",
+                         c_executor, phase, quantile,
+                         histogram->quantile(quantile).count());
+    }
+    out << std::format("{}_sum{{phase=\"{}\"}} {}\n", c_executor, phase,
+                       histogram->sum().count());
+    out << std::format("{}_count{{phase=\"{}\"}} {}\n", c_executor, phase,
+                       histogram->count());
+  }
+
+  constexpr std::string_view c_latency{"sbot_command_latency_microseconds"};
+  out << std::format("# HELP {} Command latency by stage\n# TYPE {} summary\n",
+                     c_latency, c_latency);
+  std::shared_lock lock{m_mutex};
+  for (const auto &[name, stats] : m_commands) {
+    std::string label = escapeLabel(name);
+    for (const auto &[stage, histogram] :
+         {std::pair{"parse", &stats->parse},
+          std::pair{"execute", &stats->execute},
+          std::pair{"reply", &stats->reply}}) {
+      for (double quantile : c_export_quantiles) {
+        out << std::format("{}{{command=\"{}\",stage=\"{}\",quantile=\"{}\"}} "
+                           "{}\n",
+                           c_latency, label, stage, quantile,
+                           histogram->quantile(quantile).count());
+      }
+      out << std::format("{}_sum{{command=\"{}\",stage=\"{}\"}} {}\n",
+                         c_latency, label, stage, histogram->sum().count());
+      out << std::format("{}_count{{command=\"{}\",stage=\"{}\"}} {}\n",
+                         c_latency, label, stage, histogram->count());
+    }
+  }
+}
+
+auto sbc::CommandMetrics::exportToFile(const std::filesystem::path &path) const
+    -> bool {
+  std::error_code err;
+  if (path.has_parent_path()) {
+    std::filesystem::create_directories(path.parent_path(), err);
+  }
+  auto temp_path = path;
+  temp_path += ".tmp";
+  {
+    std::ofstream file{temp_path, std::ios::trunc};
+    if (!file) {
+      LOG_WARN("Could not open {} for metrics export", temp_path.string());
+      return false;
+    }
+    writePrometheus(file);
+    if (!file) {
+      LOG_WARN("Failed to write metrics to {}", temp_path.string());
+      return false;
+    }
+  }
+  std::filesystem::rename(temp_path, path, err);
+  if (err) {
+    LOG_WARN("Failed to publish metrics file {}: {}", path.string(),
+             err.message());
+    return false;
+  }
+  return true;
+}
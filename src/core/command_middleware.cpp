@@ -0,0 +1,216 @@
+#include "seraphbot/core/command_middleware.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "seraphbot/core/chat_message.hpp"
+#include "seraphbot/core/command_metrics.hpp"
+#include "seraphbot/core/command_parser.hpp"
+#include "seraphbot/core/logging.hpp"
+
+namespace {
+namespace sbc = sbot::core;
+
+auto secondsSince(std::chrono::steady_clock::time_point then,
+                  std::chrono::steady_clock::time_point now) -> long long {
+  return std::chrono::duration_cast<std::chrono::seconds>(now - then).count();
+}
+
+auto reject(const sbc::DispatchContext &dispatch, const std::string &reason)
+    -> bool {
+  if (!dispatch.quiet) {
+    dispatch.command.reply(reason);
+  }
+  return false;
+}
+} // namespace
+
+auto sbc::TracingStage::finish(const DispatchContext &dispatch) -> void {
+  const std::string &user = dispatch.command.message.user;
+  if (!dispatch.ran) {
+    LOG_DEBUG("Command '{}' from '{}' rejected by {}", dispatch.name, user,
+              dispatch.rejected_by);
+    return;
+  }
+  LOG_DEBUG("Command '{}' from '{}' {} in {}", dispatch.name, user,
+            dispatch.ok ? "ran" : "failed",
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                dispatch.elapsed));
+}
+
+auto sbc::MetricsStage::admit(DispatchContext &dispatch) -> bool {
+  if (dispatch.stats != nullptr) {
+    dispatch.stats->invocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+auto sbc::MetricsStage::finish(const DispatchContext &dispatch) -> void {
+  CommandStats *stats = dispatch.stats;
+  if (stats == nullptr) {
+    return;
+  }
+  if (dispatch.ran) {
+    stats->execute.record(dispatch.elapsed);
+    if (!dispatch.ok) {
+      stats->errors.fetch_add(1, std::memory_order_relaxed);
+    }
+  } else if (dispatch.rejected_by == PermissionStage::c_name) {
+    stats->permission_denied.fetch_add(1, std::memory_order_relaxed);
+  } else if (dispatch.rejected_by == RateLimitStage::c_name ||
+             dispatch.rejected_by == CooldownStage::c_name) {
+    stats->cooldown_rejected.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+auto sbc::PermissionStage::admit(DispatchContext &dispatch) -> bool {
+  const CommandPolicy &policy = dispatch.policy;
+  const ChatMessage &message  = dispatch.command.message;
+  if (!policy.enabled) {
+    return false;
+  }
+  if (std::ranges::contains(policy.allowed_users, message.user)) {
+    return true;
+  }
+
+  bool allowed{true};
+  if (policy.mod_only) {
+    allowed = message.hasAnyBadge(badge::c_moderator_rank);
+  } else if (policy.vip_only) {
+    allowed = message.hasAnyBadge(badge::c_vip_rank);
+  } else if (policy.subscriber_only) {
+    allowed = message.hasAnyBadge(badge::c_subscriber_rank);
+  }
+  return allowed ||
+         reject(dispatch, "You don't have permission to use this command.");
+}
+
+auto sbc::RateLimitStage::admit(DispatchContext &dispatch) -> bool {
+  const ChatMessage &message = dispatch.command.message;
+  if (message.hasAnyBadge(badge::c_moderator_rank)) {
+    return true;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  constexpr double c_per_second =
+      1.0 / std::chrono::duration<double>(c_refill_interval).count();
+  std::lock_guard lock{m_mutex};
+  if (m_buckets.size() >= c_prune_threshold) {
+    std::erase_if(m_buckets, [now](const auto &entry) {
+      return now - entry.second.updated >= c_refill_interval * c_burst;
+    });
+  }
+
+  auto [it, inserted] = m_buckets.try_emplace(message.user);
+  Bucket &bucket      = it->second;
+  if (!inserted) {
+    std::chrono::duration<double> idle = now - bucket.updated;
+    bucket.tokens =
+        std::min(c_burst, bucket.tokens + (idle.count() * c_per_second));
+  }
+  bucket.updated = now;
+  if (bucket.tokens < 1.0) {
+    return false;
+  }
+  bucket.tokens -= 1.0;
+  return true;
+}
+
+auto sbc::CooldownStage::admit(DispatchContext &dispatch) -> bool {
+  std::string command{dispatch.name};
+  const std::string &user     = dispatch.command.message.user;
+  const CommandPolicy &policy = dispatch.policy;
+  std::string refusal;
+  {
+    std::lock_guard lock{m_mutex};
+    auto use_count_it = m_command_use_count.find(command);
+    int current_uses  = use_count_it != m_command_use_count.end()
+                            ? use_count_it->second
+                            : 0;
+    if (isOnCooldown(command, user, policy)) {
+      refusal = "Command is on cooldown.";
+    } else if (policy.max_uses_per_stream > 0 &&
+               current_uses >= policy.max_uses_per_stream) {
+      refusal = "Command has reached its usage limit for this stream.";
+    } else {
+      auto now                     = std::chrono::steady_clock::now();
+      CooldownReservation &reserve = dispatch.cooldown;
+      reserve.held                 = true;
+      reserve.at                   = now;
+
+      reserve.global  = std::exchange(m_last_global_command, now);
+      reserve.command = std::exchange(m_last_command_use[command], now);
+      reserve.user    =
+          std::exchange(m_user_command_cooldowns[command][user], now);
+      ++m_command_use_count[command];
+      return true;
+    }
+  }
+  // Replying sends a message, so not while other workers wait on the lock
+  return reject(dispatch, refusal);
+}
+
+auto sbc::CooldownStage::finish(const DispatchContext &dispatch) -> void {
+  const CooldownReservation &reserve = dispatch.cooldown;
+  if (dispatch.ran || !reserve.held) {
+    return;
+  }
+  std::string command{dispatch.name};
+  // Timestamps a later invocation has reserved since are left alone
+  auto give_back = [&reserve](std::chrono::steady_clock::time_point &slot,
+                              std::chrono::steady_clock::time_point previous) {
+    if (slot == reserve.at) {
+      slot = previous;
+    }
+  };
+
+  std::lock_guard lock{m_mutex};
+  give_back(m_last_global_command, reserve.global);
+  give_back(m_last_command_use[command], reserve.command);
+  give_back(m_user_command_cooldowns[command][dispatch.command.message.user],
+            reserve.user);
+  if (auto use_count_it = m_command_use_count.find(command);
+      use_count_it != m_command_use_count.end() && use_count_it->second > 0) {
+    --use_count_it->second;
+  }
+}
+
+auto sbc::CooldownStage::resetStreamCounters() -> void {
+  std::lock_guard lock{m_mutex};
+  m_command_use_count.clear();
+}
+
+auto sbc::CooldownStage::isOnCooldown(const std::string &command,
+                                      const std::string &user,
+                                      const CommandPolicy &policy) const
+    -> bool {
+  auto now = std::chrono::steady_clock::now();
+
+  if (policy.global_cooldown > 0 &&
+      secondsSince(m_last_global_command, now) < policy.global_cooldown) {
+    return true;
+  }
+  if (policy.command_cooldown > 0) {
+    auto it = m_last_command_use.find(command);
+    if (it != m_last_command_use.end() &&
+        secondsSince(it->second, now) < policy.command_cooldown) {
+      return true;
+    }
+  }
+  if (policy.user_cooldown > 0) {
+    auto cmd_it = m_user_command_cooldowns.find(command);
+    if (cmd_it != m_user_command_cooldowns.end()) {
+      auto user_it = cmd_it->second.find(user);
+      if (user_it != cmd_it->second.end() &&
+          secondsSince(user_it->second, now) < policy.user_cooldown) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
@@ -1,13 +1,19 @@
 #include "seraphbot/core/command_parser.hpp"
 
 #include "seraphbot/core/chat_message.hpp"
+#include "seraphbot/core/command_metrics.hpp"
+#include "seraphbot/core/command_tokenizer.hpp"
 #include "seraphbot/core/logging.hpp"
 #include <algorithm>
-#include <cctype>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <exception>
-#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -22,7 +28,8 @@ sbot::core::CommandParser::~CommandParser() {
 }
 
 auto sbot::core::CommandParser::registerCommand(const std::string &name,
-                                                CommandHandler handler)
+                                                CommandHandler handler,
+                                                CommandOptions options)
     -> void {
   if (name.empty()) {
     LOG_WARN("Attempted to register command with empty name");
@@ -34,119 +41,217 @@ auto sbot::core::CommandParser::registerCommand(const std::string &name,
     return;
   }
 
-  std::string lower_name = name;
-  std::transform(lower_name.begin(), lower_name.end(), lower_name.begin(),
-                 ::tolower);
-
-  m_commands[lower_name] = std::move(handler);
+  auto command = std::make_shared<const RegisteredCommand>(RegisteredCommand{
+      .name = name, .handler = std::move(handler), .options = options});
+  {
+    std::unique_lock lock{m_commands_mutex};
+    m_commands.insert_or_assign(name, std::move(command));
+  }
   LOG_INFO("Registered command: '{}'", name);
 }
 
-auto sbot::core::CommandParser::isCommand(const std::string &text) const
+auto sbot::core::CommandParser::unregisterCommand(std::string_view name)
+    -> bool {
+  std::unique_lock lock{m_commands_mutex};
+  auto it = m_commands.find(name);
+  if (it == m_commands.end()) {
+    return false;
+  }
+  m_commands.erase(it);
+  LOG_INFO("Unregistered command: '{}'", name);
+  return true;
+}
+
+auto sbot::core::CommandParser::findCommand(std::string_view name) const
+    -> CommandPtr {
+  std::shared_lock lock{m_commands_mutex};
+  auto it = m_commands.find(name);
+  return it != m_commands.end() ? it->second : nullptr;
+}
+
+auto sbot::core::CommandParser::isCommand(std::string_view text) const
     -> bool {
   return !text.empty() && text.starts_with(m_prefix);
 }
 
-auto sbot::core::CommandParser::parseAndExecute(
-    const ChatMessage &message,
-    std::function<void(const std::string &)> reply_fn) -> bool {
+auto sbot::core::CommandParser::peekCommand(std::string_view text) const
+    -> std::string_view {
+  if (!isCommand(text)) {
+    return {};
+  }
+  text.remove_prefix(m_prefix.size());
+  return text.substr(0, text.find_first_of(" \t\n\v\f\r"));
+}
+
+auto sbot::core::CommandParser::parseAndExecute(const ChatMessage &message,
+                                                ReplyFn reply_fn) -> bool {
   if (!isCommand(message.text)) {
     return false;
   }
+  auto parse_start = std::chrono::steady_clock::now();
 
-  auto [command, args] = parseCommand(message.text);
+  // Per thread, so the token buffers are reused across messages and handlers
+  // on different I/O threads never share them
+  thread_local CommandTokenizer tokenizer;
 
-  if (command.empty()) {
+  std::string_view text{message.text};
+  auto tokens = tokenizer.tokenize(text.substr(m_prefix.size()));
+  if (tokens.empty()) {
     LOG_DEBUG("Empty command extracted from: '{}'", message.text);
     return false;
   }
 
-  std::string lower_command = command;
-  std::transform(lower_command.begin(), lower_command.end(),
-                 lower_command.begin(), ::tolower);
+  std::string_view command = tokens.front();
+  auto args                = tokens.subspan(1);
 
-  auto it = m_commands.find(lower_command);
-  if (it == m_commands.end()) {
+  CommandPtr registered = findCommand(command);
+  if (!registered) {
     LOG_DEBUG("Unknown command: '{}' from user: {}", command, message.user);
     return false;
   }
 
-  LOG_INFO("Executing command '{}' from user '{}' with {} args", command,
-           message.user, args.size());
+  CommandStats *stats = m_metrics != nullptr
+                            ? &m_metrics->forCommand(registered->name)
+                            : nullptr;
+  if (stats != nullptr) {
+    stats->parse.record(std::chrono::steady_clock::now() - parse_start);
+  }
 
-  try {
-    CommandContext ctx(message, command, std::move(args), std::move(reply_fn));
-    it->second(ctx);
-    return true;
-  } catch (const std::exception &err) {
-    LOG_ERROR("Error executing command '{}': {}", command, err.what());
+  if (isStale(message, registered->options)) {
+    m_shed_count.fetch_add(1, std::memory_order_relaxed);
+    if (stats != nullptr) {
+      stats->shed.fetch_add(1, std::memory_order_relaxed);
+    }
+    LOG_INFO("Dropping stale command '{}' from user '{}'", command,
+             message.user);
     return false;
   }
-}
 
-auto sbot::core::CommandParser::parseCommand(const std::string &text) const
-    -> std::pair<std::string, std::vector<std::string>> {
-  if (!isCommand(text)) {
-    return {"", {}};
-  }
+  LOG_INFO("Executing command '{}' from user '{}' with {} args", command,
+           message.user, args.size());
 
-  std::string without_prefix = text.substr(m_prefix.length());
+  CommandContext ctx(message, command, args, std::move(reply_fn));
+  return dispatch(*registered, ctx, stats, false);
+}
 
-  auto tokens = tokenize(without_prefix);
+auto sbot::core::CommandParser::dispatch(const RegisteredCommand &command,
+                                         const CommandContext &ctx,
+                                         CommandStats *stats, bool quiet)
+    -> bool {
+  DispatchContext state{ctx, command.name, command.options.policy, stats,
+                        quiet};
+  return m_middleware.dispatch(state, [&command, &ctx] {
+    try {
+      command.handler(ctx);
+      return true;
+    } catch (const std::exception &err) {
+      LOG_ERROR("Error executing command '{}': {}", ctx.command, err.what());
+      return false;
+    }
+  });
+}
 
-  if (tokens.empty()) {
-    return {"", {}};
+auto sbot::core::CommandParser::setTriggers(
+    const std::vector<std::pair<std::string, std::string>> &triggers)
+    -> void {
+  std::vector<std::string> keywords;
+  std::vector<std::string> commands;
+  keywords.reserve(triggers.size());
+  commands.reserve(triggers.size());
+  for (const auto &[keyword, command] : triggers) {
+    keywords.push_back(keyword);
+    commands.push_back(command);
   }
 
-  std::string command = tokens[0];
-  std::vector<std::string> args;
-
-  if (tokens.size() > 1) {
-    args.assign(tokens.begin() + 1, tokens.end());
+  auto next = std::make_shared<TriggerSet>(
+      TriggerSet{.automaton = KeywordAutomaton{keywords},
+                 .commands  = std::move(commands)});
+  {
+    std::lock_guard lock{m_triggers_mutex};
+    m_triggers = std::move(next);
   }
+  LOG_INFO("Compiled {} keyword triggers", triggers.size());
+}
 
-  return {std::move(command), std::move(args)};
+auto sbot::core::CommandParser::matchTriggers(std::string_view text) const
+    -> TriggerMatch {
+  TriggerMatch match;
+  {
+    std::lock_guard lock{m_triggers_mutex};
+    match.triggers = m_triggers;
+  }
+  if (match.triggers) {
+    match.triggers->automaton.findAll(text, match.keywords);
+  }
+  return match;
 }
 
-auto sbot::core::CommandParser::tokenize(const std::string &text) const
-    -> std::vector<std::string> {
-  std::vector<std::string> tokens;
-  std::string current_token;
-  bool in_quotes{false};
-  bool escape_next{false};
-
-  for (char c : text) {
-    if (escape_next) {
-      current_token += c;
-      escape_next = false;
-      continue;
-    }
+auto sbot::core::CommandParser::executeTriggers(
+    const ChatMessage &message, const TriggerMatch &match,
+    const ReplyFn &reply_fn) -> bool {
+  if (!match) {
+    return false;
+  }
 
-    if (c == '\\') {
-      escape_next = true;
+  CaseInsensitiveEqual same_command;
+  std::vector<std::string_view> ran;
+  bool any{false};
+  for (std::uint32_t index : match.keywords) {
+    const std::string &name = match.triggers->commands[index];
+    if (std::ranges::any_of(ran, [&](std::string_view done) {
+          return same_command(done, name);
+        })) {
       continue;
     }
+    ran.emplace_back(name);
 
-    if (c == '"') {
-      in_quotes = !in_quotes;
+    CommandPtr registered = findCommand(name);
+    if (!registered) {
+      LOG_DEBUG("Trigger for unknown command '{}'", name);
       continue;
     }
-
-    if (std::isspace(c) && !in_quotes) {
-      if (!current_token.empty()) {
-        tokens.push_back(std::move(current_token));
-        current_token.clear();
+    CommandStats *stats = m_metrics != nullptr
+                              ? &m_metrics->forCommand(registered->name)
+                              : nullptr;
+    if (isStale(message, registered->options)) {
+      m_shed_count.fetch_add(1, std::memory_order_relaxed);
+      if (stats != nullptr) {
+        stats->shed.fetch_add(1, std::memory_order_relaxed);
       }
-    } else {
-      current_token += c;
+      continue;
     }
+
+    std::string_view keyword = match.triggers->automaton.keyword(index);
+    LOG_INFO("Trigger '{}' runs command '{}' for user '{}'", keyword, name,
+             message.user);
+    CommandContext ctx(message, keyword, {}, reply_fn);
+    any = dispatch(*registered, ctx, stats, true) || any;
   }
+  return any;
+}
 
-  if (!current_token.empty()) {
-    tokens.push_back(std::move(current_token));
+auto sbot::core::CommandParser::isStale(const ChatMessage &message,
+                                        const CommandOptions &options) const
+    -> bool {
+  // Synthetic messages have no receive time and are never stale. Twitch's
+  // send time would not do: a local clock off by more than the budget would
+  // drop every command.
+  if (message.received == std::chrono::steady_clock::time_point{}) {
+    return false;
   }
+  auto budget = options.stale_after.count() > 0 ? options.stale_after
+                                                : m_default_stale_after;
+  return std::chrono::steady_clock::now() - message.received > budget;
+}
 
-  return tokens;
+auto sbot::core::CommandContext::reply(const std::string &text,
+                                       std::function<void(bool)> on_sent) const
+    -> void {
+  if (reply_fn) {
+    reply_fn(text, std::move(on_sent));
+  } else if (on_sent) {
+    on_sent(false);
+  }
 }
 
 auto sbot::core::CommandContext::joinArgs(std::size_t start_index) const
@@ -0,0 +1,124 @@
+#include "seraphbot/core/command_tokenizer.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <span>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+// Same set as std::isspace in the "C" locale
+constexpr auto isSpace(char chr) -> bool {
+  return chr == ' ' || (chr >= '\t' && chr <= '\r');
+}
+
+constexpr auto isSpecial(char chr, bool in_quotes) -> bool {
+  return chr == '"' || chr == '\\' || (!in_quotes && isSpace(chr));
+}
+} // namespace
+
+auto sbot::core::CommandTokenizer::tokenize(std::string_view text)
+    -> std::span<const std::string_view> {
+  m_tokens.clear();
+  m_scratch.clear();
+  // Unescaped output never outgrows the input, so reserving up front keeps
+  // earlier views into the scratch buffer valid while later tokens append
+  m_scratch.reserve(text.size());
+
+  std::size_t pos{0};
+  while (pos < text.size()) {
+    while (pos < text.size() && isSpace(text[pos])) {
+      ++pos;
+    }
+    if (pos == text.size()) {
+      break;
+    }
+    std::size_t start = pos;
+    pos               = findSpecial(text, pos, false);
+    if (pos == text.size() || isSpace(text[pos])) {
+      m_tokens.push_back(text.substr(start, pos - start));
+    } else {
+      pos = unescapeToken(text, start, pos);
+    }
+  }
+  return m_tokens;
+}
+
+auto sbot::core::CommandTokenizer::unescapeToken(std::string_view text,
+                                                 std::size_t start,
+                                                 std::size_t pos)
+    -> std::size_t {
+  std::size_t out_start = m_scratch.size();
+  m_scratch.append(text.substr(start, pos - start));
+
+  bool in_quotes{false};
+  while (pos < text.size()) {
+    char chr = text[pos];
+    if (chr == '\\') {
+      // A trailing backslash escapes nothing and is dropped
+      if (pos + 1 < text.size()) {
+        m_scratch.push_back(text[pos + 1]);
+      }
+      pos = std::min(pos + 2, text.size());
+    } else if (chr == '"') {
+      in_quotes = !in_quotes;
+      ++pos;
+    } else {
+      break; // whitespace outside quotes ends the token
+    }
+    std::size_t next = findSpecial(text, pos, in_quotes);
+    m_scratch.append(text.substr(pos, next - pos));
+    pos = next;
+  }
+
+  // `""` on its own produces nothing, like an empty unquoted token
+  if (std::size_t length = m_scratch.size() - out_start; length > 0) {
+    m_tokens.emplace_back(m_scratch.data() + out_start, length);
+  }
+  return pos;
+}
+
+auto sbot::core::CommandTokenizer::findSpecial(std::string_view text,
+                                               std::size_t pos, bool in_quotes)
+    -> std::size_t {
+  const char *data = text.data();
+  std::size_t size = text.size();
+
+#if defined(__SSE2__)
+  constexpr std::size_t c_lanes{16};
+  const __m128i quote     = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i space     = _mm_set1_epi8(' ');
+  const __m128i tab       = _mm_set1_epi8('\t');
+  const __m128i ctrl_span = _mm_set1_epi8('\r' - '\t');
+  for (; pos + c_lanes <= size; pos += c_lanes) {
+    __m128i chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+    __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                _mm_cmpeq_epi8(chunk, backslash));
+    if (!in_quotes) {
+      // '\t'..'\r' is (chr - '\t') <= 4 compared as unsigned bytes
+      __m128i shifted = _mm_sub_epi8(chunk, tab);
+      __m128i ctrl =
+          _mm_cmpeq_epi8(_mm_min_epu8(shifted, ctrl_span), shifted);
+      hits = _mm_or_si128(hits,
+                          _mm_or_si128(_mm_cmpeq_epi8(chunk, space), ctrl));
+    }
+    auto mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+    if (mask != 0) {
+      return pos + static_cast<std::size_t>(std::countr_zero(mask));
+    }
+  }
+#endif
+
+  for (; pos < size; ++pos) {
+    if (isSpecial(data[pos], in_quotes)) {
+      return pos;
+    }
+  }
+  return size;
+}
@@ -0,0 +1,169 @@
+#include "seraphbot/core/file_watcher.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <stop_token>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "seraphbot/core/logging.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+} // namespace
+
+sbot::core::FileWatcher::FileWatcher(std::filesystem::path directory,
+                                     std::string extension,
+                                     Callback on_change,
+                                     std::chrono::milliseconds debounce)
+    : m_directory{std::move(directory)}, m_extension{std::move(extension)},
+      m_on_change{std::move(on_change)}, m_debounce{debounce} {
+  LOG_CONTEXT("FileWatcher");
+  LOG_INFO("Initializing for {}", m_directory.string());
+  m_thread = std::jthread{[this](const std::stop_token &stop) {
+    if (!watchInotify(stop) && !stop.stop_requested()) {
+      LOG_INFO("Polling {} for changes", m_directory.string());
+      watchPolling(stop);
+    }
+  }};
+}
+
+sbot::core::FileWatcher::~FileWatcher() {
+  LOG_CONTEXT("FileWatcher");
+  LOG_INFO("Shutting down");
+}
+
+auto sbot::core::FileWatcher::matches(const std::filesystem::path &path) const
+    -> bool {
+  return m_extension.empty() || path.extension() == m_extension;
+}
+
+auto sbot::core::FileWatcher::note(const std::filesystem::path &path) -> void {
+  if (!matches(path)) {
+    return;
+  }
+  m_pending.insert(path);
+  // Trailing edge: every event pushes the deadline out again
+  m_deadline = Clock::now() + m_debounce;
+}
+
+auto sbot::core::FileWatcher::flushIfQuiet() -> void {
+  if (m_pending.empty() || Clock::now() < m_deadline) {
+    return;
+  }
+  std::vector<std::filesystem::path> changed{m_pending.begin(),
+                                             m_pending.end()};
+  m_pending.clear();
+  try {
+    m_on_change(std::move(changed));
+  } catch (const std::exception &err) {
+    LOG_ERROR("File change handler threw: {}", err.what());
+  }
+}
+
+#if defined(__linux__)
+auto sbot::core::FileWatcher::watchInotify(const std::stop_token &stop)
+    -> bool {
+  int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd < 0) {
+    LOG_WARN("inotify unavailable: {}",
+             std::error_code{errno, std::generic_category()}.message());
+    return false;
+  }
+  // Editors either write in place (CLOSE_WRITE) or write elsewhere and
+  // rename over the file (MOVED_TO)
+  constexpr std::uint32_t c_mask = IN_CLOSE_WRITE | IN_MOVED_TO |
+                                   IN_MOVED_FROM | IN_DELETE | IN_CREATE;
+  if (inotify_add_watch(inotify_fd, m_directory.c_str(), c_mask) < 0) {
+    LOG_WARN("Could not watch {}: {}", m_directory.string(),
+             std::error_code{errno, std::generic_category()}.message());
+    close(inotify_fd);
+    return false;
+  }
+
+  alignas(inotify_event) std::array<char, 4096> buffer{};
+  pollfd poll_fd{.fd = inotify_fd, .events = POLLIN, .revents = 0};
+  while (!stop.stop_requested()) {
+    // Wake periodically to notice stop requests and expire the debounce
+    if (poll(&poll_fd, 1, static_cast<int>(c_wake_interval.count())) > 0) {
+      ssize_t length = 0;
+      while ((length = read(inotify_fd, buffer.data(), buffer.size())) > 0) {
+        for (std::size_t offset = 0;
+             offset < static_cast<std::size_t>(length);) {
+          const auto *event =
+              reinterpret_cast<const inotify_event *>(buffer.data() + offset);
+          if (event->len > 0) {
+            note(m_directory / event->name);
+          }
+          if ((event->mask & IN_Q_OVERFLOW) != 0) {
+            LOG_WARN("inotify queue overflowed; some changes were missed");
+          }
+          offset += sizeof(inotify_event) + event->len;
+        }
+      }
+    }
+    flushIfQuiet();
+  }
+  close(inotify_fd);
+  return true;
+}
+#else
+auto sbot::core::FileWatcher::watchInotify(const std::stop_token & /*stop*/)
+    -> bool {
+  return false;
+}
+#endif
+
+auto sbot::core::FileWatcher::watchPolling(const std::stop_token &stop)
+    -> void {
+  auto known     = scanDirectory();
+  auto next_scan = Clock::now() + c_poll_interval;
+  while (!stop.stop_requested()) {
+    std::this_thread::sleep_for(c_wake_interval);
+    if (Clock::now() >= next_scan) {
+      auto current = scanDirectory();
+      for (const auto &[path, mtime] : current) {
+        auto it = known.find(path);
+        if (it == known.end() || it->second != mtime) {
+          note(path);
+        }
+      }
+      for (const auto &[path, mtime] : known) {
+        if (!current.contains(path)) {
+          note(path);
+        }
+      }
+      known     = std::move(current);
+      next_scan = Clock::now() + c_poll_interval;
+    }
+    flushIfQuiet();
+  }
+}
+
+auto sbot::core::FileWatcher::scanDirectory() const
+    -> std::unordered_map<std::string, std::filesystem::file_time_type> {
+  std::unordered_map<std::string, std::filesystem::file_time_type> files;
+  std::error_code err;
+  for (const auto &entry :
+       std::filesystem::directory_iterator{m_directory, err}) {
+    if (entry.is_regular_file(err) && matches(entry.path())) {
+      files.emplace(entry.path().string(), entry.last_write_time(err));
+    }
+  }
+  return files;
+}
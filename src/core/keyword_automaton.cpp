@@ -0,0 +1,149 @@
+#include "seraphbot/core/keyword_automaton.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "seraphbot/core/case_insensitive.hpp"
+
+namespace {
+constexpr std::uint32_t c_absent{std::numeric_limits<std::uint32_t>::max()};
+
+auto isWordChar(char chr) -> bool {
+  auto byte = static_cast<unsigned char>(chr);
+  // Non-ASCII bytes are treated as letters so UTF-8 words stay whole
+  return (byte >= '0' && byte <= '9') || (byte >= 'a' && byte <= 'z') ||
+         (byte >= 'A' && byte <= 'Z') || byte == '_' || byte >= 0x80;
+}
+} // namespace
+
+sbot::core::KeywordAutomaton::KeywordAutomaton(
+    const std::vector<std::string> &keywords) {
+  m_keywords.reserve(keywords.size());
+  for (const auto &text : keywords) {
+    if (text.empty()) {
+      continue;
+    }
+    m_keywords.push_back({.text       = text,
+                          .word_start = isWordChar(text.front()),
+                          .word_end   = isWordChar(text.back())});
+  }
+
+  // Compress the alphabet to the bytes that actually occur
+  for (const auto &keyword : m_keywords) {
+    for (char chr : keyword.text) {
+      auto lower = static_cast<unsigned char>(toLowerAscii(chr));
+      if (m_classes[lower] == 0) {
+        m_classes[lower] = static_cast<std::uint8_t>(m_class_count++);
+      }
+      m_classes[static_cast<unsigned char>(chr)] = m_classes[lower];
+      if (lower >= 'a' && lower <= 'z') {
+        m_classes[lower - 'a' + 'A'] = m_classes[lower];
+      }
+    }
+  }
+
+  // Trie
+  m_next.assign(m_class_count, c_absent);
+  m_node_keyword.assign(1, c_no_keyword);
+  for (std::size_t index = 0; index < m_keywords.size(); ++index) {
+    std::uint32_t node{0};
+    for (char chr : m_keywords[index].text) {
+      std::size_t slot =
+          node * m_class_count + m_classes[static_cast<unsigned char>(chr)];
+      if (m_next[slot] == c_absent) {
+        auto child   = static_cast<std::uint32_t>(m_node_keyword.size());
+        m_next[slot] = child;
+        m_next.resize(m_next.size() + m_class_count, c_absent);
+        m_node_keyword.push_back(c_no_keyword);
+      }
+      node = m_next[slot];
+    }
+    // Duplicate keywords keep the first index
+    if (m_node_keyword[node] == c_no_keyword) {
+      m_node_keyword[node] = static_cast<std::int32_t>(index);
+    }
+  }
+
+  // Breadth first: fill in failure transitions so the trie becomes a DFA
+  std::vector<std::uint32_t> fail(m_node_keyword.size(), 0);
+  m_output.assign(m_node_keyword.size(), 0);
+  std::deque<std::uint32_t> queue;
+  for (std::size_t cls = 0; cls < m_class_count; ++cls) {
+    if (m_next[cls] == c_absent) {
+      m_next[cls] = 0;
+    } else {
+      queue.push_back(m_next[cls]);
+    }
+  }
+  while (!queue.empty()) {
+    std::uint32_t node = queue.front();
+    queue.pop_front();
+    std::uint32_t node_fail = fail[node];
+    for (std::size_t cls = 0; cls < m_class_count; ++cls) {
+      std::uint32_t &next    = m_next[node * m_class_count + cls];
+      std::uint32_t fallback = m_next[node_fail * m_class_count + cls];
+      if (next == c_absent) {
+        next = fallback;
+        continue;
+      }
+      fail[next]     = fallback;
+      m_output[next] = m_node_keyword[fallback] != c_no_keyword
+                           ? fallback
+                           : m_output[fallback];
+      queue.push_back(next);
+    }
+  }
+}
+
+template <typename OnMatch>
+auto sbot::core::KeywordAutomaton::scan(std::string_view text,
+                                        OnMatch &&on_match) const -> void {
+  if (m_keywords.empty()) {
+    return;
+  }
+  std::uint32_t state{0};
+  for (std::size_t pos = 0; pos < text.size(); ++pos) {
+    state = m_next[state * m_class_count +
+                   m_classes[static_cast<unsigned char>(text[pos])]];
+    std::uint32_t node =
+        m_node_keyword[state] != c_no_keyword ? state : m_output[state];
+    for (; node != 0; node = m_output[node]) {
+      auto index             = static_cast<std::uint32_t>(m_node_keyword[node]);
+      const Keyword &keyword = m_keywords[index];
+      std::size_t start      = pos + 1 - keyword.text.size();
+      std::size_t end        = pos + 1;
+      if (keyword.word_start && start > 0 && isWordChar(text[start - 1])) {
+        continue;
+      }
+      if (keyword.word_end && end < text.size() && isWordChar(text[end])) {
+        continue;
+      }
+      if (!on_match(index)) {
+        return;
+      }
+    }
+  }
+}
+
+auto sbot::core::KeywordAutomaton::findAll(
+    std::string_view text, std::vector<std::uint32_t> &out) const -> void {
+  scan(text, [&out](std::uint32_t index) {
+    out.push_back(index);
+    return true;
+  });
+}
+
+auto sbot::core::KeywordAutomaton::containsAny(std::string_view text) const
+    -> bool {
+  bool found{false};
+  scan(text, [&found](std::uint32_t /*index*/) {
+    found = true;
+    return false;
+  });
+  return found;
+}
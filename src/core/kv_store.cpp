@@ -0,0 +1,525 @@
+#include "seraphbot/core/kv_store.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "seraphbot/core/logging.hpp"
+
+namespace {
+using Value = sbot::core::KvStore::Value;
+
+// Record: u32 payload size, u32 payload checksum, payload. Payload: u8 op,
+// u32 key size, key and, for a set, u8 value type and the value. Integers
+// are in host byte order; the log never leaves the machine.
+enum class Op : std::uint8_t { Set = 0, Remove = 1 };
+constexpr std::size_t c_record_header{2 * sizeof(std::uint32_t)};
+
+template <typename T> auto put(std::string &out, T value) -> void {
+  static_assert(std::is_trivially_copyable_v<T>);
+  std::array<char, sizeof(T)> bytes{};
+  std::memcpy(bytes.data(), &value, sizeof(T));
+  out.append(bytes.data(), bytes.size());
+}
+
+// Bounds-checked reads over a payload
+class Reader {
+public:
+  explicit Reader(std::string_view data) : m_data{data} {}
+
+  template <typename T> auto get(T &value) -> bool {
+    if (m_data.size() < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(&value, m_data.data(), sizeof(T));
+    m_data.remove_prefix(sizeof(T));
+    return true;
+  }
+  auto bytes(std::size_t count, std::string_view &out) -> bool {
+    if (m_data.size() < count) {
+      return false;
+    }
+    out = m_data.substr(0, count);
+    m_data.remove_prefix(count);
+    return true;
+  }
+  [[nodiscard]] auto done() const -> bool { return m_data.empty(); }
+
+private:
+  std::string_view m_data;
+};
+
+auto checksum(std::string_view data) -> std::uint32_t {
+  // FNV-1a; catches torn writes, not tampering
+  std::uint32_t hash{0x811c9dc5U};
+  for (char chr : data) {
+    hash ^= static_cast<unsigned char>(chr);
+    hash *= 0x01000193U;
+  }
+  return hash;
+}
+
+auto encodeRecord(std::string &out, std::string_view key, const Value *value)
+    -> void {
+  std::string payload;
+  put(payload, value != nullptr ? Op::Set : Op::Remove);
+  put(payload, static_cast<std::uint32_t>(key.size()));
+  payload.append(key);
+  if (value != nullptr) {
+    put(payload, static_cast<std::uint8_t>(value->index()));
+    std::visit(
+        [&payload](const auto &held) {
+          using T = std::decay_t<decltype(held)>;
+          if constexpr (std::is_same_v<T, std::string>) {
+            put(payload, static_cast<std::uint32_t>(held.size()));
+            payload.append(held);
+          } else if constexpr (std::is_same_v<T, bool>) {
+            put(payload, static_cast<std::uint8_t>(held ? 1 : 0));
+          } else {
+            put(payload, held);
+          }
+        },
+        *value);
+  }
+  put(out, static_cast<std::uint32_t>(payload.size()));
+  put(out, checksum(payload));
+  out.append(payload);
+}
+
+auto encodedSize(std::string_view key, const Value &value) -> std::uintmax_t {
+  std::size_t value_size = std::visit(
+      [](const auto &held) -> std::size_t {
+        using T = std::decay_t<decltype(held)>;
+        if constexpr (std::is_same_v<T, std::string>) {
+          return sizeof(std::uint32_t) + held.size();
+        } else if constexpr (std::is_same_v<T, bool>) {
+          return 1;
+        } else {
+          return sizeof(T);
+        }
+      },
+      value);
+  return c_record_header + 1 + sizeof(std::uint32_t) + key.size() + 1 +
+         value_size;
+}
+
+struct Decoded {
+  std::string_view key;
+  std::optional<Value> value;
+};
+
+auto decodePayload(std::string_view payload) -> std::optional<Decoded> {
+  Reader reader{payload};
+  std::uint8_t op{0};
+  std::uint32_t key_size{0};
+  Decoded decoded;
+  if (!reader.get(op) || !reader.get(key_size) ||
+      !reader.bytes(key_size, decoded.key)) {
+    return std::nullopt;
+  }
+  if (op == static_cast<std::uint8_t>(Op::Remove)) {
+    return reader.done() ? std::optional{decoded} : std::nullopt;
+  }
+  std::uint8_t type{0};
+  if (op != static_cast<std::uint8_t>(Op::Set) || !reader.get(type)) {
+    return std::nullopt;
+  }
+  switch (type) {
+  case 0: {
+    std::uint8_t flag{0};
+    if (!reader.get(flag)) {
+      return std::nullopt;
+    }
+    decoded.value = flag != 0;
+    break;
+  }
+  case 1: {
+    std::int64_t number{0};
+    if (!reader.get(number)) {
+      return std::nullopt;
+    }
+    decoded.value = number;
+    break;
+  }
+  case 2: {
+    double number{0};
+    if (!reader.get(number)) {
+      return std::nullopt;
+    }
+    decoded.value = number;
+    break;
+  }
+  case 3: {
+    std::uint32_t size{0};
+    std::string_view text;
+    if (!reader.get(size) || !reader.bytes(size, text)) {
+      return std::nullopt;
+    }
+    decoded.value = std::string{text};
+    break;
+  }
+  default:
+    return std::nullopt;
+  }
+  return reader.done() ? std::optional{std::move(decoded)} : std::nullopt;
+}
+
+auto syncFile(std::FILE *file) -> bool {
+  if (std::fflush(file) != 0) {
+    return false;
+  }
+#if defined(_WIN32)
+  return _commit(_fileno(file)) == 0;
+#else
+  return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Makes a rename in `directory` durable
+auto syncDirectory(const std::filesystem::path &directory) -> void {
+#if !defined(_WIN32)
+  int dir_fd = open(directory.empty() ? "." : directory.c_str(),
+                    O_RDONLY | O_DIRECTORY);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+#endif
+}
+} // namespace
+
+sbot::core::KvStore::KvStore(std::filesystem::path log_path)
+    : m_log_path{std::move(log_path)} {
+  LOG_CONTEXT("KvStore");
+  LOG_INFO("Initializing");
+  if (m_log_path.empty()) {
+    return;
+  }
+  std::error_code err;
+  std::filesystem::create_directories(m_log_path.parent_path(), err);
+  replay();
+  if (!openForAppend()) {
+    LOG_ERROR("Could not open {}; store changes will not be saved",
+              m_log_path.string());
+    return;
+  }
+  m_persistent = true;
+  m_writer =
+      std::jthread{[this](const std::stop_token &stop) { writeLoop(stop); }};
+}
+
+sbot::core::KvStore::~KvStore() {
+  LOG_CONTEXT("KvStore");
+  LOG_INFO("Shutting down");
+  if (m_writer.joinable()) {
+    // The writer commits whatever is queued before it exits
+    m_writer.request_stop();
+    m_writer.join();
+  }
+  if (m_file != nullptr) {
+    std::fclose(m_file);
+  }
+}
+
+auto sbot::core::KvStore::get(std::string_view key) const
+    -> std::optional<Value> {
+  std::shared_lock lock{m_mutex};
+  auto it = m_values.find(key);
+  if (it == m_values.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+auto sbot::core::KvStore::set(std::string_view key, Value value) -> void {
+  std::unique_lock lock{m_mutex};
+  append(key, apply(key, std::move(value)));
+}
+
+auto sbot::core::KvStore::remove(std::string_view key) -> bool {
+  std::unique_lock lock{m_mutex};
+  if (!m_values.contains(key)) {
+    return false;
+  }
+  append(key, apply(key, std::nullopt));
+  return true;
+}
+
+auto sbot::core::KvStore::increment(std::string_view key, std::int64_t delta)
+    -> std::int64_t {
+  std::unique_lock lock{m_mutex};
+  auto it           = m_values.find(key);
+  std::int64_t next = incrementedValue(
+      it != m_values.end() ? &it->second : nullptr, delta);
+  append(key, apply(key, next));
+  return next;
+}
+
+auto sbot::core::KvStore::range(std::string_view first, std::string_view last,
+                                std::size_t limit) const
+    -> std::vector<Entry> {
+  std::vector<Entry> entries;
+  std::shared_lock lock{m_mutex};
+  for (auto it = m_order.lower_bound(first);
+       it != m_order.end() && entries.size() < limit &&
+       (last.empty() || *it < last);
+       ++it) {
+    entries.emplace_back(std::string{*it}, m_values.find(*it)->second);
+  }
+  return entries;
+}
+
+auto sbot::core::KvStore::scan(std::string_view prefix,
+                               std::size_t limit) const -> std::vector<Entry> {
+  std::vector<Entry> entries;
+  std::shared_lock lock{m_mutex};
+  for (auto it = m_order.lower_bound(prefix);
+       it != m_order.end() && entries.size() < limit &&
+       it->starts_with(prefix);
+       ++it) {
+    entries.emplace_back(std::string{*it}, m_values.find(*it)->second);
+  }
+  return entries;
+}
+
+auto sbot::core::KvStore::size() const -> std::size_t {
+  std::shared_lock lock{m_mutex};
+  return m_values.size();
+}
+
+auto sbot::core::KvStore::flush() -> void {
+  if (!m_persistent) {
+    return;
+  }
+  std::unique_lock lock{m_log_mutex};
+  std::uint64_t target = m_queued_seq;
+  m_flush_requested    = true;
+  m_log_cv.notify_all();
+  m_log_cv.wait(lock, [this, target] { return m_synced_seq >= target; });
+}
+
+auto sbot::core::KvStore::apply(std::string_view key,
+                                std::optional<Value> value) -> const Value * {
+  auto it = m_values.find(key);
+  if (it != m_values.end()) {
+    m_live_bytes -= encodedSize(it->first, it->second);
+    if (!value) {
+      m_order.erase(it->first);
+      m_values.erase(it);
+      return nullptr;
+    }
+    it->second = std::move(*value);
+  } else {
+    if (!value) {
+      return nullptr;
+    }
+    it = m_values.emplace(std::string{key}, std::move(*value)).first;
+    m_order.insert(it->first);
+  }
+  m_live_bytes += encodedSize(it->first, it->second);
+  return &it->second;
+}
+
+auto sbot::core::KvStore::append(std::string_view key, const Value *value)
+    -> void {
+  if (!m_persistent) {
+    return;
+  }
+  bool commit_now{false};
+  {
+    std::lock_guard lock{m_log_mutex};
+    encodeRecord(m_queued, key, value);
+    ++m_queued_seq;
+    commit_now = m_queued.size() >= c_commit_bytes;
+  }
+  if (commit_now) {
+    m_log_cv.notify_all();
+  }
+}
+
+auto sbot::core::KvStore::replay() -> void {
+  std::ifstream file{m_log_path, std::ios::binary};
+  if (!file) {
+    return;
+  }
+  std::string contents{std::istreambuf_iterator<char>{file},
+                       std::istreambuf_iterator<char>{}};
+  file.close();
+
+  std::size_t offset{0};
+  std::size_t records{0};
+  std::unique_lock lock{m_mutex};
+  while (contents.size() - offset >= c_record_header) {
+    std::uint32_t size{0};
+    std::uint32_t sum{0};
+    std::memcpy(&size, contents.data() + offset, sizeof(size));
+    std::memcpy(&sum, contents.data() + offset + sizeof(size), sizeof(sum));
+    if (contents.size() - offset - c_record_header < size) {
+      break;
+    }
+    std::string_view payload{contents.data() + offset + c_record_header,
+                             size};
+    if (checksum(payload) != sum) {
+      break;
+    }
+    auto decoded = decodePayload(payload);
+    if (!decoded) {
+      break;
+    }
+    apply(decoded->key, std::move(decoded->value));
+    offset += c_record_header + size;
+    ++records;
+  }
+  m_log_bytes = offset;
+
+  if (offset < contents.size()) {
+    // Everything after a torn write is unreachable anyway
+    LOG_WARN("Discarding {} bytes after the last intact record in {}",
+             contents.size() - offset, m_log_path.string());
+    std::error_code err;
+    std::filesystem::resize_file(m_log_path, offset, err);
+    if (err) {
+      LOG_ERROR("Could not truncate {}: {}", m_log_path.string(),
+                err.message());
+    }
+  }
+  LOG_INFO("Loaded {} keys from {} records", m_values.size(), records);
+}
+
+auto sbot::core::KvStore::openForAppend() -> bool {
+  m_file = std::fopen(m_log_path.string().c_str(), "ab");
+  return m_file != nullptr;
+}
+
+auto sbot::core::KvStore::writeLoop(const std::stop_token &stop) -> void {
+  bool stopping{false};
+  while (!stopping) {
+    std::string batch;
+    std::uint64_t seq{0};
+    {
+      std::unique_lock lock{m_log_mutex};
+      // Writes arriving within one interval share a single fsync
+      m_log_cv.wait_for(lock, stop, c_commit_interval, [this] {
+        return m_flush_requested || m_queued.size() >= c_commit_bytes;
+      });
+      stopping          = stop.stop_requested();
+      batch             = std::exchange(m_queued, {});
+      seq               = m_queued_seq;
+      m_flush_requested = false;
+    }
+    if (!batch.empty() && !commit(batch)) {
+      LOG_ERROR("Failed to write {} bytes to {}", batch.size(),
+                m_log_path.string());
+    }
+    {
+      std::lock_guard lock{m_log_mutex};
+      m_synced_seq = seq;
+    }
+    m_log_cv.notify_all();
+    if (!stopping) {
+      compactIfWorthwhile();
+    }
+  }
+}
+
+auto sbot::core::KvStore::reopenLog() -> bool {
+  std::error_code err;
+  std::filesystem::resize_file(m_log_path, m_log_bytes, err);
+  if (err) {
+    LOG_ERROR("Could not truncate {}: {}", m_log_path.string(),
+              err.message());
+    return false;
+  }
+  return openForAppend();
+}
+
+auto sbot::core::KvStore::commit(const std::string &batch) -> bool {
+  if (m_file == nullptr && !reopenLog()) {
+    return false;
+  }
+  if (std::fwrite(batch.data(), 1, batch.size(), m_file) == batch.size() &&
+      syncFile(m_file)) {
+    m_log_bytes += batch.size();
+    return true;
+  }
+  // Replay stops at a torn record, which would hide every later batch, so
+  // the log is cut back before anything else is appended
+  std::fclose(m_file);
+  m_file = nullptr;
+  reopenLog();
+  return false;
+}
+
+auto sbot::core::KvStore::compactIfWorthwhile() -> void {
+  std::string snapshot;
+  {
+    std::shared_lock lock{m_mutex};
+    if (m_log_bytes < c_compact_min_bytes ||
+        m_log_bytes < c_compact_ratio * m_live_bytes) {
+      return;
+    }
+    snapshot.reserve(m_live_bytes);
+    for (std::string_view key : m_order) {
+      encodeRecord(snapshot, key, &m_values.find(key)->second);
+    }
+  }
+  // Records queued meanwhile are already reflected in the snapshot;
+  // replaying them after it again is harmless, so they stay queued
+
+  auto temp_path = m_log_path;
+  temp_path += ".compact";
+  std::FILE *temp = std::fopen(temp_path.string().c_str(), "wb");
+  if (temp == nullptr) {
+    LOG_WARN("Could not create {}; not compacting", temp_path.string());
+    return;
+  }
+  bool written =
+      std::fwrite(snapshot.data(), 1, snapshot.size(), temp) ==
+          snapshot.size() &&
+      syncFile(temp);
+  std::fclose(temp);
+  std::error_code err;
+  if (written) {
+    std::filesystem::rename(temp_path, m_log_path, err);
+  }
+  if (!written || err) {
+    LOG_WARN("Compacting {} failed; keeping the old log", m_log_path.string());
+    std::filesystem::remove(temp_path, err);
+    return;
+  }
+  syncDirectory(m_log_path.parent_path());
+
+  LOG_INFO("Compacted {} from {} to {} bytes", m_log_path.string(),
+           m_log_bytes, snapshot.size());
+  if (m_file != nullptr) {
+    std::fclose(m_file);
+  }
+  m_log_bytes = snapshot.size();
+  if (!openForAppend()) {
+    LOG_ERROR("Could not reopen {} after compacting", m_log_path.string());
+  }
+}
@@ -0,0 +1,208 @@
+#include "seraphbot/core/lua_allocator.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+
+#include "seraphbot/core/logging.hpp"
+
+sbot::core::LuaAllocator::LuaAllocator(std::size_t limit) : m_limit{limit} {
+  // The runtime is charged from the first allocation on
+  m_owner_bytes[0].store(new OwnerChunk{}, std::memory_order_release);
+}
+
+sbot::core::LuaAllocator::~LuaAllocator() {
+  for (auto &chunk : m_owner_bytes) {
+    delete chunk.load(std::memory_order_relaxed);
+  }
+}
+
+auto sbot::core::LuaAllocator::allocate(void *user_data, void *ptr,
+                                        std::size_t old_size,
+                                        std::size_t new_size) -> void * {
+  auto &self = *static_cast<LuaAllocator *>(user_data);
+  // For a new block Lua passes the object type in old_size
+  std::size_t current = ptr != nullptr ? old_size : 0;
+
+  if (new_size == 0) {
+    if (ptr != nullptr) {
+      self.freeBlock(ptr, current);
+    }
+    return nullptr;
+  }
+  if (new_size > current &&
+      self.liveBytes() + (new_size - current) > self.m_limit) {
+    self.m_failed.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  if (ptr == nullptr) {
+    return self.allocateBlock(new_size, self.m_owner);
+  }
+
+  auto delta = static_cast<std::int64_t>(new_size) -
+               static_cast<std::int64_t>(current);
+  auto *header          = static_cast<Header *>(ptr) - 1;
+  std::uint32_t owner   = header->owner;
+  std::size_t old_class = header->size_class;
+  std::size_t new_class = sizeClass(new_size);
+  if (old_class == new_class && old_class < c_class_count) {
+    // Still fits the same block
+    self.charge(owner, delta);
+    return ptr;
+  }
+  if (old_class == c_class_count && new_class == c_class_count) {
+    void *moved = std::realloc(header, sizeof(Header) + new_size);
+    if (moved == nullptr) {
+      return self.shrinkInPlace(ptr, owner, delta);
+    }
+    self.charge(owner, delta);
+    return static_cast<Header *>(moved) + 1;
+  }
+
+  // The block stays with whoever allocated it, not whoever grew it
+  void *moved = self.allocateBlock(new_size, owner);
+  if (moved == nullptr) {
+    return self.shrinkInPlace(ptr, owner, delta);
+  }
+  std::memcpy(moved, ptr, std::min(current, new_size));
+  self.freeBlock(ptr, current);
+  return moved;
+}
+
+auto sbot::core::LuaAllocator::setOwner(std::uint32_t owner) -> void {
+  if (owner >= c_max_owners) {
+    if (!m_owners_exhausted) {
+      LOG_WARN("Lua allocator tracks at most {} owners, charging owner {} "
+               "and later ones to the runtime",
+               c_max_owners, owner);
+      m_owners_exhausted = true;
+    }
+    m_owner = 0;
+    return;
+  }
+  auto &chunk = m_owner_bytes[owner / c_owner_chunk];
+  if (chunk.load(std::memory_order_relaxed) == nullptr) {
+    auto *fresh = new (std::nothrow) OwnerChunk{};
+    if (fresh == nullptr) {
+      m_owner = 0;
+      return;
+    }
+    chunk.store(fresh, std::memory_order_release);
+  }
+  m_owner = owner;
+}
+
+auto sbot::core::LuaAllocator::ownerBytes(std::uint32_t owner) const
+    -> std::size_t {
+  if (owner >= c_max_owners) {
+    return 0;
+  }
+  const OwnerChunk *chunk =
+      m_owner_bytes[owner / c_owner_chunk].load(std::memory_order_acquire);
+  if (chunk == nullptr) {
+    return 0;
+  }
+  return static_cast<std::size_t>(std::max<std::int64_t>(
+      0, (*chunk)[owner % c_owner_chunk].load(std::memory_order_relaxed)));
+}
+
+auto sbot::core::LuaAllocator::shrinkInPlace(void *ptr, std::uint32_t owner,
+                                             std::int64_t delta) -> void * {
+  if (delta > 0) {
+    return nullptr;
+  }
+  // Lua assumes a shrink never fails, so keep the bigger block; its header
+  // still names its real class for when it is freed
+  charge(owner, delta);
+  return ptr;
+}
+
+auto sbot::core::LuaAllocator::sizeClass(std::size_t size) -> std::size_t {
+  std::size_t total = sizeof(Header) + size;
+  if (total > c_max_small) {
+    return c_class_count;
+  }
+  return (total - 1) / c_granule;
+}
+
+auto sbot::core::LuaAllocator::allocateBlock(std::size_t size,
+                                             std::uint32_t owner) -> void * {
+  std::size_t size_class = sizeClass(size);
+  Header *header{nullptr};
+  if (size_class == c_class_count) {
+    header = static_cast<Header *>(std::malloc(sizeof(Header) + size));
+    if (header == nullptr) {
+      return nullptr;
+    }
+  } else {
+    if (m_free[size_class] == nullptr && !refill(size_class)) {
+      return nullptr;
+    }
+    FreeBlock *block   = m_free[size_class];
+    m_free[size_class] = block->next;
+    header             = reinterpret_cast<Header *>(block);
+  }
+  header->owner      = owner;
+  header->size_class = static_cast<std::uint32_t>(size_class);
+  charge(owner, static_cast<std::int64_t>(size));
+  return header + 1;
+}
+
+auto sbot::core::LuaAllocator::freeBlock(void *ptr, std::size_t size)
+    -> void {
+  auto *header = static_cast<Header *>(ptr) - 1;
+  charge(header->owner, -static_cast<std::int64_t>(size));
+  std::size_t size_class = header->size_class;
+  if (size_class == c_class_count) {
+    std::free(header);
+    return;
+  }
+  auto *block        = reinterpret_cast<FreeBlock *>(header);
+  block->next        = m_free[size_class];
+  m_free[size_class] = block;
+}
+
+auto sbot::core::LuaAllocator::refill(std::size_t size_class) -> bool {
+  std::size_t block_size = (size_class + 1) * c_granule;
+  std::unique_ptr<std::byte[]> slab{new (std::nothrow)
+                                        std::byte[c_slab_size]};
+  if (!slab) {
+    return false;
+  }
+  // Kept before the blocks are linked, so a failure leaves no dangling ones
+  try {
+    m_slabs.push_back(std::move(slab));
+  } catch (const std::bad_alloc &) {
+    return false;
+  }
+  std::byte *base = m_slabs.back().get();
+  // Push back to front so blocks are handed out in address order
+  for (std::size_t i = c_slab_size / block_size; i > 0; --i) {
+    std::byte *start   = base + ((i - 1) * block_size);
+    auto *block        = reinterpret_cast<FreeBlock *>(start);
+    block->next        = m_free[size_class];
+    m_free[size_class] = block;
+  }
+  return true;
+}
+
+auto sbot::core::LuaAllocator::charge(std::uint32_t owner, std::int64_t delta)
+    -> void {
+  auto live = static_cast<std::size_t>(
+      static_cast<std::int64_t>(m_live.load(std::memory_order_relaxed)) +
+      delta);
+  m_live.store(live, std::memory_order_relaxed);
+  if (live > m_peak.load(std::memory_order_relaxed)) {
+    m_peak.store(live, std::memory_order_relaxed);
+  }
+  // setOwner() created the chunk before anything was charged to `owner`
+  auto &bytes = (*m_owner_bytes[owner / c_owner_chunk].load(
+      std::memory_order_relaxed))[owner % c_owner_chunk];
+  bytes.store(bytes.load(std::memory_order_relaxed) + delta,
+              std::memory_order_relaxed);
+}
@@ -0,0 +1,81 @@
+#include "seraphbot/core/lua_budget.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <lua.hpp>
+#include <string_view>
+
+#include "seraphbot/core/lua_profiler.hpp"
+
+namespace {
+// The hook has no user data pointer; the scope running on this thread is
+// the one being charged
+thread_local sbot::core::BudgetScope *t_active_scope{nullptr};
+} // namespace
+
+sbot::core::BudgetScope::BudgetScope(lua_State *lua,
+                                     const ExecutionBudget &budget,
+                                     LuaProfiler *profiler,
+                                     std::string_view command)
+    : m_lua{lua}, m_limit{budget.instructions},
+      m_started{std::chrono::steady_clock::now()},
+      m_deadline{m_started + budget.time}, m_profiler{profiler},
+      m_command{command}, m_last_sample{m_started},
+      m_previous{t_active_scope} {
+  t_active_scope = this;
+  lua_sethook(m_lua, &BudgetScope::onHook, LUA_MASKCOUNT, c_hook_interval);
+}
+
+sbot::core::BudgetScope::~BudgetScope() {
+  if (m_profiler != nullptr && m_profiler->enabled()) {
+    m_profiler->sample(m_lua, m_command,
+                       std::chrono::steady_clock::now() - m_last_sample);
+  }
+  t_active_scope = m_previous;
+  if (m_previous != nullptr && m_previous->m_lua == m_lua) {
+    lua_sethook(m_lua, &BudgetScope::onHook, LUA_MASKCOUNT, c_hook_interval);
+  } else {
+    lua_sethook(m_lua, nullptr, 0, 0);
+  }
+}
+
+auto sbot::core::BudgetScope::remaining(const ExecutionBudget &budget) const
+    -> ExecutionBudget {
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - m_started);
+  std::uint64_t used = std::min(m_used, budget.instructions);
+  return {.instructions = budget.instructions - used,
+          .time         = std::max(budget.time - elapsed,
+                                   std::chrono::milliseconds{0})};
+}
+
+auto sbot::core::BudgetScope::onHook(lua_State *lua, lua_Debug * /*debug*/)
+    -> void {
+  BudgetScope *scope = t_active_scope;
+  if (scope == nullptr) {
+    return;
+  }
+  if (scope->m_overrun == BudgetOverrun::None) {
+    auto now = std::chrono::steady_clock::now();
+    if (scope->m_profiler != nullptr && scope->m_profiler->enabled() &&
+        now - scope->m_last_sample >= LuaProfiler::c_sample_interval) {
+      scope->m_profiler->sample(lua, scope->m_command,
+                                now - scope->m_last_sample);
+      scope->m_last_sample = now;
+    }
+    scope->m_used += c_hook_interval;
+    if (scope->m_used > scope->m_limit) {
+      scope->m_overrun = BudgetOverrun::Instructions;
+    } else if (now >= scope->m_deadline) {
+      scope->m_overrun = BudgetOverrun::Time;
+    } else {
+      return;
+    }
+    lua_sethook(lua, &BudgetScope::onHook, LUA_MASKCOUNT, 1);
+  }
+  // Nothing with a destructor is alive here; luaL_error does not return
+  luaL_error(lua, scope->m_overrun == BudgetOverrun::Instructions
+                      ? "instruction budget exceeded"
+                      : "time budget exceeded");
+}
@@ -1,75 +1,278 @@
 #include "seraphbot/core/lua_command_engine.hpp"
 #include "seraphbot/core/audio_system.hpp"
+#include "seraphbot/core/chat_message.hpp"
+#include "seraphbot/core/chat_scheduler.hpp"
 #include "seraphbot/core/command_parser.hpp"
 #include "seraphbot/core/logging.hpp"
+#include "seraphbot/core/lua_async.hpp"
+#include "seraphbot/core/lua_budget.hpp"
+#include "seraphbot/core/lua_compat.hpp"
+#include "seraphbot/core/lua_sandbox.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/system/error_code.hpp>
+#include <charconv>
 #include <chrono>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <exception>
 #include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <sol/error.hpp>
 #include <sol/forward.hpp>
 #include <sol/types.hpp>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
 #include <utility>
+#include <variant>
 #include <vector>
 
-auto sbot::core::CooldownTracker::isOnCooldown(
-    const std::string &command, const std::string &user,
-    const CommandMetadata &meta) const -> bool {
-  auto now = std::chrono::steady_clock::now();
+namespace {
+// "SBOTLUAC", then the source mtime and hash the bytecode was compiled from
+constexpr std::uint64_t c_bytecode_magic{0x4341554C'544F4253};
+// Shortest `every` a timer may use, so a typo cannot flood chat
+constexpr std::chrono::seconds c_min_timer_interval{60};
 
-  if (meta.global_cooldown > 0) {
-    auto time_since_last = std::chrono::duration_cast<std::chrono::seconds>(
-                               now - last_global_command)
-                               .count();
-    if (time_since_last < meta.global_cooldown) {
+auto readFile(const std::filesystem::path &path) -> std::optional<std::string> {
+  std::ifstream file{path, std::ios::binary};
+  if (!file) {
+    return std::nullopt;
+  }
+  return std::string{std::istreambuf_iterator<char>{file},
+                     std::istreambuf_iterator<char>{}};
+}
+
+auto toSharedValue(const sol::object &value)
+    -> std::optional<sbot::core::SharedStore::Value> {
+  switch (value.get_type()) {
+  case sol::type::boolean:
+    return value.as<bool>();
+  case sol::type::number: {
+    // Keep whole numbers integers so they print as "3", not "3.0"
+    constexpr double c_exact_limit{9007199254740992.0}; // 2^53
+    auto number = value.as<double>();
+    if (std::trunc(number) == number && std::fabs(number) < c_exact_limit) {
+      return static_cast<std::int64_t>(number);
+    }
+    return number;
+  }
+  case sol::type::string:
+    return value.as<std::string>();
+  default:
+    return std::nullopt;
+  }
+}
+
+auto toLuaObject(const std::optional<sbot::core::StoreValue> &value,
+                 sol::this_state lua_state) -> sol::object {
+  if (!value) {
+    return sol::make_object(lua_state, sol::lua_nil);
+  }
+  return std::visit(
+      [lua_state](const auto &stored) {
+        return sol::make_object(lua_state, stored);
+      },
+      *value);
+}
+
+// `shared` and `store` offer the same calls; only where the values live
+// differs. Store is SharedStore or KvStore and must outlive the state.
+template <typename Store>
+auto bindStoreTable(sol::table table, Store &store, std::string_view name)
+    -> void {
+  table["get"] = [&store](const std::string &key,
+                          sol::this_state lua_state) -> sol::object {
+    return toLuaObject(store.get(key), lua_state);
+  };
+  table["set"] = [&store, name](const std::string &key,
+                                const sol::object &value) {
+    if (auto converted = toSharedValue(value)) {
+      store.set(key, std::move(*converted));
+      return true;
+    }
+    if (value.get_type() == sol::type::lua_nil) {
+      store.remove(key);
       return true;
     }
+    LOG_WARN("{}.set('{}'): only booleans, numbers and strings can be "
+             "stored",
+             name, key);
+    return false;
+  };
+  table["increment"] = [&store](const std::string &key,
+                                sol::optional<std::int64_t> delta) {
+    return store.increment(key, delta.value_or(1));
+  };
+  table["remove"] = [&store](const std::string &key) {
+    return store.remove(key);
+  };
+}
+
+auto toMillis(std::chrono::nanoseconds duration) -> double {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+auto hashSource(std::string_view source) -> std::uint64_t {
+  // FNV-1a; only has to notice edits, not resist collisions
+  std::uint64_t hash{0xcbf29ce484222325ULL};
+  for (char chr : source) {
+    hash ^= static_cast<unsigned char>(chr);
+    hash *= 0x100000001b3ULL;
   }
-  if (meta.command_cooldown > 0) {
-    auto it = last_command_use.find(command);
-    if (it != last_command_use.end()) {
-      auto time_since_last =
-          std::chrono::duration_cast<std::chrono::seconds>(now - it->second)
-              .count();
-      if (time_since_last < meta.command_cooldown) {
-        return true;
-      }
+  return hash;
+}
+
+// "<stem>-<hash of the absolute path>.luac", so files with the same name in
+// different directories do not share an entry
+auto cacheFileName(const std::filesystem::path &source)
+    -> std::filesystem::path {
+  std::error_code err;
+  auto absolute = std::filesystem::absolute(source, err);
+  std::array<char, 16> digits{};
+  auto written = std::to_chars(digits.data(), digits.data() + digits.size(),
+                               hashSource((err ? source : absolute).string()),
+                               16);
+  return source.stem().string() + "-" +
+         std::string{digits.data(), written.ptr} + ".luac";
+}
+
+auto readCachedBytecode(const std::filesystem::path &path,
+                        std::filesystem::file_time_type mtime,
+                        std::uint64_t hash) -> std::optional<std::string> {
+  auto contents = readFile(path);
+  std::array<std::uint64_t, 3> header{};
+  if (!contents || contents->size() <= sizeof(header)) {
+    return std::nullopt;
+  }
+  std::memcpy(header.data(), contents->data(), sizeof(header));
+  auto ticks = static_cast<std::uint64_t>(mtime.time_since_epoch().count());
+  if (header[0] != c_bytecode_magic || header[1] != ticks ||
+      header[2] != hash) {
+    return std::nullopt;
+  }
+  contents->erase(0, sizeof(header));
+  return contents;
+}
+
+auto writeCachedBytecode(const std::filesystem::path &path,
+                         std::filesystem::file_time_type mtime,
+                         std::uint64_t hash, const sol::bytecode &bytecode)
+    -> void {
+  std::error_code err;
+  std::filesystem::create_directories(path.parent_path(), err);
+  std::array<std::uint64_t, 3> header{
+      c_bytecode_magic,
+      static_cast<std::uint64_t>(mtime.time_since_epoch().count()), hash};
+  auto body = bytecode.as_string_view();
+  // Per thread, since the same file may be prepared twice at once; the
+  // rename replaces the entry in one step either way
+  auto temp_path = path;
+  temp_path += "." +
+               std::to_string(std::hash<std::thread::id>{}(
+                   std::this_thread::get_id())) +
+               ".tmp";
+  {
+    std::ofstream file{temp_path, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<const char *>(header.data()), sizeof(header));
+    file.write(body.data(), static_cast<std::streamsize>(body.size()));
+    if (!file) {
+      LOG_WARN("Failed to write Lua bytecode cache {}", path.string());
+      file.close();
+      std::filesystem::remove(temp_path, err);
+      return;
     }
   }
+  std::filesystem::rename(temp_path, path, err);
+  if (err) {
+    LOG_WARN("Failed to store Lua bytecode cache {}: {}", path.string(),
+             err.message());
+    std::filesystem::remove(temp_path, err);
+  }
+}
 
-  if (meta.user_cooldown > 0) {
-    auto cmd_it = user_command_cooldowns.find(command);
-    if (cmd_it != user_command_cooldowns.end()) {
-      auto user_it = cmd_it->second.find(user);
-      if (user_it != cmd_it->second.end()) {
-        auto time_since_last = std::chrono::duration_cast<std::chrono::seconds>(
-                                   now - user_it->second)
-                                   .count();
-        if (time_since_last < meta.user_cooldown) {
-          return true;
-        }
+// One entry of a command's `timers`: `every` (seconds) or `cron`, plus
+// optional `min_messages`, `message` and `args`
+auto parseTimer(const sol::table &entry, const std::string &command)
+    -> std::optional<sbot::core::CommandTimer> {
+  sbot::core::CommandTimer timer;
+  if (auto cron = entry.get<sol::optional<std::string>>("cron")) {
+    timer.schedule.cron = sbot::core::CronSchedule::parse(*cron);
+    if (!timer.schedule.cron) {
+      LOG_WARN("Ignoring timer of {} with invalid cron '{}'", command, *cron);
+      return std::nullopt;
+    }
+  } else {
+    auto every = entry.get_or<std::int64_t>("every", 0);
+    if (every <= 0) {
+      LOG_WARN("Ignoring timer of {} without 'every' or 'cron'", command);
+      return std::nullopt;
+    }
+    timer.schedule.interval =
+        std::max(std::chrono::seconds{every}, c_min_timer_interval);
+  }
+  auto min_messages = entry.get_or<std::int64_t>("min_messages", 0);
+  timer.schedule.min_messages =
+      static_cast<std::size_t>(std::max<std::int64_t>(min_messages, 0));
+  timer.message = entry.get_or<std::string>("message", "");
+  if (auto args = entry.get<sol::optional<sol::table>>("args")) {
+    for (std::size_t i = 1; i <= args->size(); ++i) {
+      if ((*args)[i].valid()) {
+        timer.args.push_back((*args)[i]);
       }
     }
   }
-  return false;
+  return timer;
 }
+} // namespace
 
-auto sbot::core::CooldownTracker::recordUsage(const std::string &command,
-                                              const std::string &user) -> void {
-  auto now = std::chrono::steady_clock::now();
+struct sbot::core::LuaCommandContext::OwnedCommand {
+  ChatMessage message;
+  std::string command;
+  std::vector<std::string> args;
+  std::vector<std::string_view> arg_views;
+  CommandContext context;
 
-  last_global_command                   = now;
-  last_command_use[command]             = now;
-  user_command_cooldowns[command][user] = now;
-  command_use_count[command]++;
-}
+  explicit OwnedCommand(const CommandContext &ctx)
+      : message{ctx.message}, command{ctx.command},
+        args{ctx.args.begin(), ctx.args.end()},
+        arg_views{args.begin(), args.end()},
+        context{message, command, arg_views, ctx.reply_fn} {}
+};
+
+sbot::core::LuaCommandContext::LuaCommandContext(
+    const CommandContext &ctx, sol::table args,
+    const std::string &channel_owner, AudioSystem &audio_system)
+    : m_ctx{&ctx}, m_args{std::move(args)}, m_channel_owner{channel_owner},
+      m_audio_system{audio_system} {}
 
-auto sbot::core::CooldownTracker::resetStreamCounters() -> void {
-  command_use_count.clear();
+sbot::core::LuaCommandContext::~LuaCommandContext() = default;
+
+auto sbot::core::LuaCommandContext::detach() -> void {
+  if (m_owned) {
+    return;
+  }
+  m_owned = std::make_unique<OwnedCommand>(*m_ctx);
+  m_ctx   = &m_owned->context;
 }
 
-sbot::core::LuaCommandEngine::LuaCommandEngine() {
+sbot::core::LuaCommandEngine::LuaCommandEngine(std::size_t state_count)
+    : m_lua{lua_compat::makeState(m_loader_allocator)},
+      m_state_count{state_count} {
   LOG_CONTEXT("LuaCommmandEngine");
   LOG_INFO("Initializing");
 }
@@ -77,6 +280,60 @@ sbot::core::LuaCommandEngine::LuaCommandEngine() {
 sbot::core::LuaCommandEngine::~LuaCommandEngine() {
   LOG_CONTEXT("LuaCommmandEngine");
   LOG_INFO("Shutting Down");
+  setScheduler(nullptr, {});
+  closeAsync();
+  if (m_metrics != nullptr) {
+    m_metrics->setHeapSource({});
+  }
+}
+
+auto sbot::core::LuaCommandEngine::closeAsync() -> void {
+  std::unordered_map<std::uint64_t, std::unique_ptr<Invocation>> invocations;
+  {
+    std::lock_guard lock{m_pending->mutex};
+    m_pending->closed = true;
+    invocations.swap(m_pending->invocations);
+  }
+  if (!invocations.empty()) {
+    LOG_INFO("Dropping {} suspended Lua commands", invocations.size());
+  }
+  // This is the shutdown thread, not a worker, so it can wait for states
+  for (auto &[id, invocation] : invocations) {
+    auto state = m_pool->acquire(*invocation->state);
+    invocation.reset();
+  }
+}
+
+auto sbot::core::LuaCommandEngine::setMetrics(CommandMetrics *metrics)
+    -> void {
+  if (m_metrics != nullptr) {
+    m_metrics->setHeapSource({});
+  }
+  m_metrics = metrics;
+  if (m_metrics != nullptr) {
+    m_metrics->setHeapSource([this] { return heapUsage(); });
+  }
+}
+
+auto sbot::core::LuaCommandEngine::heapUsage() const
+    -> std::vector<HeapUsageRow> {
+  std::vector<HeapUsageRow> rows;
+  if (!m_pool) {
+    return rows;
+  }
+  std::shared_lock lock{m_scripts_mutex};
+  rows.reserve(m_commands.size());
+  for (CommandId owner = 0; owner < m_commands.size(); ++owner) {
+    std::size_t live_bytes{0};
+    for (const auto &state : m_pool->states()) {
+      live_bytes += state->allocator.ownerBytes(owner);
+    }
+    // Files that were deleted and collected
+    if (live_bytes > 0) {
+      rows.push_back({m_commands[owner].file_name, live_bytes});
+    }
+  }
+  return rows;
 }
 
 auto sbot::core::LuaCommandEngine::initialize() -> void {
@@ -86,24 +343,34 @@ auto sbot::core::LuaCommandEngine::initialize() -> void {
   }
   LOG_INFO("Initializing Lua command engine");
 
-  m_lua.open_libraries(sol::lib::base, sol::lib::string, sol::lib::math,
-                       sol::lib::table, sol::lib::utf8);
-
-  setupLuaEnvironment();
+  auto setup = [this](sol::state &lua) {
+    lua_compat::openLibraries(lua);
+    setupLuaEnvironment(lua);
+    lua_sandbox::sealGlobals(lua);
+  };
+  m_kv_store = std::make_unique<KvStore>(m_store_path);
+  setup(m_lua);
+  // Only pooled states defer collection; the loader is idle between loads
+  m_pool        = std::make_unique<LuaStatePool>(
+      m_state_count, LuaAllocator::c_default_limit,
+      [&setup](sol::state &lua) {
+        setup(lua);
+        lua_compat::pauseCollector(lua);
+      });
   m_initialized = true;
 
   LOG_INFO("Lua command engine initialized successfully");
 }
 
-auto sbot::core::LuaCommandEngine::setupLuaEnvironment() -> void {
-  m_lua.new_usertype<LuaCommandContext>(
+auto sbot::core::LuaCommandEngine::setupLuaEnvironment(sol::state &lua)
+    -> void {
+  auto context_type = lua.new_usertype<LuaCommandContext>(
       // clang-format off
 "CommandContext",
 "getUser", &LuaCommandContext::getUser,
 "getCommand", &LuaCommandContext::getCommand,
 "getArgs", &LuaCommandContext::getArgs,
 "joinArgs", &LuaCommandContext::joinArgs,
-"reply", &LuaCommandContext::reply,
 "getMessageText", &LuaCommandContext::getMessageText,
 "isBroadcaster", &LuaCommandContext::isBroadcaster,
 "isFounder", &LuaCommandContext::isFounder,
@@ -117,84 +384,485 @@ auto sbot::core::LuaCommandEngine::setupLuaEnvironment() -> void {
 "playSound", &LuaCommandContext::playSound);
   // clang-format on
 
-  m_lua["log"] = [](const std::string &message) {
+  // Queues the message and carries on, as it always has
+  context_type["reply"] = [](LuaCommandContext &ctx,
+                             const std::string &message) {
+    ctx.command().reply(message);
+  };
+  // These yield the script's coroutine; the engine starts the wait once it
+  // has, and the script resumes with the values passed to `resume`
+  context_type["replyAndWait"] = sol::yielding(
+      [](LuaCommandContext &ctx, const std::string &message) {
+        // Resumes with whether the message was sent
+        ctx.suspend([&ctx, message](AsyncResume resume) {
+          ctx.command().reply(message,
+                              [resume = std::move(resume)](bool sent) {
+                                resume({sent});
+                              });
+        });
+      });
+  context_type["sleep"] = sol::yielding([this](LuaCommandContext &ctx,
+                                               std::int64_t delay_ms) {
+    auto io_context = m_async.io_context;
+    if (!io_context) {
+      throw sol::error{"ctx:sleep is unavailable"};
+    }
+    auto delay = std::clamp(std::chrono::milliseconds{delay_ms},
+                            std::chrono::milliseconds{0},
+                            std::chrono::milliseconds{c_max_sleep});
+    ctx.suspend([io_context, delay](AsyncResume resume) {
+      auto timer =
+          std::make_shared<boost::asio::steady_timer>(*io_context, delay);
+      timer->async_wait([timer, resume = std::move(resume)](
+                            const boost::system::error_code & /*err*/) {
+        resume({});
+      });
+    });
+  });
+  context_type["playSoundAndWait"] = sol::yielding(
+      [this](LuaCommandContext &ctx, const std::string &filepath,
+             sol::optional<int> volume) {
+        auto io_context = m_async.io_context;
+        if (!io_context) {
+          throw sol::error{"ctx:playSoundAndWait is unavailable"};
+        }
+        // Resumes with whether the sound played, once it has finished
+        auto length = m_audio_system.soundLength(filepath);
+        if (!length || !ctx.playSound(filepath, volume)) {
+          ctx.suspend([](AsyncResume resume) { resume({false}); });
+          return;
+        }
+        ctx.suspend([io_context, length = *length](AsyncResume resume) {
+          auto timer =
+              std::make_shared<boost::asio::steady_timer>(*io_context, length);
+          timer->async_wait([timer, resume = std::move(resume)](
+                                const boost::system::error_code & /*err*/) {
+            resume({true});
+          });
+        });
+      });
+  context_type["httpGet"] = sol::yielding([this](LuaCommandContext &ctx,
+                                                 const std::string &target) {
+    auto http_get = m_async.http_get;
+    if (!http_get) {
+      throw sol::error{"ctx:httpGet is unavailable"};
+    }
+    // Resumes with the response body, or nil if the request failed
+    ctx.suspend([http_get, target](AsyncResume resume) {
+      http_get(target, [resume = std::move(resume)](
+                           std::optional<std::string> body) {
+        if (body) {
+          resume({std::move(*body)});
+        } else {
+          resume({std::monostate{}});
+        }
+      });
+    });
+  });
+
+  lua["log"] = [](const std::string &message) {
     LOG_INFO("[Lua] {}", message);
   };
 
+  // Globals are per file (see lua_sandbox); this is the only data scripts
+  // share
+  sol::table shared = lua.create_named_table("shared");
+  bindStoreTable(shared, m_shared_store, "shared");
+
+  // Same calls as `shared`, but kept on disk
+  sol::table store = lua.create_named_table("store");
+  bindStoreTable(store, *m_kv_store, "store");
+  // Older name for store.increment
+  store["incr"] = store.get<sol::object>("increment");
+  // Both return an array of {key = ..., value = ...} in key order
+  auto to_table = [](const std::vector<KvStore::Entry> &entries,
+                     sol::this_state lua_state) {
+    sol::state_view lua_view{lua_state};
+    sol::table rows = lua_view.create_table(static_cast<int>(entries.size()));
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+      sol::table row = lua_view.create_table(0, 2);
+      row.raw_set("key", entries[i].first);
+      std::visit([&row](const auto &stored) { row.raw_set("value", stored); },
+                 entries[i].second);
+      rows.raw_set(i + 1, row);
+    }
+    return rows;
+  };
+  auto clamp_limit = [](sol::optional<std::int64_t> limit) {
+    return static_cast<std::size_t>(std::clamp<std::int64_t>(
+        limit.value_or(c_default_scan_limit), 0, c_max_scan_limit));
+  };
+  store["scan"] = [this, to_table, clamp_limit](
+                      const std::string &prefix,
+                      sol::optional<std::int64_t> limit,
+                      sol::this_state lua_state) {
+    return to_table(m_kv_store->scan(prefix, clamp_limit(limit)), lua_state);
+  };
+  // Keys from `first` up to but excluding `last`; nil `last` is unbounded
+  store["range"] = [this, to_table, clamp_limit](
+                       const std::string &first,
+                       sol::optional<std::string> last,
+                       sol::optional<std::int64_t> limit,
+                       sol::this_state lua_state) {
+    return to_table(m_kv_store->range(first, last.value_or(""),
+                                      clamp_limit(limit)),
+                    lua_state);
+  };
+
   LOG_DEBUG("Lua environment setup complete");
 }
 
 auto sbot::core::LuaCommandEngine::loadLuaCommand(
     const std::filesystem::path &file_path) -> bool {
+  std::lock_guard lock{m_load_mutex};
+  return loadScript(file_path) != LoadOutcome::Failed;
+}
+
+auto sbot::core::LuaCommandEngine::loadScript(
+    const std::filesystem::path &file_path) -> LoadOutcome {
   if (!m_initialized) {
     LOG_ERROR("Lua engine not initialized");
-    return false;
+    return LoadOutcome::Failed;
   }
-  if (!std::filesystem::exists(file_path)) {
+  PreparedScript prepared;
+  if (auto outcome = statScript(file_path, prepared);
+      outcome != LoadOutcome::Loaded) {
+    return outcome;
+  }
+  prepareScript(prepared, m_lua);
+  return installScript(std::move(prepared));
+}
+
+auto sbot::core::LuaCommandEngine::statScript(
+    const std::filesystem::path &file_path, PreparedScript &prepared) const
+    -> LoadOutcome {
+  std::error_code err_code;
+  auto mtime = std::filesystem::last_write_time(file_path, err_code);
+  if (err_code) {
     LOG_ERROR("Lua command file does not exist: {}", file_path.string());
-    return false;
+    return LoadOutcome::Failed;
+  }
+  prepared = PreparedScript{.path = file_path, .mtime = mtime};
+  if (CommandId command = findLoaded(file_path.string()); command != 0) {
+    if (m_commands[command].mtime == mtime) {
+      return LoadOutcome::Unchanged;
+    }
+    prepared.loaded_hash = m_commands[command].source_hash;
+  }
+  return LoadOutcome::Loaded;
+}
+
+auto sbot::core::LuaCommandEngine::prepareScript(PreparedScript &prepared,
+                                                 sol::state &compiler) const
+    -> void {
+  using Clock  = std::chrono::steady_clock;
+  auto started = Clock::now();
+  auto source  = readFile(prepared.path);
+  if (!source) {
+    LOG_ERROR("Could not read Lua command file {}", prepared.path.string());
+    return;
+  }
+  prepared.source_hash = hashSource(*source);
+  auto read_done       = Clock::now();
+  prepared.read_time =
+      std::chrono::duration_cast<std::chrono::microseconds>(read_done -
+                                                            started);
+  if (prepared.loaded_hash == prepared.source_hash) {
+    // Touched but not edited
+    prepared.unchanged = true;
+    return;
+  }
+
+  try {
+    std::string chunk_name = "@" + prepared.path.string();
+    std::filesystem::path cache_path;
+    if (!m_bytecode_cache.empty()) {
+      cache_path = m_bytecode_cache / cacheFileName(prepared.path);
+      if (auto bytecode = readCachedBytecode(cache_path, prepared.mtime,
+                                             prepared.source_hash)) {
+        // A cache written by a different Lua build fails to load; recompile
+        sol::load_result loaded =
+            compiler.load_buffer(bytecode->data(), bytecode->size(),
+                                 chunk_name, sol::load_mode::binary);
+        if (loaded.valid()) {
+          LOG_DEBUG("Using cached bytecode for {}", prepared.path.string());
+          prepared.bytecode   = std::move(*bytecode);
+          prepared.from_cache = true;
+        }
+      }
+    }
+    if (!prepared.from_cache) {
+      sol::load_result loaded =
+          compiler.load_buffer(source->data(), source->size(), chunk_name,
+                               sol::load_mode::text);
+      if (loaded.valid()) {
+        auto bytecode = loaded.get<sol::protected_function>().dump();
+        prepared.bytecode.assign(bytecode.as_string_view());
+        if (!cache_path.empty()) {
+          writeCachedBytecode(cache_path, prepared.mtime, prepared.source_hash,
+                              bytecode);
+        }
+      } else {
+        sol::error err = loaded;
+        LOG_ERROR("Error compiling Lua command {}: {}",
+                  prepared.path.string(), err.what());
+      }
+    }
+  } catch (const std::exception &err) {
+    LOG_ERROR("Exception compiling {}: {}", prepared.path.string(),
+              err.what());
+    prepared.bytecode.clear();
+  }
+  prepared.compile_time =
+      std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                            read_done);
+}
+
+auto sbot::core::LuaCommandEngine::prepareScripts(
+    std::vector<PreparedScript> &scripts) const -> std::size_t {
+  if (scripts.empty()) {
+    return 0;
   }
+  std::size_t hardware = std::max(1U, std::thread::hardware_concurrency());
+  std::size_t workers  = std::min(scripts.size(), hardware);
+  std::atomic<std::size_t> next{0};
+  auto work = [this, &scripts, &next] {
+    // Compiling needs no libraries, only a state of the same backend
+    LuaAllocator allocator{LuaAllocator::c_default_limit};
+    sol::state compiler = lua_compat::makeState(allocator);
+    for (auto index = next.fetch_add(1, std::memory_order_relaxed);
+         index < scripts.size();
+         index = next.fetch_add(1, std::memory_order_relaxed)) {
+      prepareScript(scripts[index], compiler);
+    }
+  };
+  {
+    // The calling thread is one of the workers
+    std::vector<std::jthread> threads;
+    threads.reserve(workers - 1);
+    for (std::size_t i = 1; i < workers; ++i) {
+      threads.emplace_back(work);
+    }
+    work();
+  }
+  return workers;
+}
 
-  LOG_INFO("Loading Lua command from: {}", file_path.string());
+auto sbot::core::LuaCommandEngine::installScript(PreparedScript prepared)
+    -> LoadOutcome {
+  std::string key       = prepared.path.string();
+  LoadedScript *current = nullptr;
+  if (CommandId loaded_id = findLoaded(key); loaded_id != 0) {
+    current = &m_commands[loaded_id];
+  }
+  if (prepared.unchanged) {
+    if (current != nullptr) {
+      current->mtime = prepared.mtime;
+    }
+    return LoadOutcome::Unchanged;
+  }
+  // Unreadable or failed to compile; already logged
+  if (prepared.bytecode.empty()) {
+    return LoadOutcome::Failed;
+  }
+
+  LOG_INFO("Loading Lua command from: {}", key);
 
   try {
-    auto result = m_lua.script_file(file_path.string());
+    sol::load_result loaded =
+        m_lua.load_buffer(prepared.bytecode.data(), prepared.bytecode.size(),
+                          "@" + key, sol::load_mode::binary);
+    if (!loaded.valid()) {
+      sol::error err = loaded;
+      LOG_ERROR("Error loading Lua command {}: {}", key, err.what());
+      return LoadOutcome::Failed;
+    }
+    sol::protected_function chunk = loaded.get<sol::protected_function>();
+    lua_sandbox::makeEnvironment(m_lua).set_on(chunk);
+    sol::protected_function_result result;
+    {
+      // A runaway top level would otherwise stall every later load
+      BudgetScope budget{m_lua.lua_state(), ExecutionBudget{}};
+      result = chunk();
+    }
 
     if (!result.valid()) {
       sol::error err = result;
-      LOG_ERROR("Error loading Lua command {}: {}", file_path.string(),
-                err.what());
-      return false;
+      LOG_ERROR("Error loading Lua command {}: {}", key, err.what());
+      return LoadOutcome::Failed;
     }
 
     if (result.get_type() != sol::type::table) {
-      LOG_ERROR("Lua command file {} must return a table", file_path.string());
-      return false;
+      LOG_ERROR("Lua command file {} must return a table", key);
+      return LoadOutcome::Failed;
     }
 
     sol::table command_table = result;
 
     if (!command_table["name"].valid()) {
-      LOG_ERROR("Lua command {} missing required 'name' field",
-                file_path.string());
-      return false;
+      LOG_ERROR("Lua command {} missing required 'name' field", key);
+      return LoadOutcome::Failed;
     }
 
-    if (!command_table["execute"].valid()) {
-      LOG_ERROR("Lua command {} missing required 'execute' function",
-                file_path.string());
-      return false;
+    sol::protected_function execute_func = command_table["execute"];
+    if (!execute_func.valid()) {
+      LOG_ERROR("Lua command {} missing required 'execute' function", key);
+      return LoadOutcome::Failed;
     }
 
     std::string command_name = command_table["name"];
 
     if (command_name.empty()) {
-      LOG_ERROR("Lua command {} has empty name", file_path.string());
-      return false;
+      LOG_ERROR("Lua command {} has empty name", key);
+      return LoadOutcome::Failed;
     }
 
     CommandMetadata metadata =
         parseCommandMetadata(command_table, command_name);
 
-    m_command_files[command_name]    = file_path;
-    m_command_metadata[command_name] = metadata;
-
-    for (const auto &alias : metadata.aliases) {
-      m_command_metadata[alias] = metadata;
-      m_command_files[alias]    = file_path;
+    std::vector<std::string> names{command_name};
+    names.insert(names.end(), metadata.aliases.begin(),
+                 metadata.aliases.end());
+    LoadedScript script{
+        .key         = key,
+        .file_name   = prepared.path.filename().string(),
+        .loaded      = true,
+        .mtime       = prepared.mtime,
+        .source_hash = prepared.source_hash,
+        .version     = ++m_next_version,
+        .bytecode    = std::make_shared<const std::string>(
+            std::move(prepared.bytecode)),
+        .health      = std::make_shared<ScriptHealth>(),
+        .metadata    = std::move(metadata),
+        .names       = std::move(names)};
+    {
+      // One critical section, so no invocation sees the command missing
+      std::unique_lock lock{m_scripts_mutex};
+      auto [id_it, inserted] = m_command_ids.try_emplace(
+          key, static_cast<CommandId>(m_commands.size()));
+      if (inserted) {
+        m_commands.emplace_back();
+      }
+      CommandId command = id_it->second;
+      // Aliases may have changed since the last load
+      eraseScript(command);
+      for (const auto &name : script.names) {
+        m_command_names[name] = command;
+      }
+      m_commands[command] = std::move(script);
     }
+    m_generation.fetch_add(1, std::memory_order_release);
+    syncTimers(key);
 
     LOG_INFO("Successfully loaded Lua command: '{}'", command_name);
-    return true;
+    return LoadOutcome::Loaded;
   } catch (const sol::error &err) {
-    LOG_ERROR("Sol2 error loading {}: {}", file_path.string(), err.what());
-    return false;
+    LOG_ERROR("Sol2 error loading {}: {}", key, err.what());
+    return LoadOutcome::Failed;
   } catch (const std::exception &err) {
-    LOG_ERROR("Exception loading {}: {}", file_path.string(), err.what());
-    return false;
+    LOG_ERROR("Exception loading {}: {}", key, err.what());
+    return LoadOutcome::Failed;
   }
 }
 
+auto sbot::core::LuaCommandEngine::findLoaded(const std::string &key) const
+    -> CommandId {
+  auto id_it = m_command_ids.find(key);
+  if (id_it == m_command_ids.end() || !m_commands[id_it->second].loaded) {
+    return 0;
+  }
+  return id_it->second;
+}
+
+auto sbot::core::LuaCommandEngine::forgetScript(const std::string &key)
+    -> void {
+  {
+    std::unique_lock lock{m_scripts_mutex};
+    if (CommandId command = findLoaded(key); command != 0) {
+      eraseScript(command);
+    }
+  }
+  m_generation.fetch_add(1, std::memory_order_release);
+  syncTimers(key);
+}
+
+auto sbot::core::LuaCommandEngine::eraseScript(CommandId command) -> void {
+  auto &script = m_commands[command];
+  for (const auto &name : script.names) {
+    // Another file may have taken the name since
+    if (auto name_it = m_command_names.find(name);
+        name_it != m_command_names.end() && name_it->second == command) {
+      m_command_names.erase(name_it);
+    }
+  }
+  // Keep what names the slot; everything else goes with the file
+  script = LoadedScript{.key = script.key, .file_name = script.file_name};
+}
+
+auto sbot::core::LuaCommandEngine::syncState(LuaStatePool::PooledState &state)
+    -> void {
+  // Read before the snapshot: a load racing with it bumps the generation
+  // again and the next checkout syncs once more
+  std::uint64_t generation = m_generation.load(std::memory_order_acquire);
+  if (state.generation == generation) {
+    return;
+  }
+
+  // By command id; unloaded slots have version 0
+  struct Image {
+    std::string key;
+    std::uint64_t version{0};
+    std::shared_ptr<const std::string> bytecode;
+  };
+  std::vector<Image> images;
+  {
+    std::shared_lock lock{m_scripts_mutex};
+    images.reserve(m_commands.size());
+    for (const auto &script : m_commands) {
+      images.push_back({script.key, script.version, script.bytecode});
+    }
+  }
+
+  state.scripts.resize(images.size());
+  for (CommandId command = 1; command < images.size(); ++command) {
+    const auto &image = images[command];
+    auto &slot        = state.scripts[command];
+    if (slot.version == image.version) {
+      continue;
+    }
+    if (image.version == 0) {
+      slot = {};
+      continue;
+    }
+    sol::load_result loaded =
+        state.lua.load_buffer(image.bytecode->data(), image.bytecode->size(),
+                              "@" + image.key, sol::load_mode::binary);
+    sol::protected_function_result result;
+    if (loaded.valid()) {
+      // A fresh environment, so the previous version's globals are
+      // collected with it and other files' are not touched
+      sol::protected_function chunk = loaded.get<sol::protected_function>();
+      lua_sandbox::makeEnvironment(state.lua).set_on(chunk);
+      BudgetScope budget{state.lua.lua_state(), ExecutionBudget{}};
+      state.allocator.setOwner(command);
+      result = chunk();
+      state.allocator.setOwner(0);
+    }
+    if (!loaded.valid() || !result.valid() ||
+        result.get_type() != sol::type::table) {
+      LOG_ERROR("Failed to load {} into a pooled Lua state", image.key);
+      slot = {};
+      continue;
+    }
+    sol::table command_table = result;
+    slot.execute             = command_table["execute"];
+    slot.version             = image.version;
+  }
+  // The chunks and environments that were replaced are garbage now
+  state.gc_pending.store(true, std::memory_order_relaxed);
+  state.generation = generation;
+}
+
 auto sbot::core::LuaCommandEngine::loadCommandsFromDirectory(
     const std::filesystem::path &directory) -> int {
   if (!std::filesystem::exists(directory) ||
@@ -203,25 +871,99 @@ auto sbot::core::LuaCommandEngine::loadCommandsFromDirectory(
               directory.string());
     return 0;
   }
+  if (!m_initialized) {
+    LOG_ERROR("Lua engine not initialized");
+    return 0;
+  }
 
   LOG_INFO("Loading Lua commands from directory: {}", directory.string());
 
-  int loaded_count = 0;
-
+  std::vector<std::filesystem::path> files;
   try {
     for (const auto &entry : std::filesystem::directory_iterator(directory)) {
       if (entry.is_regular_file() && entry.path().extension() == ".lua") {
-        if (loadLuaCommand(entry.path())) {
-          loaded_count++;
-        }
+        files.push_back(entry.path());
       }
     }
   } catch (const std::exception &err) {
     LOG_ERROR("Error scanning directory {}: {}", directory.string(),
               err.what());
   }
+  // Same registration order on every platform and run
+  std::ranges::sort(files);
+
+  using Clock  = std::chrono::steady_clock;
+  auto started = Clock::now();
+  std::lock_guard lock{m_load_mutex};
+
+  // Reading and compiling touch no shared state and run on every core;
+  // running the chunks and registering them use m_lua, one file at a time
+  int loaded_count = 0;
+  std::vector<PreparedScript> pending;
+  pending.reserve(files.size());
+  for (const auto &file_path : files) {
+    PreparedScript prepared;
+    switch (statScript(file_path, prepared)) {
+    case LoadOutcome::Loaded:
+      pending.push_back(std::move(prepared));
+      break;
+    case LoadOutcome::Unchanged:
+      ++loaded_count;
+      break;
+    case LoadOutcome::Failed:
+      break;
+    }
+  }
+  std::size_t workers = prepareScripts(pending);
+  auto prepared_at    = Clock::now();
 
-  LOG_INFO("Loaded {} Lua commands from {}", loaded_count, directory.string());
+  struct FileTiming {
+    std::string file_name;
+    std::chrono::microseconds read_time;
+    std::chrono::microseconds compile_time;
+    bool from_cache;
+    Clock::duration run_time;
+    std::string_view outcome;
+  };
+  std::vector<FileTiming> timings;
+  timings.reserve(pending.size());
+  for (auto &prepared : pending) {
+    FileTiming timing{.file_name    = prepared.path.filename().string(),
+                      .read_time    = prepared.read_time,
+                      .compile_time = prepared.compile_time,
+                      .from_cache   = prepared.from_cache,
+                      .run_time     = {},
+                      .outcome      = "failed"};
+    auto run_start  = Clock::now();
+    auto outcome    = installScript(std::move(prepared));
+    timing.run_time = Clock::now() - run_start;
+    switch (outcome) {
+    case LoadOutcome::Loaded:
+      timing.outcome = "loaded";
+      ++loaded_count;
+      break;
+    case LoadOutcome::Unchanged:
+      timing.outcome = "unchanged";
+      ++loaded_count;
+      break;
+    case LoadOutcome::Failed:
+      break;
+    }
+    timings.push_back(std::move(timing));
+  }
+  auto finished = Clock::now();
+
+  LOG_INFO("Loaded {} Lua commands from {} in {:.1f} ms ({:.1f} ms "
+           "compiling {} files on {} threads)",
+           loaded_count, directory.string(), toMillis(finished - started),
+           toMillis(prepared_at - started), pending.size(), workers);
+  for (const auto &timing : timings) {
+    LOG_INFO("  {}: read {:.2f} ms, compile {:.2f} ms{}, run {:.2f} ms, {}",
+             timing.file_name, toMillis(timing.read_time),
+             toMillis(timing.compile_time),
+             timing.from_cache ? " (cached)" : "", toMillis(timing.run_time),
+             timing.outcome);
+  }
   return loaded_count;
 }
 
@@ -232,117 +974,508 @@ auto sbot::core::LuaCommandEngine::registerWithParser(
     return;
   }
 
-  LOG_INFO("Registering {} Lua commands with command parser",
-           m_command_files.size());
-
-  for (const auto &[command_name, file_path] : m_command_files) {
-    try {
-      auto result = m_lua.script_file(file_path.string());
-      if (!result.valid()) {
-        LOG_ERROR("Failed to re-load command {} for registration",
-                  command_name);
-        continue;
+  std::vector<CommandId> commands;
+  {
+    std::shared_lock lock{m_scripts_mutex};
+    LOG_INFO("Registering {} Lua commands with command parser",
+             m_command_names.size());
+    for (CommandId command = 1; command < m_commands.size(); ++command) {
+      if (m_commands[command].loaded) {
+        commands.push_back(command);
       }
-      sol::table command_table             = result;
-      sol::protected_function execute_func = command_table["execute"];
+    }
+  }
+  for (CommandId command : commands) {
+    registerScript(command, parser);
+  }
+  parser.setTriggers(collectTriggers());
+  LOG_INFO("Finished registering Lua commands");
+}
 
-      if (!execute_func.valid()) {
-        LOG_ERROR("Command {} missing execute function during registration",
-                  command_name);
-        continue;
-      }
+auto sbot::core::LuaCommandEngine::registerScript(CommandId command,
+                                                  CommandParser &parser)
+    -> void {
+  std::vector<std::string> names;
+  CommandOptions options;
+  {
+    std::shared_lock lock{m_scripts_mutex};
+    const auto &script = m_commands[command];
+    if (!script.loaded) {
+      return;
+    }
+    names   = script.names;
+    options = {
+        .stale_after = std::chrono::seconds{script.metadata.stale_after},
+        .policy      = script.metadata.policy};
+  }
 
-      CommandHandler handler = [this, execute_func,
-                                command_name](const CommandContext &ctx) {
-        auto meta_it = m_command_metadata.find(command_name);
-        if (meta_it == m_command_metadata.end()) {
-          LOG_ERROR("No metadata found for command: {}", command_name);
-          ctx.reply("Command configuration error");
-          return;
-        }
-        const CommandMetadata &meta = meta_it->second;
-        if (!meta.enabled) {
-          return;
-        }
-        if (!hasPermission(ctx, meta)) {
-          ctx.reply("You don't have permission to use this command.");
-          return;
-        }
-        if (m_cooldown_tracker.isOnCooldown(command_name, ctx.message.user,
-                                            meta)) {
-          ctx.reply("Command is on cooldown.");
-          return;
-        }
-        if (meta.max_uses_per_stream > 0) {
-          auto use_count_it =
-              m_cooldown_tracker.command_use_count.find(command_name);
-          int current_uses =
-              (use_count_it != m_cooldown_tracker.command_use_count.end())
-                  ? use_count_it->second
-                  : 0;
-          if (current_uses >= meta.max_uses_per_stream) {
-            ctx.reply("Command has reached its usage limit for this stream.");
-            return;
-          }
-        }
-        executeLuaCommand(ctx, execute_func);
-        m_cooldown_tracker.recordUsage(command_name, ctx.message.user);
-      };
-
-      parser.registerCommand(command_name, std::move(handler));
-      LOG_DEBUG("Registered Lua command: {}", command_name);
-    } catch (const std::exception &err) {
-      LOG_ERROR("Error registering Lua command {}: {}", command_name,
-                err.what());
+  // Every name of a file runs the same script; permissions and cooldowns
+  // are checked by the parser's middleware
+  for (const auto &command_name : names) {
+    parser.registerCommand(command_name, makeHandler(command, command_name),
+                           options);
+    LOG_DEBUG("Registered Lua command: {}", command_name);
+  }
+}
+
+auto sbot::core::LuaCommandEngine::handlerFor(
+    const std::string &command_name) -> CommandHandler {
+  std::shared_lock lock{m_scripts_mutex};
+  auto name_it = m_command_names.find(command_name);
+  if (name_it == m_command_names.end()) {
+    return {};
+  }
+  return makeHandler(name_it->second, command_name);
+}
+
+auto sbot::core::LuaCommandEngine::makeHandler(CommandId command,
+                                               const std::string &command_name)
+    -> CommandHandler {
+  return [this, command, command_name](const CommandContext &ctx) {
+    startInvocation(ctx, command, command_name);
+  };
+}
+
+auto sbot::core::LuaCommandEngine::collectTriggers() const
+    -> std::vector<std::pair<std::string, std::string>> {
+  std::vector<std::pair<std::string, std::string>> triggers;
+  std::shared_lock lock{m_scripts_mutex};
+  for (const auto &script : m_commands) {
+    for (const auto &keyword : script.metadata.triggers) {
+      triggers.emplace_back(keyword, script.metadata.name);
     }
   }
-  LOG_INFO("Finished registering Lua commands");
+  return triggers;
 }
 
-auto sbot::core::LuaCommandEngine::reloadAllCommands() -> void {
-  LOG_INFO("Reloading all Lua commands");
+auto sbot::core::LuaCommandEngine::setScheduler(ChatScheduler *scheduler,
+                                                TimerDispatch dispatch)
+    -> void {
+  std::lock_guard lock{m_load_mutex};
+  if (m_scheduler != nullptr) {
+    for (CommandId command = 1; command < m_commands.size(); ++command) {
+      m_scheduler->removeGroup(m_commands[command].key);
+    }
+  }
+  m_scheduler      = scheduler;
+  m_timer_dispatch = std::move(dispatch);
+  for (CommandId command = 1; command < m_commands.size(); ++command) {
+    syncTimers(m_commands[command].key);
+  }
+}
 
-  auto files_to_reload = m_command_files;
-  m_command_files.clear();
+auto sbot::core::LuaCommandEngine::syncTimers(const std::string &key)
+    -> void {
+  if (m_scheduler == nullptr) {
+    return;
+  }
+  m_scheduler->removeGroup(key);
+  CommandId command = findLoaded(key);
+  if (command == 0 || !m_timer_dispatch) {
+    return;
+  }
+  const auto &metadata = m_commands[command].metadata;
+  for (std::size_t index = 0; index < metadata.timers.size(); ++index) {
+    // Runs on the scheduler's thread, without m_load_mutex, so it calls a
+    // copy of the dispatch; the work itself goes to the dispatch
+    m_scheduler->add(
+        key, metadata.timers[index].schedule,
+        [this, command, index, name = metadata.name,
+         dispatch = m_timer_dispatch] {
+          dispatch(name, [this, command, index](ReplyFn reply_fn) {
+            runTimer(command, index, reply_fn);
+          });
+        });
+  }
+  if (!metadata.timers.empty()) {
+    LOG_DEBUG("Scheduled {} timers of {}", metadata.timers.size(),
+              metadata.name);
+  }
+}
 
-  int reloaded = 0;
-  for (const auto &[command_name, file_path] : files_to_reload) {
-    if (loadLuaCommand(file_path)) {
-      reloaded++;
+auto sbot::core::LuaCommandEngine::runTimer(CommandId command,
+                                            std::size_t index,
+                                            const ReplyFn &reply_fn) -> void {
+  CommandTimer timer;
+  std::string command_name;
+  {
+    std::shared_lock lock{m_scripts_mutex};
+    const auto &script = m_commands[command];
+    if (!script.loaded || index >= script.metadata.timers.size()) {
+      return;
     }
+    timer        = script.metadata.timers[index];
+    command_name = script.metadata.name;
   }
-  LOG_INFO("Reloaded {}/{} Lua commands", reloaded, files_to_reload.size());
+  if (!timer.message.empty()) {
+    reply_fn(timer.message, {});
+    return;
+  }
+  // Timers act for the channel, so the script sees the broadcaster
+  ChatMessage message;
+  message.user       = m_channel_owner;
+  message.badges     = {"broadcaster"};
+  message.badge_mask = badge::c_broadcaster;
+  std::vector<std::string_view> args{timer.args.begin(), timer.args.end()};
+  CommandContext ctx{message, command_name, args, reply_fn};
+  startInvocation(ctx, command, command_name);
+}
+
+auto sbot::core::LuaCommandEngine::reloadFile(
+    const std::filesystem::path &file_path, CommandParser &parser) -> bool {
+  if (!m_initialized) {
+    LOG_ERROR("Cannot reload commands - Lua engine not initialized");
+    return false;
+  }
+  std::lock_guard lock{m_load_mutex};
+  std::string key = file_path.string();
+  std::vector<std::string> old_names;
+  if (CommandId command = findLoaded(key); command != 0) {
+    old_names = m_commands[command].names;
+  }
+
+  std::vector<std::string> new_names;
+  if (!std::filesystem::exists(file_path)) {
+    if (old_names.empty()) {
+      return true;
+    }
+    LOG_INFO("Lua command file {} was removed", key);
+    forgetScript(key);
+  } else {
+    switch (loadScript(file_path)) {
+    case LoadOutcome::Failed:
+      LOG_WARN("Keeping the previous version of {}", key);
+      return false;
+    case LoadOutcome::Unchanged:
+      return true;
+    case LoadOutcome::Loaded:
+      new_names = m_commands[findLoaded(key)].names;
+      break;
+    }
+  }
+
+  // Only this file's names change; other commands and all cooldown state
+  // are left alone
+  for (const auto &name : old_names) {
+    if (!std::ranges::contains(new_names, name)) {
+      parser.unregisterCommand(name);
+    }
+  }
+  if (!new_names.empty()) {
+    registerScript(findLoaded(key), parser);
+  }
+  parser.setTriggers(collectTriggers());
+  return true;
+}
+
+auto sbot::core::LuaCommandEngine::reloadAllCommands(CommandParser &parser)
+    -> void {
+  LOG_INFO("Reloading all Lua commands");
+  std::vector<std::filesystem::path> files;
+  {
+    std::lock_guard lock{m_load_mutex};
+    for (const auto &script : m_commands) {
+      if (script.loaded) {
+        files.emplace_back(script.key);
+      }
+    }
+  }
+
+  // One file at a time, each under the load lock, like the watcher's
+  // reloads; a failed file keeps serving its previous version
+  int failed = 0;
+  for (const auto &file_path : files) {
+    if (!reloadFile(file_path, parser)) {
+      ++failed;
+    }
+  }
+  LOG_INFO("Checked {} Lua command files for changes ({} failed)",
+           files.size(), failed);
 }
 
 auto sbot::core::LuaCommandEngine::getLoadedCommands() const
     -> std::vector<std::string> {
   std::vector<std::string> commands;
-  commands.reserve(m_command_files.size());
+  std::shared_lock lock{m_scripts_mutex};
+  commands.reserve(m_command_names.size());
 
-  for (const auto &[command_name, _] : m_command_files) {
+  for (const auto &[command_name, _] : m_command_names) {
     commands.push_back(command_name);
   }
   return commands;
 }
 
-auto sbot::core::LuaCommandEngine::executeLuaCommand(
-    const CommandContext &ctx, sol::protected_function lua_func) -> void {
+auto sbot::core::LuaCommandEngine::startInvocation(
+    const CommandContext &ctx, CommandId command,
+    const std::string &command_name) -> void {
+  ExecutionBudget budget;
+  std::shared_ptr<ScriptHealth> health;
+  {
+    std::shared_lock lock{m_scripts_mutex};
+    const auto &script = m_commands[command];
+    // Removed after the parser matched it
+    if (!script.loaded) {
+      return;
+    }
+    budget = script.metadata.budget;
+    health = script.health;
+  }
+  if (health->disabled.load(std::memory_order_relaxed)) {
+    LOG_DEBUG("Ignoring disabled command {}", command_name);
+    return;
+  }
+  auto state = m_pool->acquire();
+  syncState(*state);
+  if (command >= state->scripts.size() ||
+      state->scripts[command].version == 0) {
+    LOG_ERROR("Command {} is not loaded in this Lua state", command_name);
+    ctx.reply("Command error occured - check logs");
+    countOutcome(command_name, &CommandStats::errors);
+    return;
+  }
   try {
-    LuaCommandContext lua_ctx(ctx, m_channel_owner, m_audio_system);
+    auto invocation = std::make_unique<Invocation>();
+    invocation->id  = m_next_invocation.fetch_add(1, std::memory_order_relaxed);
+    invocation->command      = command;
+    invocation->command_name = command_name;
+    invocation->health       = std::move(health);
+    invocation->remaining    = budget;
+    invocation->state        = &*state;
 
-    auto result = lua_func(lua_ctx, ctx.args);
+    sol::table args =
+        state->lua.create_table(static_cast<int>(ctx.args.size()), 0);
+    for (std::size_t i = 0; i < ctx.args.size(); ++i) {
+      args.raw_set(i + 1, ctx.args[i]);
+    }
+    invocation->context = std::make_unique<LuaCommandContext>(
+        ctx, args, m_channel_owner, m_audio_system);
+    invocation->thread    = sol::thread::create(state->lua.lua_state());
+    invocation->coroutine = sol::coroutine{invocation->thread.thread_state(),
+                                           state->scripts[command].execute};
 
-    if (!result.valid()) {
+    // By pointer, so sol does not copy the context into a new userdata
+    std::vector<sol::object> call_args{
+        sol::make_object(state->lua, invocation->context.get()),
+        std::move(args)};
+    runSlice(*state, std::move(invocation), std::move(call_args));
+  } catch (const std::exception &err) {
+    LOG_ERROR("Exception starting Lua command '{}': {}", command_name,
+              err.what());
+    ctx.reply("Command execution failed");
+    countOutcome(command_name, &CommandStats::errors);
+  }
+}
+
+auto sbot::core::LuaCommandEngine::runSlice(
+    LuaStatePool::PooledState &state, std::unique_ptr<Invocation> invocation,
+    std::vector<sol::object> args) -> void {
+  Invocation &inv           = *invocation;
+  const CommandContext &ctx = inv.context->command();
+  BudgetOverrun overrun{BudgetOverrun::None};
+  bool ok{false};
+  bool yielded{false};
+  try {
+    BudgetScope scope{inv.thread.thread_state(), inv.remaining, &m_profiler,
+                      inv.command_name};
+    state.allocator.setOwner(inv.command);
+    sol::protected_function_result result =
+        inv.coroutine(sol::as_args(args));
+    state.allocator.setOwner(0);
+    overrun       = scope.overrun();
+    inv.remaining = scope.remaining(inv.remaining);
+    ok            = result.valid();
+    yielded       = ok && result.status() == sol::call_status::yielded;
+    if (!ok) {
       sol::error err = result;
-      LOG_ERROR("Error executing Lua command '{}': {}", ctx.command,
+      LOG_ERROR("Error executing Lua command '{}': {}", inv.command_name,
                 err.what());
       ctx.reply("Command error occured - check logs");
     }
   } catch (const std::exception &err) {
-    LOG_ERROR("Exception executing Lua command '{}': {}", ctx.command,
+    state.allocator.setOwner(0);
+    LOG_ERROR("Exception executing Lua command '{}': {}", inv.command_name,
               err.what());
     ctx.reply("Command execution failed");
   }
+  state.gc_pending.store(true, std::memory_order_relaxed);
+  // Behind on collection, so this command pays for what it allocated.
+  // Work in step with allocation keeps a busy state from growing until a
+  // full emergency collection, or on LuaJIT without bound.
+  std::size_t heap = lua_compat::heapBytes(state.lua);
+  if (heap > state.gc_baseline + c_gc_forced_growth &&
+      heap > state.gc_stepped_at) {
+    std::size_t grown_kb = (heap - state.gc_stepped_at) >> 10U;
+    collectStep(state,
+                static_cast<int>(std::clamp<std::size_t>(
+                    grown_kb, c_gc_step_kb, std::numeric_limits<int>::max())),
+                true);
+  }
+
+  if (yielded) {
+    if (AsyncStart start = inv.context->takePending()) {
+      suspend(std::move(invocation), std::move(start));
+      return;
+    }
+    // A bare coroutine.yield; nothing would ever resume it
+    LOG_ERROR("Lua command '{}' yielded outside a waiting call",
+              inv.command_name);
+    ctx.reply("Command error occured - check logs");
+    ok = false;
+  }
+  recordOverrun(inv.command_name, *inv.health, overrun);
+  if (!ok) {
+    countOutcome(inv.command_name, &CommandStats::errors);
+  }
+}
+
+auto sbot::core::LuaCommandEngine::suspend(
+    std::unique_ptr<Invocation> invocation, AsyncStart start) -> void {
+  // The parser's context is gone by the time the script resumes
+  invocation->context->detach();
+  std::uint64_t id = invocation->id;
+  {
+    std::lock_guard lock{m_pending->mutex};
+    if (m_pending->closed) {
+      return;
+    }
+    m_pending->invocations.emplace(id, std::move(invocation));
+  }
+  // Only schedules; the resumed slice waits for the caller's lease on the
+  // state to be released
+  start([this, pending = m_pending, id](std::vector<AsyncValue> values) {
+    std::lock_guard lock{pending->mutex};
+    if (pending->closed) {
+      return;
+    }
+    bool scheduled = m_async.schedule(
+        [this, id, values = std::move(values)]() mutable {
+          resume(id, std::move(values));
+        });
+    if (!scheduled) {
+      LOG_WARN("Could not schedule resumption of a Lua command");
+    }
+  });
+}
+
+auto sbot::core::LuaCommandEngine::resume(std::uint64_t id,
+                                          std::vector<AsyncValue> values)
+    -> void {
+  LuaStatePool::PooledState *home{nullptr};
+  {
+    std::lock_guard lock{m_pending->mutex};
+    auto invocation_it = m_pending->invocations.find(id);
+    if (invocation_it == m_pending->invocations.end()) {
+      // Dropped by closeAsync()
+      return;
+    }
+    home = invocation_it->second->state;
+  }
+  // A coroutine cannot move between states. Rather than hold this worker
+  // until its own is free, leave the invocation pending and come back
+  // through the executor when the state is released.
+  auto parked = std::make_shared<std::vector<AsyncValue>>(std::move(values));
+  auto state  = m_pool->acquireOrPark(
+      *home, [this, pending = m_pending, id, parked] {
+        std::lock_guard lock{pending->mutex};
+        if (pending->closed) {
+          return;
+        }
+        bool scheduled = m_async.schedule(
+            [this, id, parked] { resume(id, std::move(*parked)); });
+        if (!scheduled) {
+          LOG_WARN("Could not schedule resumption of a Lua command");
+        }
+      });
+  if (!state) {
+    return;
+  }
+  std::unique_ptr<Invocation> invocation;
+  {
+    std::lock_guard lock{m_pending->mutex};
+    auto node = m_pending->invocations.extract(id);
+    if (node.empty()) {
+      return;
+    }
+    invocation = std::move(node.mapped());
+  }
+  std::vector<sol::object> args;
+  args.reserve(parked->size());
+  for (auto &value : *parked) {
+    args.push_back(std::visit(
+        [&state](auto &held) {
+          if constexpr (std::is_same_v<std::decay_t<decltype(held)>,
+                                       std::monostate>) {
+            return sol::make_object(state->lua, sol::lua_nil);
+          } else {
+            return sol::make_object(state->lua, std::move(held));
+          }
+        },
+        value));
+  }
+  runSlice(*state, std::move(invocation), std::move(args));
+}
+
+auto sbot::core::LuaCommandEngine::collectIdle() -> bool {
+  if (!m_pool) {
+    return false;
+  }
+  for (const auto &state : m_pool->states()) {
+    if (!state->gc_pending.load(std::memory_order_relaxed)) {
+      continue;
+    }
+    // A busy state is left for the next idle moment
+    if (auto lease = m_pool->tryAcquire(*state)) {
+      collectStep(**lease, c_gc_step_kb, false);
+      return true;
+    }
+  }
+  return false;
+}
+
+auto sbot::core::LuaCommandEngine::collectStep(
+    LuaStatePool::PooledState &state, int kilobytes, bool forced) -> void {
+  auto started  = std::chrono::steady_clock::now();
+  bool finished = lua_compat::stepCollector(state.lua, kilobytes);
+  auto elapsed  = std::chrono::steady_clock::now() - started;
+
+  state.gc_stepped_at = lua_compat::heapBytes(state.lua);
+  if (finished) {
+    // Only a whole cycle says how much of the heap is live
+    state.gc_baseline = state.gc_stepped_at;
+    state.gc_pending.store(false, std::memory_order_relaxed);
+  }
+  if (m_metrics != nullptr) {
+    GcStats &gc = m_metrics->gc();
+    (forced ? gc.forced : gc.idle).record(elapsed);
+  }
+}
+
+auto sbot::core::LuaCommandEngine::recordOverrun(
+    const std::string &command_name, ScriptHealth &health,
+    BudgetOverrun overrun) -> void {
+  if (overrun == BudgetOverrun::None) {
+    health.strikes.store(0, std::memory_order_relaxed);
+    return;
+  }
+  int strikes = health.strikes.fetch_add(1, std::memory_order_relaxed) + 1;
+  LOG_ERROR("Lua command '{}' aborted: {} budget exceeded ({}/{})",
+            command_name,
+            overrun == BudgetOverrun::Instructions ? "instruction" : "time",
+            strikes, c_max_budget_strikes);
+  if (strikes >= c_max_budget_strikes &&
+      !health.disabled.exchange(true, std::memory_order_relaxed)) {
+    LOG_ERROR("Disabled Lua command '{}' until its file is reloaded",
+              command_name);
+  }
+}
+
+auto sbot::core::LuaCommandEngine::countOutcome(
+    const std::string &command_name,
+    std::atomic<std::uint64_t> CommandStats::*counter) -> void {
+  if (m_metrics != nullptr) {
+    (m_metrics->forCommand(command_name).*counter)
+        .fetch_add(1, std::memory_order_relaxed);
+  }
 }
 
 auto sbot::core::LuaCommandEngine::parseCommandMetadata(
@@ -363,52 +1496,72 @@ auto sbot::core::LuaCommandEngine::parseCommandMetadata(
       }
     }
   }
-  meta.global_cooldown  = command_table.get_or("global_cooldown", 0);
-  meta.command_cooldown = command_table.get_or("command_cooldown", 0);
-  meta.user_cooldown    = command_table.get_or("user_cooldown", 0);
+  if (auto triggers =
+          command_table.get<sol::optional<sol::table>>("triggers")) {
+    for (std::size_t i = 1; i <= triggers->size(); ++i) {
+      auto trigger = (*triggers)[i];
+      if (!trigger.is<std::string>()) {
+        LOG_WARN("Ignoring trigger {} of {}: not a string", i, meta.name);
+        continue;
+      }
+      meta.triggers.push_back(trigger.get<std::string>());
+    }
+  } else if (command_table["triggers"].valid()) {
+    LOG_WARN("Ignoring triggers of {}: not a table", meta.name);
+  }
+  meta.stale_after = command_table.get_or("stale_after", 0);
+
+  CommandPolicy &policy   = meta.policy;
+  policy.global_cooldown  = command_table.get_or("global_cooldown", 0);
+  policy.command_cooldown = command_table.get_or("command_cooldown", 0);
+  policy.user_cooldown    = command_table.get_or("user_cooldown", 0);
 
-  meta.mod_only        = command_table.get_or("mod_only", false);
-  meta.vip_only        = command_table.get_or("vip_only", false);
-  meta.subscriber_only = command_table.get_or("subscriber_only", false);
+  policy.mod_only        = command_table.get_or("mod_only", false);
+  policy.vip_only        = command_table.get_or("vip_only", false);
+  policy.subscriber_only = command_table.get_or("subscriber_only", false);
 
   if (command_table["allowed_users"].valid()) {
     sol::table users_table = command_table["allowed_users"];
     for (std::size_t i = 1; i <= users_table.size(); ++i) {
       if (users_table[i].valid()) {
-        meta.allowed_users.push_back(users_table[i]);
+        policy.allowed_users.push_back(users_table[i]);
       }
     }
   }
-  meta.enabled             = command_table.get_or("enabled", true);
-  meta.max_uses_per_stream = command_table.get_or("max_uses_per_stream", -1);
-
-  return meta;
-}
+  policy.enabled             = command_table.get_or("enabled", true);
+  policy.max_uses_per_stream = command_table.get_or("max_uses_per_stream", -1);
 
-auto sbot::core::LuaCommandEngine::hasPermission(
-    const CommandContext &ctx, const CommandMetadata &meta) const -> bool {
-  if (!meta.allowed_users.empty()) {
-    auto it = std::find(meta.allowed_users.begin(), meta.allowed_users.end(),
-                        ctx.message.user);
-    if (it != meta.allowed_users.end()) {
-      return true;
-    }
+  auto instructions =
+      command_table.get_or<std::int64_t>("instruction_budget", 0);
+  if (instructions > 0) {
+    meta.budget.instructions = static_cast<std::uint64_t>(instructions);
   }
-  LuaCommandContext lua_ctx(ctx, m_channel_owner, const_cast<AudioSystem&>(m_audio_system));
-  if (meta.mod_only && !lua_ctx.isModerator()) {
-    return false;
-  }
-  if (meta.vip_only && !lua_ctx.isVip()) {
-    return false;
+  auto time_ms = command_table.get_or<std::int64_t>("time_budget_ms", 0);
+  if (time_ms > 0) {
+    meta.budget.time = std::chrono::milliseconds{time_ms};
   }
-  if (meta.subscriber_only && !lua_ctx.isSubscriber()) {
-    return false;
+
+  if (auto timers = command_table.get<sol::optional<sol::table>>("timers")) {
+    for (std::size_t i = 1; i <= timers->size(); ++i) {
+      auto entry = (*timers)[i].get<sol::optional<sol::table>>();
+      if (!entry) {
+        continue;
+      }
+      if (auto timer = parseTimer(*entry, meta.name)) {
+        meta.timers.push_back(std::move(*timer));
+      }
+    }
   }
-  return true;
+
+  return meta;
 }
 
 auto sbot::core::LuaCommandEngine::getCommandMetadata(
-    const std::string &command_name) const -> const CommandMetadata * {
-  auto it = m_command_metadata.find(command_name);
-  return (it != m_command_metadata.end()) ? &it->second : nullptr;
+    const std::string &command_name) const -> std::optional<CommandMetadata> {
+  std::shared_lock lock{m_scripts_mutex};
+  auto it = m_command_names.find(command_name);
+  if (it == m_command_names.end()) {
+    return std::nullopt;
+  }
+  return m_commands[it->second].metadata;
 }
@@ -0,0 +1,271 @@
+#include "seraphbot/core/lua_compat.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <lua.hpp>
+#include <sol/error.hpp>
+#include <sol/types.hpp>
+#include <string>
+#include <string_view>
+#include <tuple>
+
+#include "seraphbot/core/logging.hpp"
+
+#if SBOT_LUAJIT
+namespace {
+constexpr std::uint32_t c_max_code_point{0x10FFFF};
+
+auto isContinuation(std::string_view text, std::size_t pos) -> bool {
+  return pos < text.size() &&
+         (static_cast<unsigned char>(text[pos]) & 0xC0U) == 0x80U;
+}
+
+// Strict decoding as in Lua 5.4: no overlong forms, surrogates or code
+// points past U+10FFFF. Returns the sequence length, or 0 if invalid.
+auto decodeAt(std::string_view text, std::size_t pos, std::uint32_t &code)
+    -> std::size_t {
+  constexpr std::uint32_t c_min_code[]{0, 0, 0x80, 0x800, 0x10000};
+  auto lead = static_cast<unsigned char>(text[pos]);
+  std::size_t length{0};
+  if (lead < 0x80U) {
+    code = lead;
+    return 1;
+  }
+  if ((lead & 0xE0U) == 0xC0U) {
+    length = 2;
+    code   = lead & 0x1FU;
+  } else if ((lead & 0xF0U) == 0xE0U) {
+    length = 3;
+    code   = lead & 0x0FU;
+  } else if ((lead & 0xF8U) == 0xF0U) {
+    length = 4;
+    code   = lead & 0x07U;
+  } else {
+    return 0;
+  }
+  for (std::size_t i = 1; i < length; ++i) {
+    if (!isContinuation(text, pos + i)) {
+      return 0;
+    }
+    code = (code << 6U) | (static_cast<unsigned char>(text[pos + i]) & 0x3FU);
+  }
+  if (code < c_min_code[length] || code > c_max_code_point ||
+      (code >= 0xD800U && code <= 0xDFFFU)) {
+    return 0;
+  }
+  return length;
+}
+
+auto encode(std::uint32_t code, std::string &out) -> void {
+  if (code < 0x80U) {
+    out += static_cast<char>(code);
+  } else if (code < 0x800U) {
+    out += static_cast<char>(0xC0U | (code >> 6U));
+    out += static_cast<char>(0x80U | (code & 0x3FU));
+  } else if (code < 0x10000U) {
+    out += static_cast<char>(0xE0U | (code >> 12U));
+    out += static_cast<char>(0x80U | ((code >> 6U) & 0x3FU));
+    out += static_cast<char>(0x80U | (code & 0x3FU));
+  } else {
+    out += static_cast<char>(0xF0U | (code >> 18U));
+    out += static_cast<char>(0x80U | ((code >> 12U) & 0x3FU));
+    out += static_cast<char>(0x80U | ((code >> 6U) & 0x3FU));
+    out += static_cast<char>(0x80U | (code & 0x3FU));
+  }
+}
+
+// Lua's relative string positions: negative counts from the end
+auto absolutePosition(std::int64_t pos, std::size_t length) -> std::int64_t {
+  if (pos >= 0) {
+    return pos;
+  }
+  if (static_cast<std::size_t>(-pos) > length) {
+    return 0;
+  }
+  return static_cast<std::int64_t>(length) + pos + 1;
+}
+
+auto installUtf8(sol::state &lua) -> void {
+  sol::table utf8 = lua.create_named_table("utf8");
+  utf8["charpattern"] = std::string{"[\0-\x7F\xC2-\xFD][\x80-\xBF]*", 14};
+
+  utf8["char"] = [](sol::variadic_args codes) {
+    std::string out;
+    for (auto code : codes) {
+      auto value = code.as<std::int64_t>();
+      if (value < 0 || value > c_max_code_point) {
+        throw sol::error{"bad argument to 'char' (value out of range)"};
+      }
+      encode(static_cast<std::uint32_t>(value), out);
+    }
+    return out;
+  };
+
+  // Number of characters starting between i and j, or nil and the
+  // position of the first invalid byte
+  utf8["len"] = [](std::string_view text, sol::optional<std::int64_t> first,
+                   sol::optional<std::int64_t> last, sol::this_state state)
+      -> std::tuple<sol::object, sol::object> {
+    std::int64_t pos = absolutePosition(first.value_or(1), text.size()) - 1;
+    std::int64_t end = absolutePosition(last.value_or(-1), text.size());
+    if (pos < 0 || pos > static_cast<std::int64_t>(text.size()) ||
+        end > static_cast<std::int64_t>(text.size())) {
+      throw sol::error{"bad argument to 'len' (out of bounds)"};
+    }
+    std::int64_t count{0};
+    while (pos < end) {
+      std::uint32_t code{0};
+      auto length = decodeAt(text, static_cast<std::size_t>(pos), code);
+      if (length == 0) {
+        return {sol::make_object(state, sol::lua_nil),
+                sol::make_object(state, pos + 1)};
+      }
+      pos += static_cast<std::int64_t>(length);
+      ++count;
+    }
+    return {sol::make_object(state, count),
+            sol::make_object(state, sol::lua_nil)};
+  };
+
+  utf8["codepoint"] = [](std::string_view text,
+                         sol::optional<std::int64_t> first,
+                         sol::optional<std::int64_t> last,
+                         sol::this_state state) {
+    std::int64_t start = absolutePosition(first.value_or(1), text.size());
+    std::int64_t end   = absolutePosition(last.value_or(start), text.size());
+    if (start < 1 || end > static_cast<std::int64_t>(text.size())) {
+      throw sol::error{"bad argument to 'codepoint' (out of bounds)"};
+    }
+    sol::variadic_results codes;
+    for (std::int64_t pos = start - 1; pos < end;) {
+      std::uint32_t code{0};
+      auto length = decodeAt(text, static_cast<std::size_t>(pos), code);
+      if (length == 0) {
+        throw sol::error{"invalid UTF-8 code"};
+      }
+      codes.push_back(
+          sol::make_object(state, static_cast<std::int64_t>(code)));
+      pos += static_cast<std::int64_t>(length);
+    }
+    return codes;
+  };
+
+  // Byte position where the n-th character from position i starts
+  utf8["offset"] = [](std::string_view text, std::int64_t n,
+                      sol::optional<std::int64_t> from)
+      -> sol::optional<std::int64_t> {
+    auto length = static_cast<std::int64_t>(text.size());
+    std::int64_t start = from.value_or(n >= 0 ? 1 : length + 1);
+    std::int64_t pos   = absolutePosition(start, text.size()) - 1;
+    if (pos < 0 || pos > length) {
+      throw sol::error{"bad argument to 'offset' (position out of bounds)"};
+    }
+    auto is_continuation = [&text](std::int64_t at) {
+      return isContinuation(text, static_cast<std::size_t>(at));
+    };
+    if (n == 0) {
+      while (pos > 0 && is_continuation(pos)) {
+        --pos;
+      }
+      return pos + 1;
+    }
+    if (is_continuation(pos)) {
+      throw sol::error{"initial position is a continuation byte"};
+    }
+    if (n < 0) {
+      while (n < 0 && pos > 0) {
+        do {
+          --pos;
+        } while (pos > 0 && is_continuation(pos));
+        ++n;
+      }
+    } else {
+      --n;
+      while (n > 0 && pos < length) {
+        do {
+          ++pos;
+        } while (is_continuation(pos));
+        --n;
+      }
+    }
+    if (n != 0) {
+      return sol::nullopt;
+    }
+    return pos + 1;
+  };
+
+  // for position, code in utf8.codes(s)
+  auto step = [](std::string_view text, std::int64_t previous)
+      -> std::tuple<sol::optional<std::int64_t>, std::int64_t> {
+    auto pos = static_cast<std::size_t>(previous);
+    while (pos < text.size() && isContinuation(text, pos)) {
+      ++pos;
+    }
+    if (pos >= text.size()) {
+      return {sol::nullopt, 0};
+    }
+    std::uint32_t code{0};
+    if (decodeAt(text, pos, code) == 0) {
+      throw sol::error{"invalid UTF-8 code"};
+    }
+    return {static_cast<std::int64_t>(pos) + 1, code};
+  };
+  sol::protected_function make_codes =
+      lua.load("local step = ... return function(s) return step, s, 0 end")
+          .get<sol::protected_function>();
+  utf8["codes"] = make_codes(step).get<sol::function>();
+}
+} // namespace
+#endif
+
+auto sbot::core::lua_compat::makeState(
+    [[maybe_unused]] LuaAllocator &allocator) -> sol::state {
+#if SBOT_LUAJIT
+  return sol::state{sol::default_at_panic};
+#else
+  return sol::state{sol::default_at_panic, &LuaAllocator::allocate,
+                    &allocator};
+#endif
+}
+
+auto sbot::core::lua_compat::openLibraries(sol::state &lua) -> void {
+  lua.open_libraries(sol::lib::base, sol::lib::string, sol::lib::math,
+                     sol::lib::table, sol::lib::utf8);
+#if SBOT_LUAJIT
+  // sol skips utf8 on LuaJIT, and Lua 5.1 has unpack as a global only
+  installUtf8(lua);
+  sol::table table = lua["table"];
+  if (!table["unpack"].valid()) {
+    table["unpack"] = lua["unpack"];
+  }
+  int mode = LUAJIT_MODE_ENGINE |
+             (SBOT_LUAJIT_COMPILE ? LUAJIT_MODE_ON : LUAJIT_MODE_OFF);
+  if (luaJIT_setmode(lua.lua_state(), 0, mode) == 0) {
+    LOG_WARN("Could not switch the LuaJIT compiler {}",
+             SBOT_LUAJIT_COMPILE ? "on" : "off");
+  }
+#endif
+}
+
+auto sbot::core::lua_compat::pauseCollector(sol::state &lua) -> void {
+#if !SBOT_LUAJIT
+  // Zeros keep the default pause, step multiplier and step size
+  lua_gc(lua.lua_state(), LUA_GCINC, 0, 0, 0);
+#endif
+  lua_gc(lua.lua_state(), LUA_GCSTOP, 0);
+}
+
+auto sbot::core::lua_compat::stepCollector(sol::state &lua, int kilobytes)
+    -> bool {
+  bool finished = lua_gc(lua.lua_state(), LUA_GCSTEP, kilobytes) == 1;
+  // Finishing a cycle restarts LuaJIT's automatic collector
+  lua_gc(lua.lua_state(), LUA_GCSTOP, 0);
+  return finished;
+}
+
+auto sbot::core::lua_compat::heapBytes(sol::state &lua) -> std::size_t {
+  auto kilobytes = lua_gc(lua.lua_state(), LUA_GCCOUNT, 0);
+  auto bytes     = lua_gc(lua.lua_state(), LUA_GCCOUNTB, 0);
+  return (static_cast<std::size_t>(kilobytes) << 10U) +
+         static_cast<std::size_t>(bytes);
+}
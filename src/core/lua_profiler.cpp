@@ -0,0 +1,232 @@
+#include "seraphbot/core/lua_profiler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <lua.hpp>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "seraphbot/core/logging.hpp"
+
+namespace {
+// Stands in for the function when a sample finds no Lua frame, as when a
+// scope ends after its call has returned
+constexpr std::string_view c_unattributed{"(unattributed)"};
+
+// ';' separates frames in the folded format and a space ends the stack
+auto appendEscaped(std::string &stack, std::string_view text) -> void {
+  for (char chr : text) {
+    stack += chr == ';' || chr == '\n' ? ':' : chr;
+  }
+}
+
+// Appends "name (file:line)", or "name [C]" for natives, without building
+// the name on its own first
+auto appendFrame(std::string &stack, lua_State *lua, int level) -> void {
+  stack += ';';
+  lua_Debug debug{};
+  if (lua_getstack(lua, level, &debug) == 0 ||
+      lua_getinfo(lua, "Sn", &debug) == 0) {
+    stack += '?';
+    return;
+  }
+  if (std::strcmp(debug.what, "main") == 0) {
+    stack += "main chunk";
+  } else {
+    appendEscaped(stack, debug.name != nullptr ? debug.name : "?");
+    if (std::strcmp(debug.what, "C") == 0) {
+      stack += " [C]";
+      return;
+    }
+  }
+  stack += " (";
+  appendEscaped(stack, debug.short_src);
+  stack += ':';
+  std::array<char, 16> line{};
+  auto written =
+      std::to_chars(line.data(), line.data() + line.size(), debug.linedefined);
+  stack.append(line.data(), written.ptr);
+  stack += ')';
+}
+
+// Splits a folded stack into its frames, command first
+auto splitStack(std::string_view stack) -> std::vector<std::string_view> {
+  std::vector<std::string_view> frames;
+  while (true) {
+    std::size_t semicolon = stack.find(';');
+    frames.push_back(stack.substr(0, semicolon));
+    if (semicolon == std::string_view::npos) {
+      return frames;
+    }
+    stack.remove_prefix(semicolon + 1);
+  }
+}
+} // namespace
+
+sbot::core::LuaProfiler::LuaProfiler() {
+  LOG_CONTEXT("LuaProfiler");
+  LOG_INFO("Initializing");
+}
+
+sbot::core::LuaProfiler::~LuaProfiler() {
+  LOG_CONTEXT("LuaProfiler");
+  LOG_INFO("Shutting down");
+}
+
+auto sbot::core::LuaProfiler::setEnabled(bool enabled) -> void {
+  if (m_enabled.exchange(enabled, std::memory_order_relaxed) != enabled) {
+    LOG_INFO("Lua profiler {}", enabled ? "enabled" : "disabled");
+  }
+}
+
+auto sbot::core::LuaProfiler::sample(lua_State *lua, std::string_view command,
+                                     std::chrono::nanoseconds elapsed) noexcept
+    -> void {
+  try {
+    // Reused so a sample only allocates when the stack is deeper than any
+    // seen on this thread before
+    thread_local std::string stack;
+    stack.assign(command);
+
+    // Level 0 is the function the hook interrupted; the key wants the
+    // outermost frame first, so find the depth before naming anything
+    lua_Debug debug{};
+    int depth{0};
+    while (depth <= static_cast<int>(c_max_depth) &&
+           lua_getstack(lua, depth, &debug) != 0) {
+      ++depth;
+    }
+    if (depth > static_cast<int>(c_max_depth)) {
+      // Frames past the limit are folded into one
+      stack += ";...";
+      depth = static_cast<int>(c_max_depth) - 1;
+    }
+    if (depth == 0) {
+      stack += ';';
+      stack += c_unattributed;
+    }
+    for (int level = depth - 1; level >= 0; --level) {
+      appendFrame(stack, lua, level);
+    }
+
+    std::lock_guard lock{m_mutex};
+    auto stack_it = m_stacks.find(stack);
+    if (stack_it == m_stacks.end()) {
+      if (m_stacks.size() >= c_max_stacks) {
+        ++m_dropped;
+        return;
+      }
+      stack_it = m_stacks.emplace(stack, StackTime{}).first;
+    }
+    stack_it->second.time += elapsed;
+    ++stack_it->second.samples;
+    ++m_samples;
+  } catch (const std::exception &) {
+    // Out of memory; losing a sample is fine
+  }
+}
+
+auto sbot::core::LuaProfiler::rows() const -> std::vector<ProfileRow> {
+  // By command, then function
+  std::map<std::pair<std::string_view, std::string_view>, ProfileRow>
+      by_function;
+  std::lock_guard lock{m_mutex};
+  for (const auto &[stack, stack_time] : m_stacks) {
+    auto frames = splitStack(stack);
+    if (frames.size() < 2) {
+      continue;
+    }
+    auto row_for = [&](std::string_view function) -> ProfileRow & {
+      auto &row = by_function[{frames.front(), function}];
+      if (row.command.empty()) {
+        row.command  = frames.front();
+        row.function = function;
+      }
+      return row;
+    };
+    ProfileRow &leaf = row_for(frames.back());
+    leaf.self += stack_time.time;
+    leaf.samples += stack_time.samples;
+    // Recursive functions appear more than once but count once
+    std::unordered_set<std::string_view> seen;
+    for (std::size_t i = 1; i < frames.size(); ++i) {
+      if (seen.insert(frames[i]).second) {
+        row_for(frames[i]).total += stack_time.time;
+      }
+    }
+  }
+
+  std::vector<ProfileRow> result;
+  result.reserve(by_function.size());
+  for (auto &[key, row] : by_function) {
+    result.push_back(std::move(row));
+  }
+  std::ranges::sort(result, [](const ProfileRow &lhs, const ProfileRow &rhs) {
+    return lhs.self > rhs.self;
+  });
+  return result;
+}
+
+auto sbot::core::LuaProfiler::sampleCount() const -> std::uint64_t {
+  std::lock_guard lock{m_mutex};
+  return m_samples;
+}
+
+auto sbot::core::LuaProfiler::droppedCount() const -> std::uint64_t {
+  std::lock_guard lock{m_mutex};
+  return m_dropped;
+}
+
+auto sbot::core::LuaProfiler::reset() -> void {
+  std::lock_guard lock{m_mutex};
+  m_stacks.clear();
+  m_samples = 0;
+  m_dropped = 0;
+}
+
+auto sbot::core::LuaProfiler::writeFolded(std::ostream &out) const -> void {
+  std::lock_guard lock{m_mutex};
+  for (const auto &[stack, stack_time] : m_stacks) {
+    auto micros =
+        std::chrono::duration_cast<std::chrono::microseconds>(stack_time.time);
+    // Flame graphs want whole counts; a stack shorter than that still ran
+    out << stack << ' ' << std::max<std::int64_t>(micros.count(), 1) << '\n';
+  }
+}
+
+auto sbot::core::LuaProfiler::exportFolded(
+    const std::filesystem::path &path) const -> bool {
+  std::error_code err;
+  if (path.has_parent_path()) {
+    std::filesystem::create_directories(path.parent_path(), err);
+  }
+  {
+    std::ofstream file{path, std::ios::trunc};
+    if (!file) {
+      LOG_WARN("Could not open {} for profile export", path.string());
+      return false;
+    }
+    writeFolded(file);
+    if (!file) {
+      LOG_WARN("Failed to write profile to {}", path.string());
+      return false;
+    }
+  }
+  LOG_INFO("Wrote Lua profile to {}", path.string());
+  return true;
+}
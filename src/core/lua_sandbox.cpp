@@ -0,0 +1,80 @@
+#include "seraphbot/core/lua_sandbox.hpp"
+
+#include <lua.hpp>
+#include <sol/error.hpp>
+#include <sol/types.hpp>
+#include <string>
+#include <tuple>
+
+namespace {
+// Registry slot of the sealed globals
+constexpr const char *c_base_key{"sbot.sandbox_base"};
+// What getmetatable() returns for protected values
+constexpr const char *c_protected_metatable{"read-only"};
+
+// An empty table that reads through to `source` and refuses writes;
+// pairs and # still see the source's contents
+auto readOnlyView(sol::state &lua, const sol::table &source,
+                  const std::string &name) -> sol::table {
+  sol::table meta    = lua.create_table();
+  meta["__index"]    = source;
+  meta["__newindex"] = [name](const sol::object & /*view*/,
+                              const sol::object &key,
+                              const sol::object & /*value*/) {
+    std::string field = key.is<std::string>() ? key.as<std::string>() : "?";
+    throw sol::error{name + "." + field + " is read-only"};
+  };
+  sol::object next = lua["next"];
+  meta["__pairs"]  = [next, source](const sol::object & /*view*/) {
+    return std::make_tuple(next, source, sol::lua_nil);
+  };
+  meta["__len"] = [source](const sol::object & /*view*/) {
+    return source.size();
+  };
+  // Keeps scripts from swapping the metatable out
+  meta["__metatable"] = c_protected_metatable;
+
+  sol::table view          = lua.create_table();
+  view[sol::metatable_key] = meta;
+  return view;
+}
+} // namespace
+
+auto sbot::core::lua_sandbox::sealGlobals(sol::state &lua) -> void {
+  sol::table base = lua.create_table();
+  for (const auto &[key, value] : lua.globals()) {
+    if (!key.is<std::string>()) {
+      continue;
+    }
+    auto name = key.as<std::string>();
+    // Every environment is its own _G
+    if (name == "_G") {
+      continue;
+    }
+    if (value.get_type() == sol::type::table) {
+      base[name] = readOnlyView(lua, value.as<sol::table>(), name);
+    } else {
+      base[name] = value;
+    }
+  }
+  lua.registry()[c_base_key] = readOnlyView(lua, base, "_G");
+
+  // Otherwise getmetatable("").__index hands out the string table itself,
+  // and a script could change string methods for every other script
+  lua_State *state = lua.lua_state();
+  lua_pushliteral(state, "");
+  if (lua_getmetatable(state, -1) != 0) {
+    lua_pushstring(state, c_protected_metatable);
+    lua_setfield(state, -2, "__metatable");
+    lua_pop(state, 1);
+  }
+  lua_pop(state, 1);
+}
+
+auto sbot::core::lua_sandbox::makeEnvironment(sol::state &lua)
+    -> sol::environment {
+  sol::table base = lua.registry()[c_base_key];
+  sol::environment env{lua, sol::create, base};
+  env["_G"] = env;
+  return env;
+}
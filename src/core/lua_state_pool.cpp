@@ -0,0 +1,116 @@
+#include "seraphbot/core/lua_state_pool.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+#include "seraphbot/core/logging.hpp"
+
+sbot::core::LuaStatePool::LuaStatePool(std::size_t size,
+                                       std::size_t memory_limit,
+                                       const Setup &setup) {
+  LOG_CONTEXT("LuaStatePool");
+  size = std::max<std::size_t>(1, size);
+  LOG_INFO("Initializing {} Lua states of up to {} MiB", size,
+           memory_limit >> 20);
+  m_states.reserve(size);
+  m_idle.reserve(size);
+  for (std::size_t i = 0; i < size; ++i) {
+    auto state = std::make_unique<PooledState>(memory_limit);
+    setup(state->lua);
+    m_idle.push_back(state.get());
+    m_states.push_back(std::move(state));
+  }
+}
+
+sbot::core::LuaStatePool::~LuaStatePool() {
+  LOG_CONTEXT("LuaStatePool");
+  LOG_INFO("Shutting down");
+}
+
+sbot::core::LuaStatePool::Lease::~Lease() {
+  if (m_pool != nullptr) {
+    m_pool->release(*m_state);
+  }
+}
+
+auto sbot::core::LuaStatePool::acquire() -> Lease {
+  std::unique_lock lock{m_mutex};
+  m_cv.wait(lock, [this] { return !m_idle.empty(); });
+  // Leave states with parked continuations to them when there is a choice
+  auto idle_it = std::ranges::find_if(m_idle, [this](PooledState *state) {
+    return !m_parked.contains(state);
+  });
+  if (idle_it == m_idle.end()) {
+    idle_it = std::prev(m_idle.end());
+  }
+  PooledState *state = *idle_it;
+  m_idle.erase(idle_it);
+  return Lease{*this, *state};
+}
+
+auto sbot::core::LuaStatePool::acquire(PooledState &state) -> Lease {
+  std::unique_lock lock{m_mutex};
+  auto idle_it = m_idle.end();
+  ++m_state_waiters;
+  m_state_cv.wait(lock, [this, &state, &idle_it] {
+    idle_it = std::ranges::find(m_idle, &state);
+    return idle_it != m_idle.end();
+  });
+  --m_state_waiters;
+  m_idle.erase(idle_it);
+  return Lease{*this, state};
+}
+
+auto sbot::core::LuaStatePool::acquireOrPark(PooledState &state,
+                                             std::function<void()> on_free)
+    -> std::optional<Lease> {
+  std::lock_guard lock{m_mutex};
+  auto idle_it = std::ranges::find(m_idle, &state);
+  if (idle_it == m_idle.end()) {
+    m_parked[&state].push_back(std::move(on_free));
+    return std::nullopt;
+  }
+  m_idle.erase(idle_it);
+  return Lease{*this, state};
+}
+
+auto sbot::core::LuaStatePool::tryAcquire(PooledState &state)
+    -> std::optional<Lease> {
+  std::lock_guard lock{m_mutex};
+  auto idle_it = std::ranges::find(m_idle, &state);
+  if (idle_it == m_idle.end()) {
+    return std::nullopt;
+  }
+  m_idle.erase(idle_it);
+  return Lease{*this, state};
+}
+
+auto sbot::core::LuaStatePool::release(PooledState &state) -> void {
+  std::function<void()> on_free;
+  bool state_waiters{false};
+  {
+    std::lock_guard lock{m_mutex};
+    m_idle.push_back(&state);
+    if (auto parked_it = m_parked.find(&state); parked_it != m_parked.end()) {
+      on_free = std::move(parked_it->second.front());
+      parked_it->second.pop_front();
+      if (parked_it->second.empty()) {
+        m_parked.erase(parked_it);
+      }
+    }
+    state_waiters = m_state_waiters > 0;
+  }
+  m_cv.notify_one();
+  if (state_waiters) {
+    // Rare (shutdown), and each checks for its own state
+    m_state_cv.notify_all();
+  }
+  if (on_free) {
+    on_free();
+  }
+}
@@ -1,6 +1,9 @@
 #include "seraphbot/core/miniaudio_player.hpp"
 
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
+#include <optional>
 
 #define MINIAUDIO_IMPLEMENTATION
 #include <miniaudio.h>
@@ -88,6 +91,24 @@ auto sbot::core::MiniaudioPlayer::playSound(
   return true;
 }
 
+auto sbot::core::MiniaudioPlayer::soundLength(
+    const std::filesystem::path &filepath)
+    -> std::optional<std::chrono::milliseconds> {
+  ma_decoder decoder;
+  if (ma_decoder_init_file(filepath.string().c_str(), nullptr, &decoder) !=
+      MA_SUCCESS) {
+    return std::nullopt;
+  }
+  ma_uint64 frames{0};
+  ma_result result = ma_decoder_get_length_in_pcm_frames(&decoder, &frames);
+  std::uint32_t sample_rate = decoder.outputSampleRate;
+  ma_decoder_uninit(&decoder);
+  if (result != MA_SUCCESS || sample_rate == 0) {
+    return std::nullopt;
+  }
+  return std::chrono::milliseconds{frames * 1000 / sample_rate};
+}
+
 auto sbot::core::MiniaudioPlayer::setMasterVolume(int volume) -> void {
   volume = std::clamp(volume, 0, 100);
   m_master_volume = volumeToFloat(volume);
@@ -0,0 +1,73 @@
+#include "seraphbot/core/shared_store.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+
+auto sbot::core::incrementedValue(const StoreValue *current,
+                                  std::int64_t delta) -> std::int64_t {
+  using Limits = std::numeric_limits<std::int64_t>;
+  const auto *held =
+      current != nullptr ? std::get_if<std::int64_t>(current) : nullptr;
+  std::int64_t base = held != nullptr ? *held : 0;
+  if (delta > 0 && base > Limits::max() - delta) {
+    return Limits::max();
+  }
+  if (delta < 0 && base < Limits::min() - delta) {
+    return Limits::min();
+  }
+  return base + delta;
+}
+
+auto sbot::core::SharedStore::get(std::string_view key) const
+    -> std::optional<Value> {
+  std::shared_lock lock{m_mutex};
+  auto it = m_values.find(key);
+  if (it == m_values.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+auto sbot::core::SharedStore::set(std::string_view key, Value value) -> void {
+  std::unique_lock lock{m_mutex};
+  if (auto it = m_values.find(key); it != m_values.end()) {
+    it->second = std::move(value);
+    return;
+  }
+  m_values.emplace(std::string{key}, std::move(value));
+}
+
+auto sbot::core::SharedStore::remove(std::string_view key) -> bool {
+  std::unique_lock lock{m_mutex};
+  auto it = m_values.find(key);
+  if (it == m_values.end()) {
+    return false;
+  }
+  m_values.erase(it);
+  return true;
+}
+
+auto sbot::core::SharedStore::increment(std::string_view key,
+                                        std::int64_t delta) -> std::int64_t {
+  std::unique_lock lock{m_mutex};
+  auto it = m_values.find(key);
+  if (it == m_values.end()) {
+    it = m_values.emplace(std::string{key}, std::int64_t{0}).first;
+  }
+  std::int64_t next = incrementedValue(&it->second, delta);
+  it->second        = next;
+  return next;
+}
+
+auto sbot::core::SharedStore::size() const -> std::size_t {
+  std::shared_lock lock{m_mutex};
+  return m_values.size();
+}
@@ -0,0 +1,49 @@
+#include "seraphbot/core/timer_wheel.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+sbot::core::TimerWheel::TimerWheel(std::size_t slot_count)
+    : m_slots(std::max<std::size_t>(slot_count, 1)) {}
+
+auto sbot::core::TimerWheel::schedule(Key key, std::uint64_t ticks) -> void {
+  cancel(key);
+  ticks = std::max<std::uint64_t>(ticks, 1);
+  // advance() moves the cursor before reading the slot, so a timer `ticks`
+  // away lives that many slots ahead of the cursor
+  std::uint64_t slot_count = m_slots.size();
+  std::size_t slot =
+      static_cast<std::size_t>((m_cursor + ticks) % slot_count);
+  auto &entries = m_slots[slot];
+  entries.push_front({.key = key, .rounds = (ticks - 1) / slot_count});
+  m_index.insert_or_assign(key, Position{slot, entries.begin()});
+}
+
+auto sbot::core::TimerWheel::cancel(Key key) -> bool {
+  auto it = m_index.find(key);
+  if (it == m_index.end()) {
+    return false;
+  }
+  m_slots[it->second.slot].erase(it->second.entry);
+  m_index.erase(it);
+  return true;
+}
+
+auto sbot::core::TimerWheel::advance() -> std::vector<Key> {
+  m_cursor      = (m_cursor + 1) % m_slots.size();
+  auto &entries = m_slots[m_cursor];
+  std::vector<Key> expired;
+  for (auto it = entries.begin(); it != entries.end();) {
+    if (it->rounds > 0) {
+      --it->rounds;
+      ++it;
+      continue;
+    }
+    expired.push_back(it->key);
+    m_index.erase(it->key);
+    it = entries.erase(it);
+  }
+  return expired;
+}
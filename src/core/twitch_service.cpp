@@ -60,12 +60,15 @@ auto sbc::TwitchService::startLogin() -> void {
         try {
           co_await m_auth->loginAsync();
           auto user_info{co_await m_auth->fetchUserInfoAsync()};
-          m_current_user          = user_info.display_name;
+          m_snapshot.update([&user_info](Snapshot &snap) {
+            snap.current_user = user_info.display_name;
+          });
           m_config.access_token   = m_auth->accessToken();
           m_config.broadcaster_id = user_info.id;
           m_config.client_id      = m_auth->clientId();
 
-          setState(State::LoggedIn, "Logged in as " + m_current_user);
+          setState(State::LoggedIn,
+                   "Logged in as " + user_info.display_name);
         } catch (const std::exception &err) {
           LOG_ERROR("Login failed: {}", err.what());
           setState(State::Error, "Login failed: " + std::string(err.what()));
@@ -158,15 +161,20 @@ auto sbc::TwitchService::connectToChat() -> asio::awaitable<void> {
   }
 }
 
-auto sbc::TwitchService::sendMessage(const std::string &message) -> void {
+auto sbc::TwitchService::sendMessage(const std::string &message,
+                                     std::function<void(bool)> on_sent)
+    -> void {
   if (m_state != State::ChatConnected) {
     LOG_WARN("Cannot send message: not connected to chat");
+    if (on_sent) {
+      on_sent(false);
+    }
     return;
   }
 
   asio::co_spawn(
       *m_connection->getIoContext(),
-      [this, message]() -> asio::awaitable<void> {
+      [this, message, on_sent = std::move(on_sent)]() -> asio::awaitable<void> {
         try {
           co_await m_chat_send->message(message, m_config.broadcaster_id);
           LOG_INFO("Sent message: {}", message);
@@ -176,6 +184,13 @@ auto sbc::TwitchService::sendMessage(const std::string &message) -> void {
             m_status_callback("Failed to send message: " +
                               std::string(err.what()));
           }
+          if (on_sent) {
+            on_sent(false);
+          }
+          co_return;
+        }
+        if (on_sent) {
+          on_sent(true);
         }
       },
       asio::detached);
@@ -187,12 +202,13 @@ auto sbc::TwitchService::disconnect() -> void {
   m_chat_read.reset();
   m_chat_send.reset();
   m_eventsub.reset();
-  m_current_user.clear();
+  m_snapshot.update([](Snapshot &snap) { snap.current_user.clear(); });
 }
 
 auto sbc::TwitchService::setState(State state, const std::string &status)
     -> void {
   m_state = state;
+  m_snapshot.update([state](Snapshot &snap) { snap.state = state; });
   LOG_INFO("State: {} - {}", static_cast<int>(state), status);
 
   if (m_status_callback && !status.empty()) {
@@ -230,20 +246,49 @@ auto sbc::TwitchService::handleEventSubMessage(const std::string &msg) -> void {
         return;
       }
       std::string chatter{raw_msg["payload"]["event"]["chatter_user_name"]};
+      std::string chatter_id{
+          raw_msg["payload"]["event"].value("chatter_user_id", "")};
       std::string text{raw_msg["payload"]["event"]["message"]["text"]};
       std::string color{raw_msg["payload"]["event"]["color"]};
       std::vector<std::string> badges;
+      BadgeMask badge_mask{0};
       badges.reserve(raw_msg["payload"]["event"]["badges"].size());
       for (const auto &badge : raw_msg["payload"]["event"]["badges"]) {
         badges.push_back(badge["set_id"].get<std::string>());
+        badge_mask |= badge::bitFor(badges.back());
+      }
+
+      std::vector<ChatFragment> fragments;
+      const auto &message = raw_msg["payload"]["event"]["message"];
+      if (message.contains("fragments") && message["fragments"].is_array()) {
+        bool has_emote{false};
+        fragments.reserve(message["fragments"].size());
+        for (const auto &fragment : message["fragments"]) {
+          ChatFragment frag{.text = fragment.value("text", "")};
+          if (fragment.value("type", "") == "emote" &&
+              fragment.contains("emote") && fragment["emote"].is_object()) {
+            frag.type     = ChatFragment::Type::Emote;
+            frag.emote_id = fragment["emote"].value("id", "");
+            has_emote     = !frag.emote_id.empty() || has_emote;
+          }
+          fragments.push_back(std::move(frag));
+        }
+        // Plain text messages render straight from `text`
+        if (!has_emote) {
+          fragments.clear();
+        }
       }
 
       LOG_INFO("Chat from {}: {}", chatter, text);
 
-      ChatMessage chat_msg{.user   = std::move(chatter),
-                           .text   = std::move(text),
-                           .color  = std::move(color),
-                           .badges = std::move(badges)};
+      ChatMessage chat_msg{.user       = std::move(chatter),
+                           .user_id    = std::move(chatter_id),
+                           .text       = std::move(text),
+                           .color      = std::move(color),
+                           .badges     = std::move(badges),
+                           .badge_mask = badge_mask,
+                           .fragments  = std::move(fragments),
+                           .received   = std::chrono::steady_clock::now()};
       m_message_callback(chat_msg);
     }
     if (type == "channel.ad_break.begin" && m_message_callback) {
@@ -151,8 +151,9 @@ auto sbot::discord::Notifications::sendMessage(std::string message)
 
   LOG_INFO("Payload dump: {}", payload.dump());
   try {
-    std::string resp = co_await tw::httpsPostAsync(
-        m_connection, "discord.com", "443", m_webhook_url, payload.dump(), {});
+    std::string webhook_url = m_webhook_url.get();
+    std::string resp        = co_await tw::httpsPostAsync(
+        m_connection, "discord.com", "443", webhook_url, payload.dump(), {});
 
     LOG_INFO("Discord notification sent successfully: : {}", resp);
   } catch (const std::exception &err) {
@@ -0,0 +1,289 @@
+#include "seraphbot/ui/emote_cache.hpp"
+
+#include <algorithm>
+#include <boost/asio/post.hpp>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <png.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "seraphbot/core/logging.hpp"
+#include "seraphbot/ui/emote_fetcher.hpp"
+#include "seraphbot/ui/imgui_backend.hpp"
+
+namespace {
+namespace asio = boost::asio;
+
+constexpr int c_cells_per_row{sbot::ui::EmoteCache::c_atlas_size /
+                              sbot::ui::EmoteCache::c_cell_size};
+constexpr int c_cell_count{c_cells_per_row * c_cells_per_row};
+constexpr std::size_t c_channels{4};
+
+// Nearest-neighbour shrink so oversized emotes still fit in one atlas cell
+auto fitToCell(std::vector<unsigned char> pixels, int &width, int &height)
+    -> std::vector<unsigned char> {
+  constexpr int c_cell{sbot::ui::EmoteCache::c_cell_size};
+  if (width <= c_cell && height <= c_cell) {
+    return pixels;
+  }
+  float scale =
+      std::min(static_cast<float>(c_cell) / static_cast<float>(width),
+               static_cast<float>(c_cell) / static_cast<float>(height));
+  int out_w = std::max(1, static_cast<int>(static_cast<float>(width) * scale));
+  int out_h = std::max(1, static_cast<int>(static_cast<float>(height) * scale));
+
+  std::vector<unsigned char> out(static_cast<std::size_t>(out_w) *
+                                 static_cast<std::size_t>(out_h) * c_channels);
+  for (int y = 0; y < out_h; ++y) {
+    int src_y = std::min(height - 1, static_cast<int>(y / scale));
+    for (int x = 0; x < out_w; ++x) {
+      int src_x = std::min(width - 1, static_cast<int>(x / scale));
+      auto src  = (static_cast<std::size_t>(src_y) * static_cast<std::size_t>(width) +
+                  static_cast<std::size_t>(src_x)) *
+                 c_channels;
+      auto dst = (static_cast<std::size_t>(y) * static_cast<std::size_t>(out_w) +
+                  static_cast<std::size_t>(x)) *
+                 c_channels;
+      std::copy_n(pixels.begin() + static_cast<std::ptrdiff_t>(src),
+                  c_channels, out.begin() + static_cast<std::ptrdiff_t>(dst));
+    }
+  }
+  width  = out_w;
+  height = out_h;
+  return out;
+}
+} // namespace
+
+sbot::ui::EmoteCache::EmoteCache(ImGuiBackend &backend,
+                                 std::unique_ptr<EmoteFetcher> fetcher)
+    : m_backend{backend}, m_fetcher{std::move(fetcher)} {
+  LOG_CONTEXT("EmoteCache");
+  LOG_INFO("Initializing");
+  m_free_slots.reserve(c_cell_count);
+  // Hand out low slots first
+  for (int slot = c_cell_count - 1; slot >= 0; --slot) {
+    m_free_slots.push_back(slot);
+  }
+}
+
+sbot::ui::EmoteCache::~EmoteCache() {
+  LOG_CONTEXT("EmoteCache");
+  LOG_INFO("Shutting down");
+  m_stopping = true;
+  // Workers waiting on a download return as soon as it is cancelled
+  m_fetcher->cancel();
+  m_workers.stop();
+  m_workers.join();
+  releaseTexture();
+}
+
+auto sbot::ui::EmoteCache::releaseTexture() -> void {
+  if (m_has_atlas) {
+    m_backend.destroyTexture(m_atlas);
+    m_has_atlas = false;
+  }
+  // Resident entries point into the released texture; start over
+  for (auto it = m_entries.begin(); it != m_entries.end();) {
+    if (it->second.status == Status::Resident) {
+      m_free_slots.push_back(it->second.slot);
+      it = m_entries.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  m_lru.clear();
+}
+
+auto sbot::ui::EmoteCache::lookup(const std::string &emote_id)
+    -> std::optional<EmoteSprite> {
+  auto it = m_entries.find(emote_id);
+  if (it != m_entries.end()) {
+    Entry &entry = it->second;
+    if (entry.status == Status::Failed &&
+        m_requests.size() < c_max_queued_requests &&
+        std::chrono::steady_clock::now() >= entry.retry_at) {
+      entry.status = Status::Queued;
+      m_requests.push_back(emote_id);
+    }
+    if (entry.status != Status::Resident) {
+      return std::nullopt;
+    }
+    entry.last_used_frame = m_frame;
+    m_lru.splice(m_lru.begin(), m_lru, entry.lru_pos);
+    return spriteFor(entry);
+  }
+
+  // During an emote flood just fall back to text until the queue drains
+  if (m_requests.size() >= c_max_queued_requests ||
+      !EmoteFetcher::isValidEmoteId(emote_id)) {
+    return std::nullopt;
+  }
+  m_entries.emplace(emote_id, Entry{});
+  m_requests.push_back(emote_id);
+  return std::nullopt;
+}
+
+auto sbot::ui::EmoteCache::processUploads() -> void {
+  ++m_frame;
+
+  std::vector<DecodedEmote> batch;
+  {
+    std::lock_guard lock{m_decoded_mutex};
+    while (!m_decoded.empty() && batch.size() < c_max_uploads_per_frame) {
+      batch.push_back(std::move(m_decoded.front()));
+      m_decoded.pop_front();
+    }
+  }
+
+  for (std::size_t i = 0; i < batch.size(); ++i) {
+    DecodedEmote &decoded = batch[i];
+    auto it               = m_entries.find(decoded.emote_id);
+    if (it == m_entries.end()) {
+      --m_in_flight;
+      continue;
+    }
+    Entry &entry = it->second;
+    if (decoded.pixels.empty()) {
+      // Usually the network; a bad image just fails again, less often
+      auto delay = std::min<std::chrono::steady_clock::duration>(
+          c_retry_delay * (1LL << std::min(entry.failures, 6)),
+          c_max_retry_delay);
+      entry.status   = Status::Failed;
+      entry.retry_at = std::chrono::steady_clock::now() + delay;
+      ++entry.failures;
+      --m_in_flight;
+      continue;
+    }
+
+    int slot = acquireSlot();
+    if (slot < 0) {
+      // Every cell was drawn last frame; retry these next frame
+      std::lock_guard lock{m_decoded_mutex};
+      for (std::size_t j = batch.size(); j > i; --j) {
+        m_decoded.push_front(std::move(batch[j - 1]));
+      }
+      break;
+    }
+    if (!m_has_atlas) {
+      m_atlas     = m_backend.createTexture(c_atlas_size, c_atlas_size);
+      m_has_atlas = true;
+    }
+
+    int cell_x = (slot % c_cells_per_row) * c_cell_size;
+    int cell_y = (slot / c_cells_per_row) * c_cell_size;
+    m_backend.updateTexture(m_atlas, cell_x, cell_y, decoded.width,
+                            decoded.height, decoded.pixels.data());
+
+    entry.status          = Status::Resident;
+    entry.failures        = 0;
+    entry.slot            = slot;
+    entry.width           = decoded.width;
+    entry.height          = decoded.height;
+    entry.last_used_frame = m_frame;
+    m_lru.push_front(decoded.emote_id);
+    entry.lru_pos = m_lru.begin();
+    --m_in_flight;
+  }
+
+  dispatchRequests();
+}
+
+auto sbot::ui::EmoteCache::dispatchRequests() -> void {
+  while (m_in_flight < c_max_in_flight && !m_requests.empty()) {
+    std::string emote_id = std::move(m_requests.front());
+    m_requests.pop_front();
+
+    auto it = m_entries.find(emote_id);
+    if (it == m_entries.end() || it->second.status != Status::Queued) {
+      continue;
+    }
+    it->second.status = Status::Decoding;
+    ++m_in_flight;
+
+    asio::post(m_workers, [this, emote_id = std::move(emote_id)] {
+      if (m_stopping) {
+        return;
+      }
+      DecodedEmote decoded = decode(emote_id);
+      std::lock_guard lock{m_decoded_mutex};
+      m_decoded.push_back(std::move(decoded));
+    });
+  }
+}
+
+auto sbot::ui::EmoteCache::decode(const std::string &emote_id)
+    -> DecodedEmote {
+  DecodedEmote decoded;
+  decoded.emote_id = emote_id;
+  try {
+    auto bytes = m_fetcher->fetch(emote_id);
+    if (!bytes) {
+      return decoded;
+    }
+
+    png_image image{};
+    image.version = PNG_IMAGE_VERSION;
+    if (png_image_begin_read_from_memory(&image, bytes->data(),
+                                         bytes->size()) == 0) {
+      LOG_WARN("Failed to read emote {}: {}", emote_id, image.message);
+      return decoded;
+    }
+    image.format = PNG_FORMAT_RGBA;
+    std::vector<unsigned char> pixels(PNG_IMAGE_SIZE(image));
+    if (png_image_finish_read(&image, nullptr, pixels.data(), 0, nullptr) ==
+        0) {
+      LOG_WARN("Failed to decode emote {}: {}", emote_id, image.message);
+      png_image_free(&image);
+      return decoded;
+    }
+
+    int width      = static_cast<int>(image.width);
+    int height     = static_cast<int>(image.height);
+    decoded.pixels = fitToCell(std::move(pixels), width, height);
+    decoded.width  = width;
+    decoded.height = height;
+  } catch (const std::exception &err) {
+    LOG_ERROR("Error decoding emote {}: {}", emote_id, err.what());
+    decoded.pixels.clear();
+  }
+  return decoded;
+}
+
+auto sbot::ui::EmoteCache::acquireSlot() -> int {
+  if (!m_free_slots.empty()) {
+    int slot = m_free_slots.back();
+    m_free_slots.pop_back();
+    return slot;
+  }
+  if (m_lru.empty()) {
+    return -1;
+  }
+  auto victim = m_entries.find(m_lru.back());
+  // Never evict something that is still on screen
+  if (victim == m_entries.end() ||
+      victim->second.last_used_frame + 1 >= m_frame) {
+    return -1;
+  }
+  int slot = victim->second.slot;
+  m_lru.pop_back();
+  m_entries.erase(victim);
+  return slot;
+}
+
+auto sbot::ui::EmoteCache::spriteFor(const Entry &entry) const -> EmoteSprite {
+  constexpr auto c_atlas = static_cast<float>(c_atlas_size);
+  auto cell_x = static_cast<float>((entry.slot % c_cells_per_row) * c_cell_size);
+  auto cell_y = static_cast<float>((entry.slot / c_cells_per_row) * c_cell_size);
+  auto width  = static_cast<float>(entry.width);
+  auto height = static_cast<float>(entry.height);
+  return {.texture = m_atlas,
+          .uv0     = ImVec2(cell_x / c_atlas, cell_y / c_atlas),
+          .uv1 = ImVec2((cell_x + width) / c_atlas, (cell_y + height) / c_atlas),
+          .size = ImVec2(width, height)};
+}
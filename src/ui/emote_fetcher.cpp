@@ -0,0 +1,240 @@
+#include "seraphbot/ui/emote_fetcher.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/asio/bind_cancellation_slot.hpp>
+#include <boost/asio/cancellation_signal.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/system/error_code.hpp>
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "seraphbot/core/connection_manager.hpp"
+#include "seraphbot/core/logging.hpp"
+#include "seraphbot/tw/config.hpp"
+
+namespace {
+namespace asio = boost::asio;
+
+constexpr std::size_t c_max_emote_id_length{64};
+// A download is aborted after this
+constexpr std::chrono::seconds c_fetch_timeout{10};
+constexpr std::array<unsigned char, 8> c_png_signature{0x89, 'P',  'N',  'G',
+                                                       '\r', '\n', 0x1A, '\n'};
+
+auto isPng(const std::vector<unsigned char> &bytes) -> bool {
+  return bytes.size() > c_png_signature.size() &&
+         std::equal(c_png_signature.begin(), c_png_signature.end(),
+                    bytes.begin());
+}
+} // namespace
+
+auto sbot::ui::EmoteFetcher::isValidEmoteId(const std::string &emote_id)
+    -> bool {
+  return !emote_id.empty() && emote_id.size() <= c_max_emote_id_length &&
+         std::ranges::all_of(emote_id, [](unsigned char chr) {
+           return std::isalnum(chr) != 0 || chr == '_';
+         });
+}
+
+sbot::ui::DirectoryEmoteFetcher::DirectoryEmoteFetcher(
+    std::filesystem::path directory)
+    : m_directory{std::move(directory)} {}
+
+auto sbot::ui::DirectoryEmoteFetcher::fetch(const std::string &emote_id)
+    -> std::optional<std::vector<unsigned char>> {
+  if (!isValidEmoteId(emote_id)) {
+    return std::nullopt;
+  }
+  std::ifstream file{m_directory / (emote_id + ".png"), std::ios::binary};
+  if (!file) {
+    return std::nullopt;
+  }
+  std::vector<unsigned char> bytes{std::istreambuf_iterator<char>{file},
+                                   std::istreambuf_iterator<char>{}};
+  if (!isPng(bytes)) {
+    LOG_WARN("Emote file for {} is not a PNG image", emote_id);
+    return std::nullopt;
+  }
+  return bytes;
+}
+
+// Everything but `settled` and `body` is only touched on `strand`
+struct sbot::ui::CdnEmoteFetcher::Download {
+  explicit Download(asio::io_context &io_context)
+      : strand{asio::make_strand(io_context)}, timer{strand} {}
+
+  // The download, its timeout or cancel(), whichever comes first; false
+  // for the others
+  auto settle(std::optional<std::string> result) -> bool {
+    if (settled.exchange(true)) {
+      return false;
+    }
+    body.set_value(std::move(result));
+    return true;
+  }
+
+  asio::strand<asio::io_context::executor_type> strand;
+  asio::steady_timer timer;
+  asio::cancellation_signal signal;
+  std::atomic<bool> settled{false};
+  std::promise<std::optional<std::string>> body;
+};
+
+sbot::ui::CdnEmoteFetcher::CdnEmoteFetcher(
+    std::shared_ptr<core::ConnectionManager> connection, std::string host,
+    std::string port)
+    : m_connection{std::move(connection)}, m_host{std::move(host)},
+      m_port{std::move(port)} {}
+
+auto sbot::ui::CdnEmoteFetcher::fetch(const std::string &emote_id)
+    -> std::optional<std::vector<unsigned char>> {
+  if (!isValidEmoteId(emote_id)) {
+    return std::nullopt;
+  }
+  std::string target = "/emoticons/v2/" + emote_id + "/static/dark/1.0";
+  auto download = std::make_shared<Download>(*m_connection->getIoContext());
+  auto result   = download->body.get_future();
+  {
+    std::lock_guard lock{m_mutex};
+    if (m_cancelled) {
+      return std::nullopt;
+    }
+    m_downloads.insert(download);
+  }
+
+  // The handlers own the download, so it may outlive this fetcher
+  asio::post(download->strand, [download, emote_id] {
+    download->timer.expires_after(c_fetch_timeout);
+    download->timer.async_wait(
+        [download, emote_id](const boost::system::error_code &err) {
+          if (!err && download->settle(std::nullopt)) {
+            LOG_WARN("Timed out downloading emote {}", emote_id);
+            download->signal.emit(asio::cancellation_type::terminal);
+          }
+        });
+  });
+  asio::co_spawn(
+      download->strand,
+      tw::httpsGetAsync(m_connection, m_host, m_port, std::move(target)),
+      asio::bind_cancellation_slot(
+          download->signal.slot(),
+          [download, emote_id](const std::exception_ptr &err,
+                               std::string body) {
+            download->timer.cancel();
+            if (!err) {
+              download->settle(std::move(body));
+              return;
+            }
+            // Already settled when it timed out or was cancelled
+            if (download->settle(std::nullopt)) {
+              try {
+                std::rethrow_exception(err);
+              } catch (const std::exception &ex) {
+                LOG_WARN("Failed to download emote {}: {}", emote_id,
+                         ex.what());
+              } catch (...) {
+                LOG_WARN("Failed to download emote {}", emote_id);
+              }
+            }
+          }));
+
+  // Workers are not I/O threads, so blocking here is fine; cancel() wakes
+  // us even if the io_context has stopped
+  std::optional<std::string> body = result.get();
+  {
+    std::lock_guard lock{m_mutex};
+    m_downloads.erase(download);
+  }
+  if (!body) {
+    return std::nullopt;
+  }
+  std::vector<unsigned char> bytes{body->begin(), body->end()};
+  if (!isPng(bytes)) {
+    LOG_WARN("CDN returned no PNG for emote {}", emote_id);
+    return std::nullopt;
+  }
+  return bytes;
+}
+
+auto sbot::ui::CdnEmoteFetcher::cancel() -> void {
+  std::lock_guard lock{m_mutex};
+  m_cancelled = true;
+  for (const auto &download : m_downloads) {
+    download->settle(std::nullopt);
+    asio::post(download->strand, [download] {
+      download->signal.emit(asio::cancellation_type::terminal);
+    });
+  }
+}
+
+sbot::ui::DiskCachedEmoteFetcher::DiskCachedEmoteFetcher(
+    std::filesystem::path cache_directory,
+    std::unique_ptr<EmoteFetcher> upstream)
+    : m_cache{cache_directory}, m_cache_directory{std::move(cache_directory)},
+      m_upstream{std::move(upstream)} {
+  std::error_code err;
+  std::filesystem::create_directories(m_cache_directory, err);
+  if (err) {
+    LOG_WARN("Could not create emote cache {}: {}", m_cache_directory.string(),
+             err.message());
+  }
+}
+
+auto sbot::ui::DiskCachedEmoteFetcher::cancel() -> void {
+  if (m_upstream) {
+    m_upstream->cancel();
+  }
+}
+
+auto sbot::ui::DiskCachedEmoteFetcher::fetch(const std::string &emote_id)
+    -> std::optional<std::vector<unsigned char>> {
+  if (auto cached = m_cache.fetch(emote_id)) {
+    return cached;
+  }
+  if (!m_upstream) {
+    return std::nullopt;
+  }
+  auto bytes = m_upstream->fetch(emote_id);
+  if (!bytes) {
+    return std::nullopt;
+  }
+
+  // Write to a temporary name first so a crash never leaves a torn image
+  auto final_path = m_cache_directory / (emote_id + ".png");
+  auto temp_path  = m_cache_directory / (emote_id + ".png.tmp");
+  {
+    std::ofstream file{temp_path, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<const char *>(bytes->data()),
+               static_cast<std::streamsize>(bytes->size()));
+    if (!file) {
+      LOG_WARN("Failed to write emote {} to disk cache", emote_id);
+      return bytes;
+    }
+  }
+  std::error_code err;
+  std::filesystem::rename(temp_path, final_path, err);
+  if (err) {
+    LOG_WARN("Failed to store emote {} in disk cache: {}", emote_id,
+             err.message());
+  }
+  return bytes;
+}
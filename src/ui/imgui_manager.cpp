@@ -6,6 +6,8 @@
 #include <backends/imgui_impl_opengl3.h>
 #include <boost/asio/co_spawn.hpp>
 #include <boost/asio/detached.hpp>
+#include <chrono>
+#include <cstdint>
 #include <imgui.h>
 #include <memory>
 #include <stdexcept>
@@ -20,6 +22,8 @@
 #include "seraphbot/viewmodels/auth_viewmodel.hpp"
 #include "seraphbot/viewmodels/chat_viewmodel.hpp"
 #include "seraphbot/viewmodels/discord_viewmodel.hpp"
+#include "seraphbot/viewmodels/metrics_viewmodel.hpp"
+#include "seraphbot/viewmodels/profiler_viewmodel.hpp"
 
 sbot::ui::ImGuiManager::ImGuiManager(std::unique_ptr<ImGuiBackend> backend,
                                      core::AppState &appstate)
@@ -27,7 +31,9 @@ sbot::ui::ImGuiManager::ImGuiManager(std::unique_ptr<ImGuiBackend> backend,
       m_message_input(256, '\0') {
   LOG_CONTEXT("ImGuiManager");
   LOG_INFO("Initializing");
-  initWindow();
+  if (m_backend->needsWindow()) {
+    initWindow();
+  }
   IMGUI_CHECKVERSION();
   m_context   = ImGui::CreateContext();
   ImGuiIO &io = ImGui::GetIO();
@@ -48,6 +54,8 @@ sbot::ui::ImGuiManager::ImGuiManager(std::unique_ptr<ImGuiBackend> backend,
 sbot::ui::ImGuiManager::~ImGuiManager() {
   LOG_CONTEXT("ImGuiManager");
   LOG_INFO("Shutting down");
+  // The atlas texture has to go before the renderer backend
+  m_emote_cache.reset();
   if (m_backend) {
     m_backend->shutdown();
     m_backend.reset();
@@ -59,31 +67,44 @@ sbot::ui::ImGuiManager::~ImGuiManager() {
   if (m_window) {
     glfwDestroyWindow(m_window);
     m_window = nullptr;
+    glfwTerminate();
   }
-  glfwTerminate();
 }
 
 void sbot::ui::ImGuiManager::beginFrame() {
   m_backend->newFrame();
+  if (m_emote_cache) {
+    m_emote_cache->processUploads();
+  }
   ImGui::NewFrame();
 }
 
+auto sbot::ui::ImGuiManager::enableEmotes(std::unique_ptr<EmoteFetcher> fetcher)
+    -> void {
+  m_emote_cache = std::make_unique<EmoteCache>(*m_backend, std::move(fetcher));
+}
+
 void sbot::ui::ImGuiManager::endFrame() { ImGui::Render(); }
 
 void sbot::ui::ImGuiManager::render() { m_backend->renderDrawData(); }
 
 void sbot::ui::ImGuiManager::poll() {
+  if (m_window == nullptr) {
+    return;
+  }
   glfwPollEvents();
   glClearColor(0.1F, 0.1F, 0.1F, 1.0F);
   glClear(GL_COLOR_BUFFER_BIT);
 }
 
 auto sbot::ui::ImGuiManager::shouldClose() -> bool {
-  return glfwWindowShouldClose(m_window) != 0;
+  return m_window != nullptr && glfwWindowShouldClose(m_window) != 0;
 }
 
 auto sbot::ui::ImGuiManager::swapBuffers() -> void {
-  glfwSwapBuffers(m_window);
+  if (m_window != nullptr) {
+    glfwSwapBuffers(m_window);
+  }
 }
 
 auto sbot::ui::ImGuiManager::initWindow(int width, int height) -> void {
@@ -174,7 +195,7 @@ auto sbot::ui::ImGuiManager::manageDocking() -> void {
     if (ImGui::BeginMenu("File")) {
       // if (ImGui::MenuItem("Settings", nullptr, &show_settings_)) {}
       ImGui::Separator();
-      if (ImGui::MenuItem("Exit")) {
+      if (ImGui::MenuItem("Exit") && m_window != nullptr) {
         glfwSetWindowShouldClose(m_window, GLFW_TRUE);
       }
       ImGui::EndMenu();
@@ -257,6 +278,7 @@ auto sbot::ui::ImGuiManager::manageChat(sbot::viewmodels::ChatVM &chat_vm)
     -> void {
   // Chat UI
   ImGui::Begin("Chat");
+  chat_vm.syncFrom();
   if (chat_vm.canSendMessages()) {
     // Process any pending messages
     state.processPendingMessages();
@@ -268,7 +290,11 @@ auto sbot::ui::ImGuiManager::manageChat(sbot::viewmodels::ChatVM &chat_vm)
     for (auto &msg : state.chat_log) {
       ImGui::TextColored(hexToImVec4(msg.color), "%s: ", msg.user.c_str());
       ImGui::SameLine();
-      ImGui::TextWrapped(msg.text.c_str());
+      if (m_emote_cache && !msg.fragments.empty()) {
+        drawFragments(msg);
+      } else {
+        ImGui::TextWrapped(msg.text.c_str());
+      }
     }
     ImGui::PopTextWrapPos();
     if (ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) {
@@ -300,6 +326,31 @@ auto sbot::ui::ImGuiManager::manageChat(sbot::viewmodels::ChatVM &chat_vm)
   ImGui::End();
 }
 
+auto sbot::ui::ImGuiManager::drawFragments(const core::ChatMessage &msg)
+    -> void {
+  const float line_height = ImGui::GetTextLineHeight();
+  bool first{true};
+  for (const auto &fragment : msg.fragments) {
+    if (!first) {
+      ImGui::SameLine(0.0F, 0.0F);
+    }
+    first = false;
+
+    if (fragment.type == core::ChatFragment::Type::Emote) {
+      if (auto sprite = m_emote_cache->lookup(fragment.emote_id)) {
+        float scale = line_height / sprite->size.y;
+        ImGui::Image(sprite->texture,
+                     ImVec2(sprite->size.x * scale, line_height), sprite->uv0,
+                     sprite->uv1);
+        continue;
+      }
+    }
+    // Text fragments, and emotes that are not resident yet
+    ImGui::TextUnformatted(fragment.text.data(),
+                           fragment.text.data() + fragment.text.size());
+  }
+}
+
 auto sbot::ui::ImGuiManager::manageDiscord(
     sbot::viewmodels::DiscordVM &discord_vm) -> void {
   ImGui::Begin("Discord Settings");
@@ -312,7 +363,8 @@ auto sbot::ui::ImGuiManager::manageDiscord(
     discord_vm.syncTo(discord_vm.webhook_url);
   }
   ImGui::SameLine();
-  ImGui::Text(discord_vm.syncFrom().c_str());
+  discord_vm.syncFrom();
+  ImGui::TextUnformatted(discord_vm.applied_webhook_url.c_str());
   ImGui::InputText("##notification_message", discord_vm.notification_text,
                    sizeof(discord_vm.notification_text));
   ImGui::SameLine();
@@ -321,3 +373,111 @@ auto sbot::ui::ImGuiManager::manageDiscord(
   }
   ImGui::End();
 }
+
+auto sbot::ui::ImGuiManager::manageMetrics(
+    sbot::viewmodels::MetricsVM &metrics_vm) -> void {
+  ImGui::Begin("Command Stats");
+  metrics_vm.syncFrom();
+  if (!metrics_vm.heap_rows.empty() && ImGui::CollapsingHeader("Lua heap")) {
+    for (const auto &row : metrics_vm.heap_rows) {
+      ImGui::Text("%-32s %10.1f KiB", row.file.c_str(),
+                  static_cast<double>(row.live_bytes) / 1024.0);
+    }
+  }
+  if (metrics_vm.rows.empty()) {
+    ImGui::TextUnformatted("No commands run yet");
+    ImGui::End();
+    return;
+  }
+  auto millis = [](std::chrono::microseconds value) {
+    return static_cast<double>(value.count()) / 1000.0;
+  };
+  ImGui::Text("Queue wait p50 %.2f ms p99 %.2f ms, run p50 %.2f ms p99 "
+              "%.2f ms",
+              millis(metrics_vm.wait_p50), millis(metrics_vm.wait_p99),
+              millis(metrics_vm.run_p50), millis(metrics_vm.run_p99));
+  constexpr ImGuiTableFlags c_table_flags =
+      ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg |
+      ImGuiTableFlags_ScrollY | ImGuiTableFlags_SizingStretchProp;
+  if (ImGui::BeginTable("##command_stats", 9, c_table_flags)) {
+    ImGui::TableSetupScrollFreeze(0, 1);
+    for (const char *header :
+         {"Command", "Runs", "Denied", "Cooldown", "Errors", "Dropped",
+          "Run p50 (ms)", "Run p99 (ms)", "Reply p99 (ms)"}) {
+      ImGui::TableSetupColumn(header);
+    }
+    ImGui::TableHeadersRow();
+    for (const auto &row : metrics_vm.rows) {
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(row.name.c_str());
+      for (std::uint64_t count :
+           {row.invocations, row.permission_denied, row.cooldown_rejected,
+            row.errors, row.shed}) {
+        ImGui::TableNextColumn();
+        ImGui::Text("%llu", static_cast<unsigned long long>(count));
+      }
+      for (auto latency : {row.execute_p50, row.execute_p99, row.reply_p99}) {
+        ImGui::TableNextColumn();
+        ImGui::Text("%.2f", millis(latency));
+      }
+    }
+    ImGui::EndTable();
+  }
+  ImGui::End();
+}
+
+auto sbot::ui::ImGuiManager::manageProfiler(
+    sbot::viewmodels::ProfilerVM &profiler_vm) -> void {
+  ImGui::Begin("Lua Profiler");
+  profiler_vm.syncFrom();
+  if (ImGui::Checkbox("Sample commands", &profiler_vm.enabled)) {
+    profiler_vm.setEnabled(profiler_vm.enabled);
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Reset")) {
+    profiler_vm.reset();
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Export flame graph")) {
+    profiler_vm.exportFolded();
+  }
+  ImGui::Text("%llu samples, %llu dropped, folded stacks go to %s",
+              static_cast<unsigned long long>(profiler_vm.samples),
+              static_cast<unsigned long long>(profiler_vm.dropped),
+              sbot::viewmodels::ProfilerVM::c_export_path);
+  if (profiler_vm.rows.empty()) {
+    ImGui::TextUnformatted("No samples yet");
+    ImGui::End();
+    return;
+  }
+  auto millis = [](std::chrono::nanoseconds value) {
+    return static_cast<double>(value.count()) / 1'000'000.0;
+  };
+  constexpr ImGuiTableFlags c_table_flags =
+      ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg |
+      ImGuiTableFlags_ScrollY | ImGuiTableFlags_SizingStretchProp;
+  if (ImGui::BeginTable("##lua_profile", 5, c_table_flags)) {
+    ImGui::TableSetupScrollFreeze(0, 1);
+    for (const char *header :
+         {"Command", "Function", "Self (ms)", "Total (ms)", "Samples"}) {
+      ImGui::TableSetupColumn(header);
+    }
+    ImGui::TableHeadersRow();
+    for (const auto &row : profiler_vm.rows) {
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(row.command.c_str());
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(row.function.c_str());
+      ImGui::TableNextColumn();
+      ImGui::Text("%.2f", millis(row.self));
+      ImGui::TableNextColumn();
+      ImGui::Text("%.2f", millis(row.total));
+      ImGui::TableNextColumn();
+      ImGui::Text("%llu", static_cast<unsigned long long>(row.samples));
+    }
+    ImGui::EndTable();
+  }
+  ImGui::End();
+}